@@ -3,14 +3,54 @@
 
 layout(location=0) in vec3 position;
 
+// Per instance model matrix rows
+layout(location=3) in vec4 model_row0;
+layout(location=4) in vec4 model_row1;
+layout(location=5) in vec4 model_row2;
+
 out float illumination_amount;
 
-uniform mat4 mvp_transform;
-uniform float light_attenuation;
-uniform float light_intensity;
+#define MAX_POINT_LIGHTS 2
+
+struct Directional_Light {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct Point_Light {
+    vec3 position;
+    float constant;
+    float linear;
+    float quadratic;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// Shared with every shader, see Frame_Uniforms
+layout(std140) uniform Frame_Data {
+    Directional_Light directional_light;
+    Point_Light point_lights[MAX_POINT_LIGHTS];
+    vec3 fog_color;
+    float fog_density;
+    float fog_gradient;
+    float light_attenuation;
+    float light_intensity;
+};
+
+// Shared with every shader, see View_Uniforms
+layout(std140) uniform View_Data {
+    mat4 view_proj_transform;
+    mat4 sky_transform; // view projection without the camera translation
+    vec3 view_pos;
+};
 
 void main() {
-    vec4 world_position = mvp_transform*vec4(position, 1.0f);
+    vec4 local_position = vec4(position, 1.0f);
+    vec3 model_position = vec3(dot(model_row0, local_position), dot(model_row1, local_position), dot(model_row2, local_position));
+    vec4 world_position = view_proj_transform*vec4(model_position, 1.0f);
     illumination_amount = log(1.0f/(length(world_position)*light_attenuation))*light_intensity;
     gl_Position = world_position;
 }
@@ -10,20 +10,32 @@ layout(location=0) in vec3 a_pos;
 layout(location=1) in vec2 a_texcoord;
 layout(location=2) in vec3 a_normal;
 
+// Per instance model matrix and normal matrix rows
+layout(location=3) in vec4 a_model_row0;
+layout(location=4) in vec4 a_model_row1;
+layout(location=5) in vec4 a_model_row2;
+layout(location=6) in vec3 a_normal_row0;
+layout(location=7) in vec3 a_normal_row1;
+layout(location=8) in vec3 a_normal_row2;
+
 out vec3 frag_pos;
 out vec2 texcoord;
 out vec3 normal;
 
-uniform mat4 model_transform;
-uniform mat3 normal_transform;
-uniform mat4 mvp_transform;
+// Shared with every shader, see View_Uniforms
+layout(std140) uniform View_Data {
+    mat4 view_proj_transform;
+    mat4 sky_transform; // view projection without the camera translation
+    vec3 view_pos;
+};
 
 void main() {
-    frag_pos = vec3(model_transform * vec4(a_pos, 1.0f));
+    vec4 local_pos = vec4(a_pos, 1.0f);
+    frag_pos = vec3(dot(a_model_row0, local_pos), dot(a_model_row1, local_pos), dot(a_model_row2, local_pos));
     texcoord = a_texcoord;
-    normal = normalize(normal_transform * a_normal);
+    normal = normalize(vec3(dot(a_normal_row0, a_normal), dot(a_normal_row1, a_normal), dot(a_normal_row2, a_normal)));
 
-    gl_Position = mvp_transform * vec4(a_pos, 1.0f);
+    gl_Position = view_proj_transform * vec4(frag_pos, 1.0f);
 }
 
 /***************************************************************************
@@ -33,14 +45,14 @@ void main() {
 #shader GL_FRAGMENT_SHADER
 #version 330
 
-#define MAX_POINT_LIGHTS 2
-
 in vec3 frag_pos;
 in vec2 texcoord;
 in vec3 normal;
 
 out vec4 frag_color;
 
+#define MAX_POINT_LIGHTS 2
+
 struct Directional_Light {
     vec3 direction;
     vec3 ambient;
@@ -58,6 +70,24 @@ struct Point_Light {
     vec3 specular;
 };
 
+// Shared with every shader, see Frame_Uniforms
+layout(std140) uniform Frame_Data {
+    Directional_Light directional_light;
+    Point_Light point_lights[MAX_POINT_LIGHTS];
+    vec3 fog_color;
+    float fog_density;
+    float fog_gradient;
+    float light_attenuation;
+    float light_intensity;
+};
+
+// Shared with every shader, see View_Uniforms
+layout(std140) uniform View_Data {
+    mat4 view_proj_transform;
+    mat4 sky_transform; // view projection without the camera translation
+    vec3 view_pos;
+};
+
 struct Material {
     vec3 color;
     sampler2D diffuse;
@@ -67,14 +97,6 @@ struct Material {
 
 uniform Material material;
 
-uniform Directional_Light directional_light;
-uniform Point_Light point_lights[MAX_POINT_LIGHTS];
-uniform vec3 view_pos;
-
-uniform vec3 fog_color;
-uniform float fog_density;
-uniform float fog_gradient;
-
 
 vec3 calc_directional_light(Directional_Light light, vec3 view_dir) {
     vec3 light_dir = normalize(-light.direction);
@@ -14,11 +14,16 @@ out Fragment_Data {
     vec2 texcoord;
 } fragment;
 
-uniform mat4 vp_transform;
+// Shared with every shader, see View_Uniforms
+layout(std140) uniform View_Data {
+    mat4 view_proj_transform;
+    mat4 sky_transform; // view projection without the camera translation
+    vec3 view_pos;
+};
 
 void main() {
     fragment.texcoord = texcoord;
-    gl_Position = vp_transform * vec4(position, 1.0f);
+    gl_Position = sky_transform * vec4(position, 1.0f);
 }
 
 /***************************************************************************
@@ -34,17 +39,45 @@ in Fragment_Data {
 
 out vec4 frag_color;
 
+#define MAX_POINT_LIGHTS 2
+
+struct Directional_Light {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct Point_Light {
+    vec3 position;
+    float constant;
+    float linear;
+    float quadratic;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// Shared with every shader, see Frame_Uniforms
+layout(std140) uniform Frame_Data {
+    Directional_Light directional_light;
+    Point_Light point_lights[MAX_POINT_LIGHTS];
+    vec3 fog_color;
+    float fog_density;
+    float fog_gradient;
+    float light_attenuation;
+    float light_intensity;
+};
+
 // Material depandant uniforms
 struct Material {
     sampler2D map;
-    vec3 fog_color;
 };
 
 uniform Material material;
 
 void main() {
-    vec4 fog_color = vec4(material.fog_color, 1.0f);
     vec4 texel_color = texture2D(material.map, fragment.texcoord);
     float factor = 1.0f - exp(-pow(fragment.texcoord.y + 0.50f, 40.0f));
-    frag_color = mix(texel_color, fog_color, factor);
+    frag_color = mix(texel_color, vec4(fog_color, 1.0f), factor);
 }
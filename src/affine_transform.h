@@ -0,0 +1,128 @@
+
+/***************************************************************************
+ * Affine Transform
+ * A 4x4 matrix where the last row is always (0, 0, 0, 1), so only the
+ * upper 3x4 part is stored, 48 bytes instead of 64. Multiplying two of
+ * them, inverting them and computing the normal matrix is cheaper than
+ * the general mat4 versions since the last row is known. They are only
+ * expanded to mat4 when uploaded to the GPU, see affine_to_mat4.
+ ***************************************************************************/
+
+/**
+ * Stored row-major, each row holds the rotation/scale part in xyz and the
+ * translation in w, i.e. the point p is transformed by dot(rows[i], vec4(p, 1)).
+ */
+struct Affine_Transform {
+    glm::vec4 rows[3];
+};
+
+inline Affine_Transform
+affine_identity() {
+    Affine_Transform result;
+    result.rows[0] = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    result.rows[1] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+    result.rows[2] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    return result;
+}
+
+// NOTE(alexander): the last row of m is assumed to be (0, 0, 0, 1) and is ignored
+inline Affine_Transform
+affine_from_mat4(const glm::mat4& m) {
+    Affine_Transform result;
+    for (int i = 0; i < 3; i++) {
+        result.rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+    return result;
+}
+
+inline glm::mat4
+affine_to_mat4(const Affine_Transform& a) {
+    return glm::mat4(a.rows[0].x, a.rows[1].x, a.rows[2].x, 0.0f,
+                     a.rows[0].y, a.rows[1].y, a.rows[2].y, 0.0f,
+                     a.rows[0].z, a.rows[1].z, a.rows[2].z, 0.0f,
+                     a.rows[0].w, a.rows[1].w, a.rows[2].w, 1.0f);
+}
+
+inline glm::vec3
+affine_translation(const Affine_Transform& a) {
+    return glm::vec3(a.rows[0].w, a.rows[1].w, a.rows[2].w);
+}
+
+/**
+ * Same as a * b for the expanded matrices, each row of the result is a
+ * linear combination of the rows of b plus the translation of a.
+ */
+inline Affine_Transform
+affine_multiply(const Affine_Transform& a, const Affine_Transform& b) {
+    Affine_Transform result;
+    for (int i = 0; i < 3; i++) {
+        const glm::vec4& r = a.rows[i];
+        result.rows[i] = r.x*b.rows[0] + r.y*b.rows[1] + r.z*b.rows[2];
+        result.rows[i].w += r.w;
+    }
+    return result;
+}
+
+// NOTE(alexander): same as m * affine_to_mat4(a) without expanding a, e.g. view_proj * model
+inline glm::mat4
+affine_multiply(const glm::mat4& m, const Affine_Transform& a) {
+    glm::mat4 result;
+    for (int j = 0; j < 4; j++) {
+        result[j] = m[0]*a.rows[0][j] + m[1]*a.rows[1][j] + m[2]*a.rows[2][j];
+    }
+    result[3] += m[3];
+    return result;
+}
+
+inline glm::vec3
+affine_transform_point(const Affine_Transform& a, const glm::vec3& p) {
+    glm::vec4 v(p, 1.0f);
+    return glm::vec3(glm::dot(a.rows[0], v), glm::dot(a.rows[1], v), glm::dot(a.rows[2], v));
+}
+
+inline glm::vec3
+affine_transform_vector(const Affine_Transform& a, const glm::vec3& v) {
+    return glm::vec3(glm::dot(glm::vec3(a.rows[0]), v),
+                     glm::dot(glm::vec3(a.rows[1]), v),
+                     glm::dot(glm::vec3(a.rows[2]), v));
+}
+
+/**
+ * The rows of the inverse transpose of the 3x3 part are the cross products
+ * of its rows divided by the determinant, this is also the normal matrix.
+ */
+static inline void
+affine_inverse_transpose_rows(const Affine_Transform& a, glm::vec3* n0, glm::vec3* n1, glm::vec3* n2) {
+    glm::vec3 r0(a.rows[0]), r1(a.rows[1]), r2(a.rows[2]);
+    glm::vec3 c0 = glm::cross(r1, r2);
+    f32 inv_det = 1.0f/glm::dot(r0, c0); // NOTE(alexander): not finite for zero scale, same as glm::inverse
+    *n0 = c0*inv_det;
+    *n1 = glm::cross(r2, r0)*inv_det;
+    *n2 = glm::cross(r0, r1)*inv_det;
+}
+
+inline Affine_Transform
+affine_inverse(const Affine_Transform& a) {
+    glm::vec3 n0, n1, n2;
+    affine_inverse_transpose_rows(a, &n0, &n1, &n2);
+
+    // NOTE(alexander): the inverse of the 3x3 part has n0, n1, n2 as columns, the translation is -inverse*t
+    glm::vec3 t = affine_translation(a);
+    Affine_Transform result;
+    for (int i = 0; i < 3; i++) {
+        glm::vec3 row(n0[i], n1[i], n2[i]);
+        result.rows[i] = glm::vec4(row, -glm::dot(row, t));
+    }
+    return result;
+}
+
+/**
+ * The transpose of the inverse of the 3x3 part, used for transforming normals
+ * so they stay perpendicular to non-uniformly scaled surfaces.
+ */
+inline glm::mat3
+affine_normal_matrix(const Affine_Transform& a) {
+    glm::vec3 n0, n1, n2;
+    affine_inverse_transpose_rows(a, &n0, &n1, &n2);
+    return glm::transpose(glm::mat3(n0, n1, n2));
+}
@@ -9,6 +9,7 @@ struct Basic_3D_Graphics_Scene {
 
     World world;
     std::vector<System> main_systems;
+    System_Schedule main_schedule;
     std::vector<System> rendering_pipeline;
     Entity_Handle movable_cube;
     Entity_Handle camera;
@@ -77,6 +78,7 @@ initialize_scene(Basic_3D_Graphics_Scene* scene, Window* window) {
         auto renderer = add_component(world, entity, Mesh_Renderer);
         renderer->mesh = cuboid_mesh;
         renderer->material = material;
+        add_component(world, entity, World_Bounds);
     }
 
     // Create the movable cube entity
@@ -92,6 +94,7 @@ initialize_scene(Basic_3D_Graphics_Scene* scene, Window* window) {
     auto renderer = add_component(world, movable_cube, Mesh_Renderer);
     renderer->mesh = cuboid_mesh;
     renderer->material = material;
+    add_component(world, movable_cube, World_Bounds);
 
     // Create camera entity
     Entity_Handle camera = spawn_entity(world);
@@ -109,13 +112,15 @@ initialize_scene(Basic_3D_Graphics_Scene* scene, Window* window) {
 
     // Setup main systems
     System cube_controller = {};
+    cube_controller.name = "movable_cube_controller_system";
     cube_controller.on_update = &movable_cube_controller_system;
-    use_component(cube_controller, Movable_Cube_Controller);
+    use_component(cube_controller, Movable_Cube_Controller, System::Flag_Read_Only);
     use_component(cube_controller, Position);
     push_system(scene->main_systems, cube_controller);
 
     push_transform_systems(scene->main_systems);
     push_camera_systems(scene->main_systems);
+    scene->main_schedule = build_system_schedule(&scene->main_systems);
 
     // Setup rendering pipeline
     push_mesh_renderer_system(scene->rendering_pipeline, &scene->camera);
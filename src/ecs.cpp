@@ -1,11 +1,16 @@
 
 /***************************************************************************
- * Entity management
+ * Archetype storage
  ***************************************************************************/
 
-static constexpr usize default_component_capacity = 2; // TODO(alexander): tweak this
+static constexpr usize chunk_size = 16*1024; // in bytes
+static constexpr usize column_alignment = 32; // in bytes, minimum alignment so columns can use AVX loads
+static constexpr usize chunks_per_page = 64; // one bit per chunk in Chunk_Page::used_mask
+static constexpr usize page_alignment = 4096; // in bytes, chunks starts at the beginning of memory pages
+
+static constexpr usize min_removed_indices = 1024; // removed indices wait in line this long before they are reused, see can_reuse_entity_index
 
-static constexpr usize min_removed_indices = 1024;
+static constexpr u32 default_min_batch_size = 1024; // in entities, for parallel systems
 
 static constexpr usize entity_index_bits = 24;
 static constexpr usize entity_index_mask = (1<<entity_index_bits) - 1;
@@ -13,6 +18,637 @@ static constexpr usize entity_index_mask = (1<<entity_index_bits) - 1;
 static constexpr usize entity_generation_bits = 8;
 static constexpr usize entity_generation_mask = (1<<entity_generation_bits) - 1;
 
+static inline usize
+align_forward(usize offset, usize alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// NOTE(alexander): the system currently running on this thread, if any
+static thread_local const System* current_system = NULL;
+static thread_local u32 current_change_version = 0;
+static thread_local System_Stats* current_system_stats = NULL; // stats of current_system, NULL inside batches
+
+/**
+ * Version that writes on this thread are tagged with. Writes outside of systems uses
+ * the next version that will be handed out, so every system sees them on its next run.
+ */
+static inline u32
+get_write_version(World* world) {
+    return current_system ? current_change_version : world->change_version + 1;
+}
+
+// NOTE(alexander): handles the versions wrapping around
+static inline bool
+is_newer_version(u32 version, u32 than) {
+    return (i32) (version - than) > 0;
+}
+
+static void
+initialize_archetype_layout(Archetype* archetype) {
+    usize row_size = sizeof(Entity_Handle);
+    for (int i = 0; i < archetype->component_sizes.size(); i++) {
+        row_size += archetype->component_sizes[i];
+    }
+
+    // NOTE(alexander): start with the upper bound and shrink until it fits with padding
+    u32 capacity = (u32) ((chunk_size - sizeof(u32)*archetype->component_sizes.size())/row_size);
+    assert(capacity > 0 && "too many components to fit into a single chunk");
+    archetype->column_offsets.resize(archetype->component_sizes.size());
+    while (capacity > 0) {
+        usize offset = sizeof(Entity_Handle)*capacity;
+        for (int i = 0; i < archetype->component_sizes.size(); i++) {
+            usize alignment = max(column_alignment, component_infos[archetype->component_ids[i]].alignment);
+            offset = align_forward(offset, alignment);
+            archetype->column_offsets[i] = (u32) offset;
+            offset += archetype->component_sizes[i]*capacity;
+        }
+        offset = align_forward(offset, sizeof(u32));
+        archetype->change_versions_offset = (u32) offset;
+        offset += sizeof(u32)*archetype->component_sizes.size();
+
+        if (offset <= chunk_size) break;
+        capacity--;
+    }
+    archetype->chunk_capacity = capacity;
+
+    archetype->is_trivial = true;
+    for (int i = 0; i < archetype->component_ids.size(); i++) {
+        const Component_Info& info = component_infos[archetype->component_ids[i]];
+        assert(info.size == archetype->component_sizes[i] && "component size doesn't match the registered type");
+        assert(page_alignment % info.alignment == 0 && "component alignment is larger than the chunk alignment");
+        if (!info.is_trivial) archetype->is_trivial = false;
+    }
+}
+
+static Component_Mask
+get_component_mask(const u32* ids, usize count) {
+    Component_Mask mask = 0;
+    for (usize i = 0; i < count; i++) {
+        assert(ids[i] < max_component_types && "too many component types registered");
+        mask |= component_mask_bit(ids[i]);
+    }
+    return mask;
+}
+
+static inline bool
+is_matching_mask(Component_Mask mask, Component_Mask required, Component_Mask excluded) {
+    return (mask & required) == required && (mask & excluded) == 0;
+}
+
+static u32
+find_or_create_archetype(World* world, const std::vector<u32>& ids, const std::vector<u32>& sizes) {
+    // NOTE(alexander): the mask is unique per set of components, no need to compare the ids
+    Component_Mask mask = get_component_mask(ids.data(), ids.size());
+    for (u32 i = 0; i < world->archetypes.size(); i++) {
+        if (world->archetypes[i].component_mask == mask) {
+            return i;
+        }
+    }
+
+    Archetype archetype = {};
+    archetype.component_mask = mask;
+    archetype.component_ids = ids;
+    archetype.component_sizes = sizes;
+    initialize_archetype_layout(&archetype);
+
+    for (u32 i = 0; i < max_component_types; i++) {
+        archetype.component_columns[i] = -1;
+        archetype.add_edges[i] = -1;
+        archetype.remove_edges[i] = -1;
+    }
+    for (int i = 0; i < ids.size(); i++) {
+        archetype.component_columns[ids[i]] = i;
+    }
+    world->archetypes.push_back(archetype);
+    return (u32) world->archetypes.size() - 1;
+}
+
+static inline int
+find_component_column(const Archetype& archetype, u32 id) {
+    return archetype.component_columns[id];
+}
+
+static inline u8*
+get_component_column(const Archetype& archetype, const Chunk& chunk, int column) {
+    return chunk.data + archetype.column_offsets[column];
+}
+
+static inline Entity_Handle*
+get_entity_column(const Chunk& chunk) {
+    return (Entity_Handle*) chunk.data;
+}
+
+static inline u32*
+get_change_versions(const Archetype& archetype, const Chunk& chunk) {
+    return (u32*) (chunk.data + archetype.change_versions_offset);
+}
+
+// NOTE(alexander): marks every column as changed e.g. when rows are added or moved around
+static inline void
+mark_chunk_changed(World* world, const Archetype& archetype, const Chunk& chunk) {
+    u32 version = get_write_version(world);
+    u32* versions = get_change_versions(archetype, chunk);
+    for (int i = 0; i < archetype.component_ids.size(); i++) {
+        versions[i] = version;
+    }
+}
+
+inline Entity*
+get_entity(World* world, Entity_Handle handle);
+
+static inline u32
+get_entity_index(Entity_Handle entity);
+
+// NOTE(alexander): trivial components are zero initialized, the rest are value initialized
+static inline void
+construct_components(u32 id, u8* data, u32 count) {
+    const Component_Info& info = component_infos[id];
+    if (info.is_trivial) {
+        memset(data, 0, info.size*count);
+    } else {
+        info.construct(data, count);
+    }
+}
+
+// NOTE(alexander): dst must be uninitialized memory, src is left uninitialized afterwards
+static inline void
+relocate_components(u32 id, u8* dst, u8* src, u32 count) {
+    const Component_Info& info = component_infos[id];
+    if (info.is_trivial) {
+        memcpy(dst, src, info.size*count);
+    } else {
+        info.relocate(dst, src, count);
+    }
+}
+
+// NOTE(alexander): fills count components in dst with copies of the single component in src
+static inline void
+copy_components(u32 id, u8* dst, const u8* src, u32 count) {
+    const Component_Info& info = component_infos[id];
+    if (!info.is_trivial) {
+        info.copy(dst, src, count);
+        return;
+    }
+
+    // NOTE(alexander): doubles the copied range every time, so large fills are a few big memcpys
+    memcpy(dst, src, info.size);
+    u32 num_copied = 1;
+    while (num_copied < count) {
+        u32 num_rows = min(num_copied, count - num_copied);
+        memcpy(dst + num_copied*info.size, dst, num_rows*info.size);
+        num_copied += num_rows;
+    }
+}
+
+static inline void
+destroy_components(u32 id, u8* data, u32 count) {
+    const Component_Info& info = component_infos[id];
+    if (!info.is_trivial) {
+        info.destroy(data, count);
+    }
+}
+
+// NOTE(alexander): stored in the first bytes of chunks on the free list
+struct Free_Chunk {
+    u8* next;
+    u32 page;
+};
+
+static inline u32
+get_chunk_slot(const Chunk_Page& page, const u8* data) {
+    return (u32) ((data - page.data)/chunk_size);
+}
+
+static void
+add_chunk_page(Chunk_Pool* pool) {
+    Chunk_Page page = {};
+    page.memory = (u8*) malloc(chunks_per_page*chunk_size + page_alignment);
+    page.data = (u8*) align_forward((usize) page.memory, page_alignment);
+    pool->pages.push_back(page);
+
+    // NOTE(alexander): pushed in reverse so chunks are handed out in address order
+    for (usize i = chunks_per_page; i > 0; i--) {
+        Free_Chunk* free_chunk = (Free_Chunk*) (page.data + (i - 1)*chunk_size);
+        free_chunk->next = pool->free_list;
+        free_chunk->page = (u32) pool->pages.size() - 1;
+        pool->free_list = (u8*) free_chunk;
+    }
+}
+
+static void
+allocate_chunk(Chunk_Pool* pool, Chunk* chunk) {
+    if (!pool->free_list) {
+        add_chunk_page(pool);
+    }
+
+    Free_Chunk* free_chunk = (Free_Chunk*) pool->free_list;
+    pool->free_list = free_chunk->next;
+    chunk->data = (u8*) free_chunk;
+    chunk->page = free_chunk->page;
+    chunk->count = 0;
+
+    Chunk_Page& page = pool->pages[chunk->page];
+    page.used_mask |= (u64) 1 << get_chunk_slot(page, chunk->data);
+    pool->num_used_chunks++;
+}
+
+static void
+free_chunk(Chunk_Pool* pool, Chunk* chunk) {
+    Chunk_Page& page = pool->pages[chunk->page];
+    page.used_mask &= ~((u64) 1 << get_chunk_slot(page, chunk->data));
+    pool->num_used_chunks--;
+
+    Free_Chunk* free_chunk = (Free_Chunk*) chunk->data;
+    free_chunk->next = pool->free_list;
+    free_chunk->page = chunk->page;
+    pool->free_list = chunk->data;
+    chunk->data = NULL;
+}
+
+// NOTE(alexander): the hierarchy caches where the transforms of its entities are stored, see refresh_hierarchy_locations
+static inline void
+invalidate_hierarchy_location(World* world, Entity_Handle entity) {
+    const std::vector<u32>& depths = world->hierarchy.depths;
+    u32 index = get_entity_index(entity);
+    if (index < depths.size() && depths[index] != invalid_hierarchy_depth) {
+        world->hierarchy.are_locations_valid = false;
+    }
+}
+
+// NOTE(alexander): component data is left uninitialized, returns the chunk index
+static u32
+reserve_archetype_row(World* world, u32 archetype_index, Entity_Handle handle, u32* row) {
+    Archetype& archetype = world->archetypes[archetype_index];
+    if (archetype.chunks.size() == 0 ||
+        archetype.chunks[archetype.chunks.size() - 1].count == archetype.chunk_capacity) {
+        Chunk chunk = {};
+        allocate_chunk(&world->chunk_pool, &chunk);
+        archetype.chunks.push_back(chunk);
+    }
+
+    u32 chunk_index = (u32) archetype.chunks.size() - 1;
+    Chunk& chunk = archetype.chunks[chunk_index];
+    *row = chunk.count++;
+    get_entity_column(chunk)[*row] = handle;
+    mark_chunk_changed(world, archetype, chunk);
+    return chunk_index;
+}
+
+// NOTE(alexander): component data is constructed, returns the chunk index
+static u32
+allocate_archetype_row(World* world, u32 archetype_index, Entity_Handle handle, u32* row) {
+    u32 chunk_index = reserve_archetype_row(world, archetype_index, handle, row);
+    const Archetype& archetype = world->archetypes[archetype_index];
+    const Chunk& chunk = archetype.chunks[chunk_index];
+    for (int i = 0; i < archetype.component_ids.size(); i++) {
+        u32 size = archetype.component_sizes[i];
+        construct_components(archetype.component_ids[i], get_component_column(archetype, chunk, i) + *row*size, 1);
+    }
+    return chunk_index;
+}
+
+// NOTE(alexander): destroys every component in the row, use remove_archetype_row afterwards
+static void
+destroy_archetype_row(World* world, u32 archetype_index, u32 chunk_index, u32 row) {
+    const Archetype& archetype = world->archetypes[archetype_index];
+    if (archetype.is_trivial) return;
+
+    const Chunk& chunk = archetype.chunks[chunk_index];
+    for (int i = 0; i < archetype.component_ids.size(); i++) {
+        u32 size = archetype.component_sizes[i];
+        destroy_components(archetype.component_ids[i], get_component_column(archetype, chunk, i) + row*size, 1);
+    }
+}
+
+// NOTE(alexander): fills the hole with the very last row of the archetype (swap and pop),
+// the components in the row must already have been destroyed or moved out.
+static void
+remove_archetype_row(World* world, u32 archetype_index, u32 chunk_index, u32 row) {
+    Archetype& archetype = world->archetypes[archetype_index];
+    u32 last_chunk_index = (u32) archetype.chunks.size() - 1;
+    Chunk& chunk = archetype.chunks[chunk_index];
+    Chunk& last_chunk = archetype.chunks[last_chunk_index];
+    u32 last_row = last_chunk.count - 1;
+
+    if (chunk_index != last_chunk_index || row != last_row) {
+        Entity_Handle last = get_entity_column(last_chunk)[last_row];
+        get_entity_column(chunk)[row] = last;
+        for (int i = 0; i < archetype.component_sizes.size(); i++) {
+            u32 size = archetype.component_sizes[i];
+            relocate_components(archetype.component_ids[i],
+                                get_component_column(archetype, chunk, i) + row*size,
+                                get_component_column(archetype, last_chunk, i) + last_row*size,
+                                1);
+        }
+
+        Entity* last_entity = get_entity(world, last);
+        last_entity->chunk = chunk_index;
+        last_entity->row = row;
+        mark_chunk_changed(world, archetype, chunk);
+        invalidate_hierarchy_location(world, last);
+    }
+
+    last_chunk.count--;
+    if (last_chunk.count == 0) {
+        free_chunk(&world->chunk_pool, &last_chunk);
+        archetype.chunks.pop_back();
+    }
+}
+
+// NOTE(alexander): moves the entity and all the components it shares with the new archetype,
+// components that only exist in the new archetype are constructed and the rest are destroyed.
+static void
+move_entity_to_archetype(World* world, Entity* entity, u32 archetype_index) {
+    u32 row;
+    u32 chunk_index = reserve_archetype_row(world, archetype_index, entity->handle, &row);
+
+    Archetype& src = world->archetypes[entity->archetype];
+    Archetype& dst = world->archetypes[archetype_index];
+    Chunk& src_chunk = src.chunks[entity->chunk];
+    Chunk& dst_chunk = dst.chunks[chunk_index];
+
+    for (int i = 0; i < dst.component_ids.size(); i++) {
+        u32 size = dst.component_sizes[i];
+        u8* dst_data = get_component_column(dst, dst_chunk, i) + row*size;
+        int column = find_component_column(src, dst.component_ids[i]);
+        if (column >= 0) {
+            u8* src_data = get_component_column(src, src_chunk, column) + entity->row*size;
+            relocate_components(dst.component_ids[i], dst_data, src_data, 1);
+        } else {
+            construct_components(dst.component_ids[i], dst_data, 1);
+        }
+    }
+
+    for (int i = 0; i < src.component_ids.size(); i++) {
+        if (find_component_column(dst, src.component_ids[i]) < 0) {
+            u32 size = src.component_sizes[i];
+            destroy_components(src.component_ids[i], get_component_column(src, src_chunk, i) + entity->row*size, 1);
+        }
+    }
+
+    remove_archetype_row(world, entity->archetype, entity->chunk, entity->row);
+    entity->archetype = archetype_index;
+    entity->chunk = chunk_index;
+    entity->row = row;
+    invalidate_hierarchy_location(world, entity->handle);
+}
+
+// NOTE(alexander): copies the chunk to dst, non trivial components are moved one by one
+static void
+relocate_chunk(const Archetype& archetype, u8* dst, const Chunk& chunk) {
+    if (archetype.is_trivial) {
+        memcpy(dst, chunk.data, chunk_size);
+        return;
+    }
+
+    memcpy(dst, chunk.data, sizeof(Entity_Handle)*chunk.count);
+    memcpy(dst + archetype.change_versions_offset, get_change_versions(archetype, chunk),
+           sizeof(u32)*archetype.component_ids.size());
+    for (int i = 0; i < archetype.component_ids.size(); i++) {
+        u32 offset = archetype.column_offsets[i];
+        relocate_components(archetype.component_ids[i], dst + offset, chunk.data + offset, chunk.count);
+    }
+}
+
+// NOTE(alexander): links every unused chunk in address order of the pages
+static void
+rebuild_chunk_free_list(Chunk_Pool* pool) {
+    pool->free_list = NULL;
+    for (u32 i = (u32) pool->pages.size(); i > 0; i--) {
+        Chunk_Page& page = pool->pages[i - 1];
+        for (u32 slot = chunks_per_page; slot > 0; slot--) {
+            if (page.used_mask & ((u64) 1 << (slot - 1))) continue;
+            Free_Chunk* free_chunk = (Free_Chunk*) (page.data + (slot - 1)*chunk_size);
+            free_chunk->next = pool->free_list;
+            free_chunk->page = i - 1;
+            pool->free_list = (u8*) free_chunk;
+        }
+    }
+}
+
+static inline u32
+count_used_chunks(const Chunk_Page& page) {
+    u32 count = 0;
+    for (u64 mask = page.used_mask; mask; mask &= mask - 1) count++;
+    return count;
+}
+
+/**
+ * Moves chunks out of the least used pages into the free space of the most used ones
+ * and releases the emptied pages, leaving one page of free chunks to avoid reallocating.
+ * Chunk data changes address so component pointers are only valid until the next call,
+ * the app calls this once at the end of every frame, after both the main systems and
+ * the rendering pipeline has run. Entity rows stays the same.
+ */
+void
+compact_chunk_pool(World* world) {
+    assert(world->structural_change_locks == 0 && "cannot compact chunks while systems are iterating");
+    Chunk_Pool* pool = &world->chunk_pool;
+    u32 num_kept_pages = (u32) ((pool->num_used_chunks + chunks_per_page - 1)/chunks_per_page) + 1;
+    if (pool->pages.size() <= num_kept_pages) return;
+
+    std::vector<u32> order(pool->pages.size());
+    std::vector<u32> num_used(pool->pages.size());
+    for (u32 i = 0; i < pool->pages.size(); i++) {
+        order[i] = i;
+        num_used[i] = count_used_chunks(pool->pages[i]);
+    }
+    std::stable_sort(order.begin(), order.end(), [&num_used](u32 a, u32 b) {
+        return num_used[a] > num_used[b];
+    });
+
+    std::vector<Chunk_Page> pages(num_kept_pages);
+    std::vector<i32> page_remap(pool->pages.size(), -1);
+    for (u32 i = 0; i < num_kept_pages; i++) {
+        pages[i] = pool->pages[order[i]];
+        page_remap[order[i]] = (i32) i;
+    }
+
+    u32 dst_page = 0;
+    for (u32 i = 0; i < world->archetypes.size(); i++) {
+        Archetype& archetype = world->archetypes[i];
+        for (u32 c = 0; c < archetype.chunks.size(); c++) {
+            Chunk& chunk = archetype.chunks[c];
+            if (page_remap[chunk.page] >= 0) {
+                chunk.page = (u32) page_remap[chunk.page];
+                continue;
+            }
+
+            while (pages[dst_page].used_mask == ~(u64) 0) dst_page++;
+            Chunk_Page& page = pages[dst_page];
+            u32 slot = 0;
+            while (page.used_mask & ((u64) 1 << slot)) slot++;
+
+            u8* data = page.data + slot*chunk_size;
+            relocate_chunk(archetype, data, chunk);
+            page.used_mask |= (u64) 1 << slot;
+            chunk.data = data;
+            chunk.page = dst_page;
+            world->hierarchy.are_locations_valid = false;
+        }
+    }
+
+    for (u32 i = num_kept_pages; i < order.size(); i++) {
+        free(pool->pages[order[i]].memory);
+    }
+    pool->pages = pages;
+    rebuild_chunk_free_list(pool);
+}
+
+/***************************************************************************
+ * Component observers
+ ***************************************************************************/
+
+// NOTE(alexander): cheap when nothing is observed, only the observed components are recorded
+static void
+record_observer_events(World* world, Component_Observer::Event event, Component_Mask components,
+                       const Entity_Handle* entities, u32 count) {
+    Component_Mask observed = components & world->observed_masks[event];
+    for (u32 id = 0; observed != 0; id++, observed >>= 1) {
+        if ((observed & 1) == 0) continue;
+        std::vector<Entity_Handle>& pending = world->observer_events[event][id];
+        pending.insert(pending.end(), entities, entities + count);
+    }
+}
+
+static inline void
+record_chunk_observer_events(World* world, Component_Observer::Event event, const Archetype& archetype,
+                             const Chunk& chunk, u32 first_row, u32 count) {
+    if ((archetype.component_mask & world->observed_masks[event]) == 0) return;
+    record_observer_events(world, event, archetype.component_mask, get_entity_column(chunk) + first_row, count);
+}
+
+#define observe_component(world, type, event, on_event, data) \
+    _observe_component(world, type ## _ID, Component_Observer::event, on_event, data, #on_event)
+
+/**
+ * Calls on_event with the entities that the event happened to at every sync point,
+ * only changes made after the observer was added are reported.
+ */
+void
+_observe_component(World* world, u32 id, Component_Observer::Event event, OnObserveComponent on_event, void* data, const char* name) {
+    assert(id < max_component_types && "too many component types registered");
+    assert(event < Component_Observer::Num_Events && "invalid observer event");
+    assert(on_event && "observer is missing on_event function");
+
+    if (event == Component_Observer::On_Modified && world->observed_masks[event] == 0) {
+        world->observer_flush_version = ++world->change_version;
+    }
+
+    Component_Observer observer = {};
+    observer.name = name;
+    observer.data = data;
+    observer.on_event = on_event;
+    observer.component_id = id;
+    observer.event = event;
+    world->observers.push_back(observer);
+    world->observed_masks[event] |= component_mask_bit(id);
+}
+
+struct Observer_Batch {
+    Component_Observer::Event event;
+    u32 component_id;
+    u32 first; // into the flushed entities
+    u32 count;
+};
+
+static void
+push_observer_batch(std::vector<Observer_Batch>* batches, std::vector<Entity_Handle>* entities,
+                    Component_Observer::Event event, u32 id, u32 first) {
+    // NOTE(alexander): sorted so the order doesn't depend on the order of the changes, e.g. between threads,
+    // often they are already sorted since handles are mostly handed out in order
+    auto is_less = [](Entity_Handle a, Entity_Handle b) {
+        return a.id < b.id;
+    };
+    if (!std::is_sorted(entities->begin() + first, entities->end(), is_less)) {
+        std::sort(entities->begin() + first, entities->end(), is_less);
+    }
+    entities->erase(std::unique(entities->begin() + first, entities->end()), entities->end());
+    if (entities->size() == first) return;
+
+    Observer_Batch batch;
+    batch.event = event;
+    batch.component_id = id;
+    batch.first = first;
+    batch.count = (u32) entities->size() - first;
+    batches->push_back(batch);
+}
+
+/**
+ * Delivers the pending events to the observers, component by component with removals
+ * first, so an entity that had a component removed and added again ends up added.
+ * Entities that no longer have an added component are left out. Events caused
+ * by the observers themselves are delivered at the next sync point.
+ * Called by play_back_command_buffers.
+ */
+void
+flush_observers(World* world) {
+    assert(world->structural_change_locks == 0 && "cannot flush observers while systems are iterating");
+    if (world->observers.size() == 0) return;
+
+    std::vector<Entity_Handle> entities;
+    std::vector<Observer_Batch> batches;
+    const Component_Observer::Event recorded_events[] = { Component_Observer::On_Remove, Component_Observer::On_Add };
+    for (int e = 0; e < array_count(recorded_events); e++) {
+        Component_Observer::Event event = recorded_events[e];
+        for (u32 id = 0; id < max_component_types; id++) {
+            std::vector<Entity_Handle>& pending = world->observer_events[event][id];
+            if (pending.size() == 0) continue;
+
+            u32 first = (u32) entities.size();
+            for (int i = 0; i < pending.size(); i++) {
+                Entity_Handle entity = pending[i];
+                if (event == Component_Observer::On_Add &&
+                    (!is_alive(world, entity) || !_has_component(world, get_entity(world, entity), id))) {
+                    continue;
+                }
+                entities.push_back(entity);
+            }
+            pending.clear();
+            push_observer_batch(&batches, &entities, event, id, first);
+        }
+    }
+
+    Component_Mask modified = world->observed_masks[Component_Observer::On_Modified];
+    if (modified != 0) {
+        for (u32 id = 0; id < max_component_types; id++) {
+            if ((modified & component_mask_bit(id)) == 0) continue;
+
+            u32 first = (u32) entities.size();
+            for (u32 i = 0; i < world->archetypes.size(); i++) {
+                const Archetype& archetype = world->archetypes[i];
+                int column = find_component_column(archetype, id);
+                if (column < 0) continue;
+
+                for (u32 c = 0; c < archetype.chunks.size(); c++) {
+                    const Chunk& chunk = archetype.chunks[c];
+                    if (is_newer_version(get_change_versions(archetype, chunk)[column], world->observer_flush_version)) {
+                        const Entity_Handle* handles = get_entity_column(chunk);
+                        entities.insert(entities.end(), handles, handles + chunk.count);
+                    }
+                }
+            }
+            push_observer_batch(&batches, &entities, Component_Observer::On_Modified, id, first);
+        }
+
+        // NOTE(alexander): writes outside of systems are tagged with the next version, see get_write_version
+        world->observer_flush_version = ++world->change_version;
+    }
+
+    for (u32 i = 0; i < batches.size(); i++) {
+        const Observer_Batch& batch = batches[i];
+        for (u32 j = 0; j < world->observers.size(); j++) {
+            Component_Observer observer = world->observers[j]; // NOTE(alexander): copy, on_event may add observers
+            if (observer.event != batch.event || observer.component_id != batch.component_id) continue;
+            observer.on_event(world, entities.data() + batch.first, batch.count, observer.data);
+        }
+    }
+}
+
+/***************************************************************************
+ * Entity management
+ ***************************************************************************/
+
 static inline u32
 get_entity_index(Entity_Handle entity) {
     return entity.id & entity_index_mask;
@@ -37,138 +673,774 @@ get_entity(World* world, Entity_Handle handle) {
 
 inline bool
 is_alive(World* world, Entity_Handle entity) {
-    return world->generations[get_entity_index(entity)] == get_entity_generation(entity);
+    u32 index = get_entity_index(entity);
+    return index < world->generations.size() && world->generations[index] == get_entity_generation(entity);
 }
 
-Entity_Handle
-spawn_entity(World* world) {
+// NOTE(alexander): indices are only reused once there are enough of them, the generations are only
+// 8 bits so reusing an index right away would let a stale handle refer to a new entity after 256
+// spawns and despawns. Holding back the indices costs 4 KB and the entity arrays still stop growing.
+static inline bool
+can_reuse_entity_index(World* world) {
+    return world->removed_entity_indices.size() > min_removed_indices;
+}
+
+static Entity_Handle
+allocate_entity_handle(World* world) {
     u32 index;
-    if (world->removed_entity_indices.size() > min_removed_indices) {
+    if (can_reuse_entity_index(world)) {
         index = world->removed_entity_indices[0];
         world->removed_entity_indices.pop_front();
         world->handles[index] = (u32) world->entities.size();
     } else {
         index = (u32) world->generations.size();
-        assert(index < (1 << entity_index_bits));
+        assert(index < entity_index_mask);
         world->generations.push_back(0);
         world->handles.push_back((u32) world->entities.size());
     }
+    return make_entity_handle(index, world->generations[index]);
+}
+
+Entity_Handle
+spawn_entity(World* world) {
+    assert(world->structural_change_locks == 0 && "cannot spawn entities while systems are iterating");
+    assert(world->num_reserved_entities == 0 && "play back command buffers before spawning more entities");
+    if (world->archetypes.size() == 0) {
+        find_or_create_archetype(world, std::vector<u32>(), std::vector<u32>());
+    }
+
+    Entity entity = {};
+    Entity_Handle handle = allocate_entity_handle(world);
+    entity.handle = handle;
+    entity.archetype = 0; // NOTE(alexander): the empty archetype
+    entity.chunk = allocate_archetype_row(world, entity.archetype, handle, &entity.row);
+    world->entities.push_back(entity);
+    return handle;
+}
+
+#define add_template_component(archetype_template, type) \
+    _add_template_component(archetype_template, type ## _ID, type ## _SIZE)
+
+void
+_add_template_component(Archetype_Template* archetype_template, u32 id, usize size) {
+    auto& ids = archetype_template->component_ids;
+    auto& sizes = archetype_template->component_sizes;
+    usize insert_index = std::lower_bound(ids.begin(), ids.end(), id) - ids.begin();
+    assert((insert_index == ids.size() || ids[insert_index] != id) && "template can only have one component of each type");
+    ids.insert(ids.begin() + insert_index, id);
+    sizes.insert(sizes.begin() + insert_index, (u32) size);
+}
+
+/**
+ * Appends count rows to the archetype, storage is reserved up front and whole ranges
+ * of rows are filled in at once. Component i is copied from sources[i] in every row,
+ * or zero initialized if sources is NULL (see construct_components).
+ */
+static void
+spawn_archetype_rows(World* world, u32 archetype_index, u32 count, const u8* const* sources, Entity_Handle* out_handles) {
+    Archetype& archetype = world->archetypes[archetype_index];
+    u32 free_rows = 0;
+    if (archetype.chunks.size() > 0) {
+        free_rows = archetype.chunk_capacity - archetype.chunks[archetype.chunks.size() - 1].count;
+    }
+    if (count > free_rows) {
+        archetype.chunks.reserve(archetype.chunks.size() + (count - free_rows + archetype.chunk_capacity - 1)/archetype.chunk_capacity);
+    }
+    world->entities.reserve(world->entities.size() + count);
+    if (world->removed_entity_indices.size() <= min_removed_indices + count) {
+        world->generations.reserve(world->generations.size() + count);
+        world->handles.reserve(world->handles.size() + count);
+    }
+
+    u32 num_spawned = 0;
+    while (num_spawned < count) {
+        if (archetype.chunks.size() == 0 ||
+            archetype.chunks[archetype.chunks.size() - 1].count == archetype.chunk_capacity) {
+            Chunk chunk = {};
+            allocate_chunk(&world->chunk_pool, &chunk);
+            archetype.chunks.push_back(chunk);
+        }
+
+        u32 chunk_index = (u32) archetype.chunks.size() - 1;
+        Chunk& chunk = archetype.chunks[chunk_index];
+        u32 first_row = chunk.count;
+        u32 num_rows = min(count - num_spawned, archetype.chunk_capacity - chunk.count);
+        for (int i = 0; i < archetype.component_sizes.size(); i++) {
+            u32 size = archetype.component_sizes[i];
+            u8* column = get_component_column(archetype, chunk, i) + first_row*size;
+            if (sources) {
+                copy_components(archetype.component_ids[i], column, sources[i], num_rows);
+            } else {
+                construct_components(archetype.component_ids[i], column, num_rows);
+            }
+        }
+
+        Entity_Handle* handles = get_entity_column(chunk);
+        for (u32 row = first_row; row < first_row + num_rows; row++) {
+            Entity entity = {};
+            entity.handle = allocate_entity_handle(world);
+            entity.archetype = archetype_index;
+            entity.chunk = chunk_index;
+            entity.row = row;
+            world->entities.push_back(entity);
+
+            handles[row] = entity.handle;
+            if (out_handles) out_handles[num_spawned] = entity.handle;
+            num_spawned++;
+        }
+
+        chunk.count += num_rows;
+        mark_chunk_changed(world, archetype, chunk);
+        record_chunk_observer_events(world, Component_Observer::On_Add, archetype, chunk, first_row, num_rows);
+    }
+}
+
+/**
+ * Spawns count entities with all the components in the template (zero initialized).
+ * The handles of the new entities are written to out_handles, if not NULL.
+ */
+void
+spawn_entities(World* world, u32 count, const Archetype_Template* archetype_template, Entity_Handle* out_handles) {
+    assert(world->structural_change_locks == 0 && "cannot spawn entities while systems are iterating");
+    assert(world->num_reserved_entities == 0 && "play back command buffers before spawning more entities");
+    if (world->archetypes.size() == 0) {
+        find_or_create_archetype(world, std::vector<u32>(), std::vector<u32>());
+    }
+
+    u32 archetype_index = 0;
+    if (archetype_template) {
+        archetype_index = find_or_create_archetype(world, archetype_template->component_ids,
+                                                   archetype_template->component_sizes);
+    }
+    spawn_archetype_rows(world, archetype_index, count, NULL, out_handles);
+}
+
+void
+despawn_entity(World* world, Entity_Handle entity) {
+    assert(is_alive(world, entity) && "entity is already despawned");
+    assert(world->structural_change_locks == 0 && "cannot despawn entities while systems are iterating");
+    remove_from_hierarchy(world, entity);
+
+    u32 index = get_entity_index(entity);
+    u32 entity_index = world->handles[index];
+    Entity* removed = &world->entities[entity_index];
+    record_observer_events(world, Component_Observer::On_Remove, world->archetypes[removed->archetype].component_mask, &entity, 1);
+    destroy_archetype_row(world, removed->archetype, removed->chunk, removed->row);
+    remove_archetype_row(world, removed->archetype, removed->chunk, removed->row);
+
+    world->generations[index]++;
+    world->removed_entity_indices.push_back(index);
+
+    Entity& last = world->entities[world->entities.size() - 1];
+    world->handles[get_entity_index(last.handle)] = entity_index;
+    world->entities[entity_index] = last;
+    world->entities.pop_back();
+}
+
+/**
+ * Removes all the rows of the archetype at once. The rows that are kept after the new
+ * end of the archetype are moved into the holes before it (in any order, like swap and
+ * pop) and the chunks at the end are truncated, so every chunk is only compacted once.
+ * NOTE(alexander): every chunk but the last one is always full.
+ */
+static void
+remove_archetype_rows(World* world, u32 archetype_index, const Entity* removed, u32 count) {
+    Archetype& archetype = world->archetypes[archetype_index];
+    std::vector<Entity_Handle> handles(count);
+    for (u32 i = 0; i < count; i++) {
+        Entity_Handle* handle = get_entity_column(archetype.chunks[removed[i].chunk]) + removed[i].row;
+        assert(*handle != null_entity_handle && "entity is despawned twice");
+        destroy_archetype_row(world, archetype_index, removed[i].chunk, removed[i].row);
+        *handle = null_entity_handle; // NOTE(alexander): marks the row as removed
+        handles[i] = removed[i].handle;
+    }
+    record_observer_events(world, Component_Observer::On_Remove, archetype.component_mask, handles.data(), count);
+
+    u32 capacity = archetype.chunk_capacity;
+    u32 num_rows = ((u32) archetype.chunks.size() - 1)*capacity + archetype.chunks[archetype.chunks.size() - 1].count;
+    u32 new_num_rows = num_rows - count;
+
+    u32 src = new_num_rows;
+    for (u32 i = 0; i < count; i++) {
+        if (removed[i].chunk*capacity + removed[i].row >= new_num_rows) continue;
+
+        // NOTE(alexander): there are as many rows kept after the new end as there are holes before it
+        while (get_entity_column(archetype.chunks[src/capacity])[src % capacity] == null_entity_handle) src++;
+        Chunk& src_chunk = archetype.chunks[src/capacity];
+        Chunk& dst_chunk = archetype.chunks[removed[i].chunk];
+        u32 src_row = src % capacity;
+        u32 dst_row = removed[i].row;
+        src++;
+
+        Entity_Handle moved = get_entity_column(src_chunk)[src_row];
+        get_entity_column(dst_chunk)[dst_row] = moved;
+        for (int k = 0; k < archetype.component_sizes.size(); k++) {
+            u32 size = archetype.component_sizes[k];
+            relocate_components(archetype.component_ids[k],
+                                get_component_column(archetype, dst_chunk, k) + dst_row*size,
+                                get_component_column(archetype, src_chunk, k) + src_row*size,
+                                1);
+        }
+
+        Entity* moved_entity = get_entity(world, moved);
+        moved_entity->chunk = removed[i].chunk;
+        moved_entity->row = dst_row;
+        mark_chunk_changed(world, archetype, dst_chunk);
+        invalidate_hierarchy_location(world, moved);
+    }
+
+    u32 num_chunks = (new_num_rows + capacity - 1)/capacity;
+    for (u32 i = num_chunks; i < archetype.chunks.size(); i++) {
+        free_chunk(&world->chunk_pool, &archetype.chunks[i]);
+    }
+    archetype.chunks.resize(num_chunks);
+    if (num_chunks > 0) {
+        archetype.chunks[num_chunks - 1].count = new_num_rows - (num_chunks - 1)*capacity;
+    }
+}
+
+/**
+ * Despawns all the entities, they are grouped by archetype (counting sort) and the
+ * rows of each archetype are removed together, see remove_archetype_rows.
+ * The entity indices are freed in one pass afterwards.
+ */
+void
+despawn_entities(World* world, const Entity_Handle* handles, u32 count) {
+    assert(world->structural_change_locks == 0 && "cannot despawn entities while systems are iterating");
+    std::vector<Entity> entities(count);
+    std::vector<u32> offsets(world->archetypes.size() + 1, 0);
+    for (u32 i = 0; i < count; i++) {
+        assert(is_alive(world, handles[i]) && "entity is already despawned");
+        remove_from_hierarchy(world, handles[i]);
+        entities[i] = *get_entity(world, handles[i]);
+        offsets[entities[i].archetype + 1]++;
+    }
+    for (u32 i = 1; i < offsets.size(); i++) {
+        offsets[i] += offsets[i - 1];
+    }
+
+    std::vector<Entity> sorted(count);
+    std::vector<u32> next(offsets.begin(), offsets.end() - 1);
+    for (u32 i = 0; i < count; i++) {
+        sorted[next[entities[i].archetype]++] = entities[i];
+    }
+    for (u32 i = 0; i + 1 < offsets.size(); i++) {
+        if (offsets[i + 1] > offsets[i]) {
+            remove_archetype_rows(world, i, &sorted[offsets[i]], offsets[i + 1] - offsets[i]);
+        }
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        u32 index = get_entity_index(handles[i]);
+        u32 entity_index = world->handles[index];
+        world->generations[index]++;
+        world->removed_entity_indices.push_back(index);
+
+        Entity& last = world->entities[world->entities.size() - 1];
+        world->handles[get_entity_index(last.handle)] = entity_index;
+        world->entities[entity_index] = last;
+        world->entities.pop_back();
+    }
+}
+
+/**
+ * Despawns every entity and releases all the chunk memory, the archetypes are kept
+ * (but empty) so the archetypes cached by systems are still valid.
+ */
+void
+clear_world(World* world) {
+    assert(world->structural_change_locks == 0 && "cannot clear the world while systems are iterating");
+    assert(world->num_reserved_entities == 0 && "play back command buffers before clearing the world");
+
+    for (u32 i = 0; i < world->archetypes.size(); i++) {
+        Archetype& archetype = world->archetypes[i];
+        for (u32 c = 0; c < archetype.chunks.size(); c++) {
+            record_chunk_observer_events(world, Component_Observer::On_Remove, archetype, archetype.chunks[c], 0, archetype.chunks[c].count);
+        }
+        if (!archetype.is_trivial) {
+            for (u32 c = 0; c < archetype.chunks.size(); c++) {
+                const Chunk& chunk = archetype.chunks[c];
+                for (int k = 0; k < archetype.component_ids.size(); k++) {
+                    destroy_components(archetype.component_ids[k], get_component_column(archetype, chunk, k), chunk.count);
+                }
+            }
+        }
+        archetype.chunks.clear();
+    }
+
+    Chunk_Pool* pool = &world->chunk_pool;
+    for (u32 i = 0; i < pool->pages.size(); i++) {
+        free(pool->pages[i].memory); // NOTE(alexander): NULL for pages adopted from a snapshot
+    }
+    if (pool->mapped_memory) {
+        unmap_file(pool->mapped_memory, pool->mapped_size);
+    }
+    pool->pages.clear();
+    pool->free_list = NULL;
+    pool->num_used_chunks = 0;
+    pool->mapped_memory = NULL;
+    pool->mapped_size = 0;
+
+    world->generations.clear();
+    world->removed_entity_indices.clear();
+    world->entities.clear();
+    world->handles.clear();
+    world->hierarchy.levels.clear();
+    world->hierarchy.nodes.clear();
+    world->hierarchy.depths.clear();
+    world->hierarchy.indices.clear();
+    world->hierarchy.are_locations_valid = false;
+}
+
+/***************************************************************************
+ * Component management
+ ***************************************************************************/
+
+#ifndef NDEBUG
+static void
+check_component_access(u32 id) {
+    if (!current_system) return;
+    for (int i = 0; i < current_system->component_ids.size(); i++) {
+        if (current_system->component_ids[i] == id) return;
+    }
+    assert(0 && "system accessed a component that it did not declare, see use_component");
+}
+#else
+#define check_component_access(id)
+#endif
+
+static inline bool
+is_read_only_access(u32 id) {
+    return current_system && (current_system->read_only_mask & component_mask_bit(id)) != 0;
+}
+
+#define add_component(world, handle, type) \
+    (type*) _add_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE)
+#define remove_component(world, handle, type) \
+    _remove_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE)
+#define get_component(world, handle, type) \
+    (type*) _get_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE)
+#define has_component(world, handle, type) \
+    _has_component(world, get_entity(world, handle), type ## _ID)
+
+void*
+_add_component(World* world, Entity* entity, u32 id, usize size) {
+    assert(is_alive(world, entity->handle) && "cannot add component to despawned entity");
+    check_component_access(id);
+    assert(world->structural_change_locks == 0 && "cannot add components while systems are iterating");
+    assert(find_component_column(world->archetypes[entity->archetype], id) == -1 &&
+           "entity can only have one component of each type");
+
+    i32 archetype_index = world->archetypes[entity->archetype].add_edges[id];
+    if (archetype_index < 0) {
+        std::vector<u32> ids = world->archetypes[entity->archetype].component_ids;
+        std::vector<u32> sizes = world->archetypes[entity->archetype].component_sizes;
+        usize insert_index = std::lower_bound(ids.begin(), ids.end(), id) - ids.begin();
+        ids.insert(ids.begin() + insert_index, id);
+        sizes.insert(sizes.begin() + insert_index, (u32) size);
+
+        archetype_index = (i32) find_or_create_archetype(world, ids, sizes);
+        world->archetypes[entity->archetype].add_edges[id] = archetype_index;
+    }
+
+    move_entity_to_archetype(world, entity, (u32) archetype_index);
+    record_observer_events(world, Component_Observer::On_Add, component_mask_bit(id), &entity->handle, 1);
+    return _get_component(world, entity, id, size);
+}
+
+bool
+_remove_component(World* world, Entity* entity, u32 id, usize size) {
+    assert(is_alive(world, entity->handle) && "cannot remove component from despawned entity");
+    check_component_access(id);
+    assert(world->structural_change_locks == 0 && "cannot remove components while systems are iterating");
+
+    int column = find_component_column(world->archetypes[entity->archetype], id);
+    if (column < 0) {
+        return false;
+    }
+
+    i32 archetype_index = world->archetypes[entity->archetype].remove_edges[id];
+    if (archetype_index < 0) {
+        std::vector<u32> ids = world->archetypes[entity->archetype].component_ids;
+        std::vector<u32> sizes = world->archetypes[entity->archetype].component_sizes;
+        ids.erase(ids.begin() + column);
+        sizes.erase(sizes.begin() + column);
+
+        archetype_index = (i32) find_or_create_archetype(world, ids, sizes);
+        world->archetypes[entity->archetype].remove_edges[id] = archetype_index;
+    }
+
+    move_entity_to_archetype(world, entity, (u32) archetype_index);
+    record_observer_events(world, Component_Observer::On_Remove, component_mask_bit(id), &entity->handle, 1);
+    return true;
+}
+
+void*
+_get_component(World* world, Entity* entity, u32 id, usize size) {
+    assert(is_alive(world, entity->handle) && "cannot get component from despawned entity");
+    check_component_access(id);
+
+    const Archetype& archetype = world->archetypes[entity->archetype];
+    int column = find_component_column(archetype, id);
+    if (column < 0) {
+        return NULL;
+    }
+
+    // NOTE(alexander): the caller may write to the component, unless the system declared it read only
+    const Chunk& chunk = archetype.chunks[entity->chunk];
+    if (!is_read_only_access(id)) {
+        get_change_versions(archetype, chunk)[column] = get_write_version(world);
+    }
+    return get_component_column(archetype, chunk, column) + entity->row*size;
+}
+
+/**
+ * Same as get_component but for reading only, so it won't be marked as changed.
+ */
+#define read_component(world, handle, type) \
+    ((const type*) _read_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE))
+
+const void*
+_read_component(World* world, Entity* entity, u32 id, usize size) {
+    assert(is_alive(world, entity->handle) && "cannot read component from despawned entity");
+    check_component_access(id);
+
+    const Archetype& archetype = world->archetypes[entity->archetype];
+    int column = find_component_column(archetype, id);
+    if (column < 0) {
+        return NULL;
+    }
+
+    const Chunk& chunk = archetype.chunks[entity->chunk];
+    return get_component_column(archetype, chunk, column) + entity->row*size;
+}
+
+inline bool
+_has_component(World* world, Entity* entity, u32 id) {
+    return find_component_column(world->archetypes[entity->archetype], id) >= 0;
+}
+
+/***************************************************************************
+ * Entity command buffer
+ ***************************************************************************/
+
+#define cmd_add_component(cmd, handle, type) \
+    (type*) _cmd_add_component(cmd, handle, type ## _ID, type ## _SIZE)
+#define cmd_remove_component(cmd, handle, type) \
+    _cmd_remove_component(cmd, handle, type ## _ID, type ## _SIZE)
+
+static void
+reserve_command_buffers(World* world) {
+    usize num_buffers = world->job_system ? get_num_job_threads(world->job_system) : 1;
+    if (world->command_buffers.size() < num_buffers) {
+        assert(world->structural_change_locks == 0 && "command buffers has to be created before systems are run");
+        world->command_buffers.resize(num_buffers);
+    }
+}
+
+// NOTE(alexander): each thread records into its own buffer so no locking is needed
+Entity_Command_Buffer*
+get_command_buffer(World* world) {
+    reserve_command_buffers(world);
+    usize index = world->job_system ? get_job_thread_index(world->job_system) : 0;
+    return &world->command_buffers[index];
+}
+
+static inline void
+push_entity_command(Entity_Command_Buffer* cmd, Entity_Command::Type type, Entity_Handle handle, u32 id, usize size) {
+    Entity_Command command = {};
+    command.type = type;
+    command.handle = handle;
+    command.component_id = id;
+    command.component_size = (u32) size;
+    cmd->commands.push_back(command);
+}
+
+/**
+ * The returned handle can be used in other commands right away, the entity
+ * itself is spawned when the command buffer is played back. Until then the
+ * handle shouldn't be passed to anything but other commands.
+ */
+Entity_Handle
+cmd_spawn_entity(Entity_Command_Buffer* cmd, World* world) {
+    // NOTE(alexander): same index reuse as allocate_entity_handle, new indices are only
+    // reserved here, the entity arrays can't grow while systems are iterating them
+    u32 index;
+    u8 generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(world->reserved_entities_mutex);
+        if (can_reuse_entity_index(world)) {
+            index = world->removed_entity_indices[0];
+            world->removed_entity_indices.pop_front();
+            generation = world->generations[index];
+        } else {
+            index = (u32) world->generations.size() + world->num_reserved_new_indices++;
+            assert(index < entity_index_mask);
+        }
+        world->num_reserved_entities++;
+    }
 
-    Entity entity = {};
-    Entity_Handle handle = make_entity_handle(index, world->generations[index]);
-    entity.handle = handle;
-    world->entities.push_back(entity);
+    Entity_Handle handle = make_entity_handle(index, generation);
+    push_entity_command(cmd, Entity_Command::Spawn, handle, 0, 0);
     return handle;
 }
 
 void
-despawn_entity(World* world, Entity_Handle entity) {
-    u32 index = get_entity_index(entity);
-    world->generations[index]++;
-    world->removed_entity_indices.push_back(index);
-
-    u32 entity_index = world->handles[index];
-    world->entities[entity_index] = world->entities[world->entities.size() - 1];
-    world->handles[index] = entity_index;
-    world->entities.pop_back();
-    world->handles.pop_back();
+cmd_despawn_entity(Entity_Command_Buffer* cmd, Entity_Handle entity) {
+    push_entity_command(cmd, Entity_Command::Despawn, entity, 0, 0);
 }
 
-/***************************************************************************
- * Component management
- ***************************************************************************/
+// NOTE(alexander): returns zeroed component data to fill in, trivial components are
+// only valid until the next command is pushed. Non trivial components are value initialized
+// in their own allocation and copied into the entity when the command is played back.
+void*
+_cmd_add_component(Entity_Command_Buffer* cmd, Entity_Handle entity, u32 id, usize size) {
+    push_entity_command(cmd, Entity_Command::Add_Component, entity, id, size);
+    const Component_Info& info = component_infos[id];
+    if (!info.is_trivial) {
+        assert(info.alignment <= alignof(std::max_align_t) && "component is aligned more than malloc guarantees");
+        u8* object = (u8*) malloc(size);
+        construct_components(id, object, 1);
+        cmd->commands[cmd->commands.size() - 1].data_offset = (u32) cmd->objects.size();
+        cmd->objects.push_back(object);
+        return object;
+    }
 
-#define add_component(world, handle, type) \
-    (type*) _add_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE)
-#define remove_component(world, handle, type) \
-    _remove_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE)
-#define get_component(world, handle, type) \
-    (type*) _get_component(world, get_entity(world, handle), type ## _ID, type ## _SIZE)
+    usize offset = align_forward(cmd->data.size(), column_alignment);
+    cmd->commands[cmd->commands.size() - 1].data_offset = (u32) offset;
+    cmd->data.resize(offset + size, 0);
+    return &cmd->data[offset];
+}
 
-void*
-_add_component(World* world, Entity* entity, u32 id, usize size) {
-    assert(is_alive(world, entity->handle) && "cannot add component to despawned entity");
+void
+_cmd_remove_component(Entity_Command_Buffer* cmd, Entity_Handle entity, u32 id, usize size) {
+    push_entity_command(cmd, Entity_Command::Remove_Component, entity, id, size);
+}
 
-    if (world->components.find(id) == world->components.end()) {
-        world->components[id].reserve(size*default_component_capacity);
-    }
+// NOTE(alexander): reference to a recorded command, sorted by entity and then component
+struct Sorted_Entity_Command {
+    u64 key; // entity handle in the upper 32 bits and the component id in the lower
+    u32 buffer; // index into World::command_buffers
+    u32 command;
+};
+
+/**
+ * Applies the commands recorded by every thread, then notifies the observers.
+ * The commands are sorted by entity (and component) so all the adds and removes
+ * of an entity are folded into the archetype it ends up in and it's moved only
+ * once, spawned entities are created directly in that archetype. Commands on the
+ * same component are applied in the order they were recorded, the last recorded
+ * data is kept. Called by update_systems after all systems have finished.
+ */
+void
+play_back_command_buffers(World* world) {
+    assert(world->structural_change_locks == 0 && "cannot play back command buffers while systems are iterating");
 
-    std::vector<u8>& memory = world->components[id];
-    usize curr_size = memory.size();
-    memory.resize(curr_size + size); // TODO(alexander): use custom allocator
+    if (world->archetypes.size() == 0) {
+        find_or_create_archetype(world, std::vector<u32>(), std::vector<u32>());
+    }
 
-    // NOTE(alexander): each component data needs to keep track of its owner handle
-    *((Entity_Handle*) &memory[curr_size]) = entity->handle;
-    curr_size += sizeof(Entity_Handle);
+    // NOTE(alexander): the reserved indices that didn't reuse a removed index are added at the end
+    usize num_indices = world->generations.size() + world->num_reserved_new_indices;
+    world->generations.resize(num_indices, 0);
+    world->handles.resize(num_indices);
+    world->entities.reserve(world->entities.size() + world->num_reserved_entities);
+    world->num_reserved_entities = 0;
+    world->num_reserved_new_indices = 0;
+
+    std::vector<Sorted_Entity_Command> sorted;
+    for (u32 i = 0; i < world->command_buffers.size(); i++) {
+        const Entity_Command_Buffer& cmd = world->command_buffers[i];
+        for (u32 j = 0; j < cmd.commands.size(); j++) {
+            Sorted_Entity_Command sorted_command;
+            sorted_command.key = ((u64) cmd.commands[j].handle.id << 32) | cmd.commands[j].component_id;
+            sorted_command.buffer = i;
+            sorted_command.command = j;
+            sorted.push_back(sorted_command);
+        }
+    }
 
-    Component_Handle component = { (u32) id, curr_size };
-    entity->components.push_back(component);
-    return &memory[curr_size];
-}
+    // NOTE(alexander): stable so the commands on the same component stay in the recorded order
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Sorted_Entity_Command& a, const Sorted_Entity_Command& b) {
+        return a.key < b.key;
+    });
+
+    std::vector<u32> ids;
+    std::vector<u32> component_sizes;
+    u32 sizes[max_component_types];
+    u32 prev_archetype = 0;
+    Component_Mask prev_target_mask = 0;
+    u32 target_archetype = 0;
+
+    usize end = 0;
+    for (usize begin = 0; begin < sorted.size(); begin = end) {
+        end = begin + 1;
+        while (end < sorted.size() && (sorted[end].key >> 32) == (sorted[begin].key >> 32)) end++;
+
+        // Fold the adds and removes into the components the entity ends up with
+        Entity_Handle handle = world->command_buffers[sorted[begin].buffer].commands[sorted[begin].command].handle;
+        bool is_spawned = false;
+        bool is_despawned = false;
+        Component_Mask target_mask = 0;
+        Component_Mask removed_mask = 0;
+        for (usize i = begin; i < end; i++) {
+            const Entity_Command& command = world->command_buffers[sorted[i].buffer].commands[sorted[i].command];
+            Component_Mask bit = component_mask_bit(command.component_id);
+            switch (command.type) {
+                case Entity_Command::Spawn: {
+                    is_spawned = true;
+                } break;
+
+                case Entity_Command::Despawn: {
+                    is_despawned = true;
+                } break;
+
+                case Entity_Command::Add_Component: {
+                    target_mask |= bit;
+                    sizes[command.component_id] = command.component_size;
+                } break;
+
+                case Entity_Command::Remove_Component: {
+                    target_mask &= ~bit;
+                    removed_mask |= bit;
+                } break;
+            }
+        }
 
-bool
-_remove_component(World* world, Entity* entity, u32 id, usize size) {
-    assert(is_alive(world, entity->handle) && "cannot remove component from despawned entity");
+        u32 index = get_entity_index(handle);
+        if (!is_spawned && !is_alive(world, handle)) continue;
+        if (is_despawned) {
+            if (is_spawned) {
+                // NOTE(alexander): never spawned, the index is released right away
+                world->generations[index]++;
+                world->removed_entity_indices.push_back(index);
+            } else {
+                despawn_entity(world, handle);
+            }
+            continue;
+        }
 
-    for (int i = 0; i < entity->components.size(); i++) {
-        Component_Handle& component = entity->components[i];
-
-        if (component.id == id) {
-            std::vector<u8>& memory = world->components[id]; // TODO(alexander): use custom allocator
-            usize index = component.offset - sizeof(Entity_Handle);
-            usize last_index = memory.size() - size - sizeof(Entity_Handle);
-            Entity_Handle* last = (Entity_Handle*) &memory[last_index];
-
-            if (index != last_index) {
-                Entity* last_entity = get_entity(world, *last);
-                for (auto last_component : last_entity->components) {
-                    if (last_component.id == component.id && last_component.offset == last_index) {
-                        last_component.offset = component.offset;
-                        break;
-                    }
+        // NOTE(alexander): spawned entities start out in the empty archetype without being added to it
+        Entity* entity = is_spawned ? NULL : get_entity(world, handle);
+        u32 current_archetype = is_spawned ? 0 : entity->archetype;
+        Component_Mask current_mask = world->archetypes[current_archetype].component_mask;
+
+        // NOTE(alexander): removed and then added again, the new component starts over
+        Component_Mask replaced_mask = current_mask & removed_mask & target_mask;
+        target_mask |= current_mask & ~removed_mask;
+
+        if (target_mask != current_mask || is_spawned) {
+            // NOTE(alexander): entities in the same archetype often get the same commands, e.g. from the same system
+            if (current_archetype != prev_archetype || target_mask != prev_target_mask) {
+                const Archetype& archetype = world->archetypes[current_archetype];
+                ids.clear();
+                component_sizes.clear();
+                for (u32 id = 0; id < max_component_types; id++) {
+                    if ((target_mask & component_mask_bit(id)) == 0) continue;
+                    int column = find_component_column(archetype, id);
+                    ids.push_back(id);
+                    component_sizes.push_back(column >= 0 ? archetype.component_sizes[column] : sizes[id]);
                 }
-
-                memcpy(&memory[component.id], last, size);
+                prev_archetype = current_archetype;
+                prev_target_mask = target_mask;
+                target_archetype = find_or_create_archetype(world, ids, component_sizes);
             }
 
-            memory.resize(last_index);
+            if (is_spawned) {
+                Entity spawned = {};
+                spawned.handle = handle;
+                spawned.archetype = target_archetype;
+                spawned.chunk = allocate_archetype_row(world, target_archetype, handle, &spawned.row);
+                world->handles[index] = (u32) world->entities.size();
+                world->entities.push_back(spawned);
+                entity = &world->entities[world->entities.size() - 1];
+            } else {
+                move_entity_to_archetype(world, entity, target_archetype);
+            }
+        }
 
-            entity->components[i] = entity->components[entity->components.size() - 1];
-            entity->components.pop_back();
+        if (replaced_mask) {
+            const Archetype& archetype = world->archetypes[entity->archetype];
+            const Chunk& chunk = archetype.chunks[entity->chunk];
+            for (int i = 0; i < archetype.component_ids.size(); i++) {
+                u32 id = archetype.component_ids[i];
+                if ((replaced_mask & component_mask_bit(id)) == 0) continue;
+                u8* data = get_component_column(archetype, chunk, i) + entity->row*archetype.component_sizes[i];
+                destroy_components(id, data, 1);
+                construct_components(id, data, 1);
+            }
         }
-    }
 
-    return false;
-}
+        record_observer_events(world, Component_Observer::On_Remove, (current_mask & ~target_mask) | replaced_mask, &handle, 1);
+        record_observer_events(world, Component_Observer::On_Add, (target_mask & ~current_mask) | replaced_mask, &handle, 1);
 
-void*
-_get_component(World* world, Entity* entity, u32 id, usize size) {
-    assert(is_alive(world, entity->handle) && "cannot get component from despawned entity");
+        for (usize i = begin; i < end; i++) {
+            const Entity_Command_Buffer& cmd = world->command_buffers[sorted[i].buffer];
+            const Entity_Command& command = cmd.commands[sorted[i].command];
+            if (command.type != Entity_Command::Add_Component ||
+                (target_mask & component_mask_bit(command.component_id)) == 0) {
+                continue;
+            }
 
-    for (int i = 0; i < entity->components.size(); i++) {
-        Component_Handle& component = entity->components[i];
+            u8* component = (u8*) _get_component(world, entity, command.component_id, command.component_size);
+            if (component_infos[command.component_id].is_trivial) {
+                memcpy(component, &cmd.data[command.data_offset], command.component_size);
+            } else {
+                destroy_components(command.component_id, component, 1);
+                copy_components(command.component_id, component, cmd.objects[command.data_offset], 1);
+            }
+        }
+    }
 
-        if (component.id == id) {
-            std::vector<u8>& memory = world->components[id];
-            return &memory[component.offset];
+    for (int i = 0; i < world->command_buffers.size(); i++) {
+        Entity_Command_Buffer& cmd = world->command_buffers[i];
+        for (int j = 0; j < cmd.commands.size(); j++) {
+            const Entity_Command& command = cmd.commands[j];
+            if (command.type == Entity_Command::Add_Component && !component_infos[command.component_id].is_trivial) {
+                destroy_components(command.component_id, cmd.objects[command.data_offset], 1);
+                free(cmd.objects[command.data_offset]);
+            }
         }
+        cmd.commands.clear();
+        cmd.data.clear();
+        cmd.objects.clear();
     }
 
-    return NULL;
+    flush_observers(world);
 }
 
 /***************************************************************************
  * Systems management
  ***************************************************************************/
 
+// NOTE(alexander): flags are optional, the ## removes the trailing comma when they are left out
 #define use_component(system, type, ...) \
-    _use_component(system, type ## _ID, type ## _SIZE, __VA_ARGS__)
+    _use_component(system, type ## _ID, type ## _SIZE, ##__VA_ARGS__)
 
 void
 _use_component(System& system, u32 id, u32 size, u32 flags) {
+    assert(id < max_component_types && "too many component types registered");
+
+    // NOTE(alexander): a component that is used more than once is only read only if every use is
+    bool is_used = std::find(system.component_ids.begin(), system.component_ids.end(), id) != system.component_ids.end();
+    if ((flags & System::Flag_Read_Only) == 0) {
+        system.read_only_mask &= ~component_mask_bit(id);
+    } else if (!is_used) {
+        system.read_only_mask |= component_mask_bit(id);
+    }
+
     system.component_ids.push_back(id);
     system.component_sizes.push_back(size);
     system.component_flags.push_back(flags);
+
+    if (flags & System::Flag_Exclude) {
+        assert((flags & ~System::Flag_Exclude) == 0 && "excluded components cannot be combined with other flags");
+        system.excluded_mask |= component_mask_bit(id);
+    } else if (flags & System::Flag_Optional) {
+        system.optional_mask |= component_mask_bit(id);
+    } else if ((flags & System::Flag_Random_Access) == 0) {
+        system.required_mask |= component_mask_bit(id);
+    }
 }
 
 void
@@ -176,220 +1448,775 @@ push_system(std::vector<System>& systems, System system) {
     assert(system.component_ids.size() > 0 && "expected system to use at least one component");
     bool is_valid = false;
     for (int i = 0; i < system.component_flags.size(); i++) {
-        if ((system.component_flags[i] & System::Flag_Optional) == 0) {
+        if ((system.component_flags[i] & (System::Flag_Optional | System::Flag_Exclude)) == 0) {
             is_valid = true;
             break;
         }
     }
-    assert(is_valid && "invalid system, all components cannot be optional");
+    assert(is_valid && "invalid system, all components cannot be optional or excluded");
+    assert((system.required_mask & system.excluded_mask) == 0 && "system cannot both require and exclude a component");
+    assert((system.on_update || system.on_query) && "system is missing on_update or on_query function");
     systems.push_back(system);
 }
 
-void
-update_systems(World* world, const std::vector<System>& systems, f32 dt) {
-    std::vector<void*> component_params;
-    std::vector<std::vector<u8>*> component_data;
+/***************************************************************************
+ * Parallel iteration
+ ***************************************************************************/
 
-    for (u32 i = 0; i < systems.size(); i++) {
-        const System& system = systems[i];
-        assert(system.on_update && "system is missing on_update function");
+struct Matched_Chunk {
+    const Archetype* archetype;
+    const Chunk* chunk;
+};
+
+/**
+ * Checks the archetypes created since the system last ran and caches the ones matching
+ * its component masks, moving entities between existing archetypes never changes the matches.
+ */
+static void
+update_matching_archetypes(World* world, System* system) {
+    if (system->matched_world != world) {
+        system->matched_world = world;
+        system->num_matched_archetypes = 0;
+        system->matching_archetypes.clear();
+    }
 
-        if (system.component_ids.size() == 1) {
-            u32 id = system.component_ids[0];
-            u32 size = system.component_sizes[0];
-            std::vector<u8>& data = world->components[id];
-            for (int j = 0; j < data.size(); j += size) {
-                Entity_Handle handle = *((Entity_Handle*) &data[j]);
-                void* component = &data[j + sizeof(Entity_Handle)];
-                system.on_update(world, dt, handle, &component, system.data);
+    for (u32 i = system->num_matched_archetypes; i < world->archetypes.size(); i++) {
+        if (is_matching_mask(world->archetypes[i].component_mask, system->required_mask, system->excluded_mask)) {
+            system->matching_archetypes.push_back(i);
+        }
+    }
+    system->num_matched_archetypes = (u32) world->archetypes.size();
+}
+
+/**
+ * Finds the archetypes that has all the required components and none of the excluded.
+ * Inside a system its cached matches are filtered further, as long as they cover the query.
+ */
+static void
+find_matching_archetypes(World* world, Component_Mask required, Component_Mask excluded, std::vector<u32>* result) {
+    const System* system = current_system;
+    if (system && system->matched_world == world && (required & system->required_mask) == system->required_mask) {
+        // NOTE(alexander): archetypes can't be created while the system runs, so the cache is up to date
+        excluded |= system->excluded_mask;
+        for (u32 i = 0; i < system->matching_archetypes.size(); i++) {
+            u32 index = system->matching_archetypes[i];
+            if (is_matching_mask(world->archetypes[index].component_mask, required, excluded)) {
+                result->push_back(index);
             }
+        }
+        return;
+    }
 
-        } else {
-            component_params.resize(max(component_params.size(), system.component_ids.size()));
-            component_data.resize(max(component_data.size(), system.component_ids.size()));
-
-            u32 min_size = (u32) -1;
-            u32 min_index = (u32) -1;
-            for (int j = 0; j < system.component_ids.size(); j++) {
-                component_data[j] = &world->components[system.component_ids[j]];
-                if ((system.component_flags[j] & System::Flag_Optional) != 0) {
-                    continue;
-                }
+    if (system) excluded |= system->excluded_mask;
+    for (u32 i = 0; i < world->archetypes.size(); i++) {
+        if (is_matching_mask(world->archetypes[i].component_mask, required, excluded)) {
+            result->push_back(i);
+        }
+    }
+}
 
-                u32 id = system.component_ids[j];
-                u32 size = system.component_sizes[j];
-                if (size <= min_size) {
-                    min_size = size;
-                    min_index = j;
-                }
+/**
+ * Collects every chunk in the given archetypes and groups them into batches
+ * of at least min_batch_size entities, batch i covers chunks
+ * [batches[i], batches[i + 1]) so the last element is always the number of chunks.
+ */
+static void
+batch_matching_chunks(World* world, const u32* archetypes, usize num_archetypes, u32 min_batch_size,
+                      std::vector<Matched_Chunk>* chunks, std::vector<u32>* batches) {
+    u32 batch_count = 0;
+    batches->push_back(0);
+
+    for (usize i = 0; i < num_archetypes; i++) {
+        const Archetype& archetype = world->archetypes[archetypes[i]];
+
+        for (u32 c = 0; c < archetype.chunks.size(); c++) {
+            Matched_Chunk matched = { &archetype, &archetype.chunks[c] };
+            chunks->push_back(matched);
+            batch_count += archetype.chunks[c].count;
+            if (batch_count >= min_batch_size) {
+                batches->push_back((u32) chunks->size());
+                batch_count = 0;
             }
-            assert(min_index < component_params.size());
-
-            std::vector<u8>& data = *component_data[min_index];
-            for (int j = 0; j < data.size(); j += min_size) {
-                Entity_Handle handle = *((Entity_Handle*) &data[j]);
-                Entity* entity = get_entity(world, handle);
-                component_params[min_index] = &data[j + sizeof(Entity_Handle)];
-
-                bool is_valid = true;
-                for (int k = 0; k < system.component_ids.size(); k++) {
-                    if (k == min_index) continue;
-                    component_params[k] = _get_component(world,
-                                                         entity,
-                                                         system.component_ids[k],
-                                                         system.component_sizes[k]);
-                    if (component_params[k] == NULL && (system.component_flags[k] & System::Flag_Optional) == 0) {
-                        is_valid = false;
-                        break;
-                    }
-                }
+        }
+    }
+
+    if (batch_count > 0) {
+        batches->push_back((u32) chunks->size());
+    }
+}
+
+/**
+ * Checks the components the system declared with Flag_Changed, returns true if any
+ * of them changed since the system last ran or if the system doesn't filter on changes.
+ */
+static bool
+has_chunk_changed(const Archetype& archetype, const Chunk& chunk, const System* system) {
+    if (!system) return true;
+
+    bool has_filter = false;
+    u32* versions = get_change_versions(archetype, chunk);
+    for (int k = 0; k < system->component_ids.size(); k++) {
+        if ((system->component_flags[k] & System::Flag_Changed) == 0) continue;
+        has_filter = true;
+
+        int column = find_component_column(archetype, system->component_ids[k]);
+        if (column >= 0 && is_newer_version(versions[column], system->last_run_version)) {
+            return true;
+        }
+    }
+    return !has_filter;
+}
+
+// NOTE(alexander): only systems with Flag_Parallel are split up and only when there is a job system
+static inline bool
+should_iterate_in_parallel(World* world) {
+    return world->job_system && current_system && (current_system->flags & System::Flag_Parallel);
+}
+
+static inline u32
+get_min_batch_size(const System* system) {
+    return system->min_batch_size > 0 ? system->min_batch_size : default_min_batch_size;
+}
+
+/***************************************************************************
+ * Systems execution
+ ***************************************************************************/
+
+// NOTE(alexander): only counted on the thread running the system, parallel batches are summed up first
+static inline void
+count_system_entities(u32 num_visited, u32 num_skipped) {
+    if (!current_system_stats) return;
+    current_system_stats->num_entities_visited += num_visited;
+    current_system_stats->num_entities_skipped += num_skipped;
+}
+
+// NOTE(alexander): returns false if the chunk was skipped since nothing the system filters on changed
+static bool
+run_system_on_chunk(World* world, const System& system, f32 dt, const Archetype& archetype, const Chunk& chunk) {
+    if (!has_chunk_changed(archetype, chunk, &system)) return false;
+
+    u8* column_data[max_component_types];
+    void* component_params[max_component_types];
+    usize num_components = system.component_ids.size();
+    u32* versions = get_change_versions(archetype, chunk);
+
+    for (int k = 0; k < num_components; k++) {
+        int column = find_component_column(archetype, system.component_ids[k]);
+        if (column < 0 || (system.component_flags[k] & System::Flag_Random_Access)) {
+            column_data[k] = NULL;
+        } else {
+            column_data[k] = get_component_column(archetype, chunk, column);
+            if ((system.component_flags[k] & System::Flag_Read_Only) == 0) {
+                versions[column] = current_change_version;
+            }
+        }
+    }
+
+    Entity_Handle* handles = get_entity_column(chunk);
+    for (u32 row = 0; row < chunk.count; row++) {
+        for (int k = 0; k < num_components; k++) {
+            component_params[k] = column_data[k] ? column_data[k] + row*system.component_sizes[k] : NULL;
+        }
+        system.on_update(world, dt, handles[row], &component_params[0], system.data);
+    }
+    return true;
+}
+
+struct System_Batches {
+    World* world;
+    const System* system;
+    u32 change_version;
+    f32 dt;
+    std::vector<Matched_Chunk> chunks;
+    std::vector<u32> batches;
+    std::atomic<u32> num_visited;
+    std::atomic<u32> num_skipped;
+};
+
+static void
+run_system_batches(void* data, u32 begin, u32 end) {
+    System_Batches* batches = (System_Batches*) data;
+    const System* prev_system = current_system;
+    u32 prev_change_version = current_change_version;
+    System_Stats* prev_stats = current_system_stats;
+    current_system = batches->system;
+    current_change_version = batches->change_version;
+    current_system_stats = NULL;
+
+    u32 num_visited = 0;
+    u32 num_skipped = 0;
+    for (u32 i = batches->batches[begin]; i < batches->batches[end]; i++) {
+        const Matched_Chunk& matched = batches->chunks[i];
+        if (run_system_on_chunk(batches->world, *batches->system, batches->dt, *matched.archetype, *matched.chunk)) {
+            num_visited += matched.chunk->count;
+        } else {
+            num_skipped += matched.chunk->count;
+        }
+    }
+    batches->num_visited += num_visited;
+    batches->num_skipped += num_skipped;
+
+    current_system = prev_system;
+    current_change_version = prev_change_version;
+    current_system_stats = prev_stats;
+}
+
+static void
+record_system_time(System_Stats* stats, f32 time) {
+    stats->times[stats->next_time] = time;
+    stats->next_time = (stats->next_time + 1) % system_stats_history;
+    if (stats->num_times < system_stats_history) stats->num_times++;
+}
+
+/**
+ * Summarizes the recorded times of a system, the 99th percentile
+ * is the time that 99% of the recorded runs finished within.
+ */
+System_Timings
+get_system_timings(const System_Stats* stats) {
+    System_Timings timings = {};
+    if (stats->num_times == 0) return timings;
+
+    f32 sorted[system_stats_history];
+    f32 total = 0.0f;
+    for (u32 i = 0; i < stats->num_times; i++) {
+        sorted[i] = stats->times[i];
+        total += stats->times[i];
+    }
+    std::sort(sorted, sorted + stats->num_times);
+
+    u32 p99_index = (u32) ceilf(0.99f*(f32) stats->num_times) - 1;
+    timings.min_time = sorted[0];
+    timings.avg_time = total/(f32) stats->num_times;
+    timings.max_time = sorted[stats->num_times - 1];
+    timings.p99_time = sorted[p99_index];
+    return timings;
+}
 
-                if (is_valid) {
-                    system.on_update(world, dt, handle, &component_params[0], system.data);
+static void
+run_system(World* world, System& system, f32 dt) {
+    auto begin_time = std::chrono::high_resolution_clock::now();
+    const System* prev_system = current_system;
+    u32 prev_change_version = current_change_version;
+    System_Stats* prev_stats = current_system_stats;
+    current_system = &system;
+    current_change_version = ++world->change_version;
+    current_system_stats = &system.stats;
+    system.stats.num_entities_visited = 0;
+    system.stats.num_entities_skipped = 0;
+
+    // NOTE(alexander): systems must not add or remove components while iterating,
+    // since that moves entities between archetypes and invalidates the chunks, use
+    // get_command_buffer instead. Exclusive systems runs alone so they are allowed to move entities around.
+    bool is_locked = (system.flags & System::Flag_Exclusive) == 0;
+    if (is_locked) world->structural_change_locks++;
+
+    update_matching_archetypes(world, &system);
+
+    if (system.on_query) {
+        system.on_query(world, dt, system.data);
+    } else if (should_iterate_in_parallel(world)) {
+        assert(system.on_update && "system is missing on_update function");
+
+        System_Batches batches;
+        batches.world = world;
+        batches.system = &system;
+        batches.change_version = current_change_version;
+        batches.dt = dt;
+        batches.num_visited = 0;
+        batches.num_skipped = 0;
+        batch_matching_chunks(world, system.matching_archetypes.data(), system.matching_archetypes.size(),
+                              get_min_batch_size(&system), &batches.chunks, &batches.batches);
+        parallel_for(world->job_system, (u32) batches.batches.size() - 1, 1, &run_system_batches, &batches);
+        count_system_entities(batches.num_visited, batches.num_skipped);
+    } else {
+        assert(system.on_update && "system is missing on_update function");
+
+        for (u32 j = 0; j < system.matching_archetypes.size(); j++) {
+            const Archetype& archetype = world->archetypes[system.matching_archetypes[j]];
+            for (u32 c = 0; c < archetype.chunks.size(); c++) {
+                const Chunk& chunk = archetype.chunks[c];
+                if (run_system_on_chunk(world, system, dt, archetype, chunk)) {
+                    count_system_entities(chunk.count, 0);
+                } else {
+                    count_system_entities(0, chunk.count);
                 }
             }
         }
     }
+
+    if (is_locked) world->structural_change_locks--;
+    system.last_run_version = current_change_version;
+    current_system = prev_system;
+    current_change_version = prev_change_version;
+    current_system_stats = prev_stats;
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    record_system_time(&system.stats, std::chrono::duration<f32, std::milli>(end_time - begin_time).count());
+}
+
+void
+update_systems(World* world, std::vector<System>& systems, f32 dt) {
+    reserve_command_buffers(world);
+    for (u32 i = 0; i < systems.size(); i++) {
+        run_system(world, systems[i], dt);
+    }
+    play_back_command_buffers(world);
 }
 
 /***************************************************************************
- * Basic Non-hierarchical Transform System
+ * Systems scheduling
  ***************************************************************************/
 
-DEF_SYSTEM(convert_euler_rotation_system) {
-    auto euler_rot = (Euler_Rotation*) components[0];
-    auto rot = (Rotation*) components[1];
+static bool
+systems_conflict(const System& a, const System& b) {
+    if ((a.flags | b.flags) & System::Flag_Exclusive) {
+        return true;
+    }
+
+    for (int i = 0; i < a.component_ids.size(); i++) {
+        for (int j = 0; j < b.component_ids.size(); j++) {
+            if (a.component_ids[i] != b.component_ids[j]) continue;
+
+            // NOTE(alexander): excluded components are never accessed, only used for matching
+            if ((a.component_flags[i] | b.component_flags[j]) & System::Flag_Exclude) continue;
 
-    // NOTE(alexander): y - points upwards, but glm uses z instead
-    glm::quat rot_x(glm::vec3(0.0f, euler_rot->v.x, 0.0f));
-    glm::quat rot_y(glm::vec3(euler_rot->v.y, 0.0f, 0.0f));
-    glm::quat rot_z(glm::vec3(0.0f, 0.0f, euler_rot->v.z));
-    rot->q = rot_z * rot_y * rot_x;
+            bool a_writes = (a.component_flags[i] & System::Flag_Read_Only) == 0;
+            bool b_writes = (b.component_flags[j] & System::Flag_Read_Only) == 0;
+            if (a_writes || b_writes) {
+                return true;
+            }
+        }
+    }
+
+    return false;
 }
 
-DEF_SYSTEM(trs_local_to_world_system) {
-    auto local_to_world = (Local_To_World*) components[0];
-    auto pos = (Position*) components[1];
-    auto rot = (Rotation*) components[2];
-    auto scl = (Scale*) components[3];
+System_Schedule
+build_system_schedule(std::vector<System>* systems) {
+    System_Schedule schedule = {};
+    schedule.systems = systems;
+    schedule.dependents.resize(systems->size());
+    schedule.dependency_counts.resize(systems->size());
+
+    // NOTE(alexander): conflicting systems keep the order they were pushed in
+    for (u32 i = 0; i < systems->size(); i++) {
+        for (u32 j = i + 1; j < systems->size(); j++) {
+            if (systems_conflict((*systems)[i], (*systems)[j])) {
+                schedule.dependents[i].push_back(j);
+                schedule.dependency_counts[j]++;
+            }
+        }
+    }
 
-    if (!pos && !rot && !scl) return; // NOTE(alexander): need at least one of these
+    return schedule;
+}
 
-    glm::mat4 T = pos ? glm::translate(glm::mat4(1.0f), pos->v) : glm::mat4(1.0f);
-    glm::mat4 R = rot ? glm::toMat4(rot->q)                     : glm::mat4(1.0f);
-    glm::mat4 S = scl ? glm::scale(glm::mat4(1.0f), scl->v)     : glm::mat4(1.0f);
+struct Schedule_Run;
+
+struct System_Job {
+    Schedule_Run* run;
+    u32 index;
+};
 
-    local_to_world->m = T * R * S;
+struct Schedule_Run {
+    World* world;
+    System_Schedule* schedule;
+    f32 dt;
+
+    std::vector<System_Job> jobs;
+    std::unique_ptr<std::atomic<u32>[]> dependency_counts;
+    std::atomic<u32> num_completed;
+
+    std::mutex main_thread_mutex;
+    std::vector<u32> main_thread_queue; // ready systems that has to run on the main thread
+};
+
+static void run_scheduled_system_job(void* data);
+
+static void
+dispatch_scheduled_system(Schedule_Run* run, u32 index) {
+    const System& system = (*run->schedule->systems)[index];
+    if (system.flags & System::Flag_Main_Thread) {
+        std::lock_guard<std::mutex> lock(run->main_thread_mutex);
+        run->main_thread_queue.push_back(index);
+    } else {
+        push_job(run->world->job_system, &run_scheduled_system_job, &run->jobs[index]);
+    }
+}
+
+static void
+complete_scheduled_system(Schedule_Run* run, u32 index) {
+    const std::vector<u32>& dependents = run->schedule->dependents[index];
+    for (int i = 0; i < dependents.size(); i++) {
+        if (--run->dependency_counts[dependents[i]] == 0) {
+            dispatch_scheduled_system(run, dependents[i]);
+        }
+    }
+    run->num_completed++;
+}
+
+static void
+run_scheduled_system_job(void* data) {
+    System_Job* job = (System_Job*) data;
+    Schedule_Run* run = job->run;
+    run_system(run->world, (*run->schedule->systems)[job->index], run->dt);
+    complete_scheduled_system(run, job->index);
 }
 
 void
-push_transform_systems(std::vector<System>& systems) {
-    System euler_conv = {};
-    euler_conv.on_update = &convert_euler_rotation_system;
-    use_component(euler_conv, Euler_Rotation);
-    use_component(euler_conv, Rotation);
-    push_system(systems, euler_conv);
+update_systems(World* world, System_Schedule* schedule, f32 dt) {
+    std::vector<System>& systems = *schedule->systems;
+    assert(systems.size() == schedule->dependency_counts.size() && "system schedule is out of date");
 
-    System trs_world = {};
-    trs_world.on_update = &trs_local_to_world_system;
-    use_component(trs_world, Local_To_World);
-    use_component(trs_world, Position, System::Flag_Optional);
-    use_component(trs_world, Rotation, System::Flag_Optional);
-    use_component(trs_world, Scale,    System::Flag_Optional);
-    push_system(systems, trs_world);
+    if (!world->job_system) {
+        update_systems(world, systems, dt);
+        return;
+    }
+    reserve_command_buffers(world);
+
+    Schedule_Run run;
+    run.world = world;
+    run.schedule = schedule;
+    run.dt = dt;
+    run.num_completed = 0;
+    run.jobs.resize(systems.size());
+    run.dependency_counts.reset(new std::atomic<u32>[systems.size()]);
+    for (u32 i = 0; i < systems.size(); i++) {
+        run.jobs[i].run = &run;
+        run.jobs[i].index = i;
+        run.dependency_counts[i] = schedule->dependency_counts[i];
+    }
+
+    for (u32 i = 0; i < systems.size(); i++) {
+        if (schedule->dependency_counts[i] == 0) {
+            dispatch_scheduled_system(&run, i);
+        }
+    }
+
+    // NOTE(alexander): the main thread runs main thread systems and helps out with the rest
+    while (run.num_completed < systems.size()) {
+        bool has_main_thread_system = false;
+        u32 index = 0;
+        {
+            std::lock_guard<std::mutex> lock(run.main_thread_mutex);
+            if (run.main_thread_queue.size() > 0) {
+                index = run.main_thread_queue.back();
+                run.main_thread_queue.pop_back();
+                has_main_thread_system = true;
+            }
+        }
+
+        if (has_main_thread_system) {
+            run_system(world, systems[index], dt);
+            complete_scheduled_system(&run, index);
+        } else if (!run_next_job(world->job_system)) {
+            std::this_thread::yield();
+        }
+    }
+
+    play_back_command_buffers(world);
 }
 
 /***************************************************************************
- * Hierarchical Transform System
+ * Typed queries
  ***************************************************************************/
 
-DEF_SYSTEM(parent_system) {
-    auto child_parent = (Parent*) components[0];
-    auto parent_parent = get_component(world, child_parent->handle, Parent);
-    if (!parent_parent) return;
+/**
+ * Marks a component in a typed query as optional, the system then
+ * receives a pointer to the component that may be NULL instead of a reference.
+ */
+template <typename T>
+struct Optional {};
+
+/**
+ * Describes how each query term maps to a chunk column and to the argument passed to the system.
+ * Using Entity_Handle as a term gives access to the handle of the entity being iterated.
+ * Const terms e.g. const Position are read only and are not marked as changed.
+ */
+template <typename T>
+struct Query_Term {
+    static constexpr bool is_optional = false;
+    static constexpr bool is_entity = false;
+    static constexpr bool is_read_only = std::is_const<T>::value;
+    static constexpr u32 id = Component_Type<typename std::remove_const<T>::type>::id;
+
+    static inline T& get(u8* column, u32 row) {
+        return ((T*) column)[row];
+    }
+
+    static inline T* get_column(u8* column) {
+        return (T*) column;
+    }
+};
+
+template <typename T>
+struct Query_Term<Optional<T>> {
+    static constexpr bool is_optional = true;
+    static constexpr bool is_entity = false;
+    static constexpr bool is_read_only = std::is_const<T>::value;
+    static constexpr u32 id = Component_Type<typename std::remove_const<T>::type>::id;
+
+    static inline T* get(u8* column, u32 row) {
+        return column ? ((T*) column) + row : NULL;
+    }
+
+    static inline T* get_column(u8* column) {
+        return (T*) column;
+    }
+};
+
+template <>
+struct Query_Term<Entity_Handle> {
+    static constexpr bool is_optional = false;
+    static constexpr bool is_entity = true;
+    static constexpr bool is_read_only = true;
+    static constexpr u32 id = 0; // NOTE(alexander): unused, always stored in the first column
 
-    // Swap so that parent world matrix is calculated first
-    if (parent_parent > child_parent) {
-        auto child = get_entity(world, handle);
-        auto parent = get_entity(world, child_parent->handle);
+    static inline Entity_Handle get(u8* column, u32 row) {
+        return ((Entity_Handle*) column)[row];
+    }
 
-        Parent temp = *child_parent;
-        *child_parent = *parent_parent;
-        *parent_parent = temp;
+    static inline const Entity_Handle* get_column(u8* column) {
+        return (const Entity_Handle*) column;
+    }
+};
 
-        auto child_entity = ((Entity_Handle*) child_parent) - 1;
-        auto parent_entity = ((Entity_Handle*) parent_parent) - 1;
+template <typename... Terms, typename Function, usize... I>
+static inline void
+world_query_chunk(Function& function, u8** columns, u32 count, std::index_sequence<I...>) {
+    for (u32 row = 0; row < count; row++) {
+        function(Query_Term<Terms>::get(columns[I], row)...);
+    }
+}
 
-        Entity_Handle entity_temp = *child_entity;
-        *child_entity = *parent_entity;
-        *parent_entity = entity_temp;
+template <typename... Terms, typename Function, usize... I>
+static inline void
+world_query_chunk_columns(Function& function, u8** columns, u32 count, std::index_sequence<I...>) {
+    function(count, Query_Term<Terms>::get_column(columns[I])...);
+}
 
-        for (int i = 0; i < child->components.size(); i++) {
-            Component_Handle& component = child->components[i];
-            if (component.id == Parent_ID) {
-                component.offset = (usize) (((u8*) parent_parent) - &world->components[Parent_ID][0]);
-                break;
+// NOTE(alexander): also marks the columns of terms that are not read only as changed
+template <typename... Terms>
+static inline void
+get_query_columns(const Archetype& archetype, const Chunk& chunk, u8** column_data) {
+    static constexpr usize num_terms = sizeof...(Terms);
+    static constexpr u32 ids[num_terms] = { Query_Term<Terms>::id... };
+    static constexpr bool is_entity[num_terms] = { Query_Term<Terms>::is_entity... };
+    static constexpr bool is_read_only[num_terms] = { Query_Term<Terms>::is_read_only... };
+
+    u32* versions = get_change_versions(archetype, chunk);
+    for (usize k = 0; k < num_terms; k++) {
+        if (is_entity[k]) {
+            column_data[k] = (u8*) get_entity_column(chunk);
+        } else {
+            int column = find_component_column(archetype, ids[k]);
+            column_data[k] = column >= 0 ? get_component_column(archetype, chunk, column) : NULL;
+            if (column >= 0 && !is_read_only[k]) {
+                versions[column] = current_change_version;
             }
         }
+    }
+}
+
+template <typename Function>
+struct Query_Batches {
+    Function* function;
+    const System* system;
+    u32 change_version;
+    std::vector<Matched_Chunk> chunks;
+    std::vector<u32> batches;
+    std::atomic<u32> num_visited;
+    std::atomic<u32> num_skipped;
+};
+
+template <typename Function, typename... Terms>
+static void
+world_query_batches(void* data, u32 begin, u32 end) {
+    Query_Batches<Function>* batches = (Query_Batches<Function>*) data;
+    const System* prev_system = current_system;
+    u32 prev_change_version = current_change_version;
+    System_Stats* prev_stats = current_system_stats;
+    current_system = batches->system;
+    current_change_version = batches->change_version;
+    current_system_stats = NULL;
+
+    u32 num_visited = 0;
+    u32 num_skipped = 0;
+    u8* column_data[sizeof...(Terms)];
+    for (u32 i = batches->batches[begin]; i < batches->batches[end]; i++) {
+        const Matched_Chunk& matched = batches->chunks[i];
+        if (!has_chunk_changed(*matched.archetype, *matched.chunk, batches->system)) {
+            num_skipped += matched.chunk->count;
+            continue;
+        }
+        get_query_columns<Terms...>(*matched.archetype, *matched.chunk, column_data);
+        (*batches->function)(column_data, matched.chunk->count);
+        num_visited += matched.chunk->count;
+    }
+    batches->num_visited += num_visited;
+    batches->num_skipped += num_skipped;
+
+    current_system = prev_system;
+    current_change_version = prev_change_version;
+    current_system_stats = prev_stats;
+}
+
+// NOTE(alexander): the components an archetype must have, i.e. every term that isn't optional or the entity handle
+template <typename... Terms>
+static constexpr Component_Mask
+get_query_required_mask() {
+    Component_Mask mask = 0;
+    bool is_required[] = { !Query_Term<Terms>::is_optional && !Query_Term<Terms>::is_entity... };
+    u32 ids[] = { Query_Term<Terms>::id... };
+    for (usize k = 0; k < sizeof...(Terms); k++) {
+        if (is_required[k]) mask |= (Component_Mask) 1 << ids[k];
+    }
+    return mask;
+}
+
+// NOTE(alexander): calls chunk_function(columns, count) for every matching chunk, see world_query
+template <typename... Terms, typename Function>
+static void
+iterate_query_chunks(World* world, Function& chunk_function) {
+    static constexpr usize num_terms = sizeof...(Terms);
+    static constexpr Component_Mask required_mask = get_query_required_mask<Terms...>();
+
+#ifndef NDEBUG
+    static constexpr u32 ids[num_terms] = { Query_Term<Terms>::id... };
+    static constexpr bool is_entity[num_terms] = { Query_Term<Terms>::is_entity... };
+    for (usize k = 0; k < num_terms; k++) {
+        if (!is_entity[k]) check_component_access(ids[k]);
+    }
+#endif
+
+    std::vector<u32> archetypes;
+    find_matching_archetypes(world, required_mask, 0, &archetypes);
+
+    // NOTE(alexander): same rules as update_systems, no structural changes while iterating.
+    if (should_iterate_in_parallel(world)) {
+        Query_Batches<Function> batches;
+        batches.function = &chunk_function;
+        batches.system = current_system;
+        batches.change_version = current_change_version;
+        batches.num_visited = 0;
+        batches.num_skipped = 0;
+        batch_matching_chunks(world, archetypes.data(), archetypes.size(), get_min_batch_size(current_system),
+                              &batches.chunks, &batches.batches);
+        parallel_for(world->job_system, (u32) batches.batches.size() - 1, 1,
+                     &world_query_batches<Function, Terms...>, &batches);
+        count_system_entities(batches.num_visited, batches.num_skipped);
+        return;
+    }
 
-        for (int i = 0; i < parent->components.size(); i++) {
-            Component_Handle& component = parent->components[i];
-            if (component.id == Parent_ID) {
-                component.offset = (usize) (((u8*) child_parent) - &world->components[Parent_ID][0]);
-                break;
+    // NOTE(alexander): outside of systems the writes are tagged with the next version
+    u32 prev_change_version = current_change_version;
+    if (!current_system) current_change_version = get_write_version(world);
+
+    u8* column_data[num_terms];
+    for (u32 i = 0; i < archetypes.size(); i++) {
+        const Archetype& archetype = world->archetypes[archetypes[i]];
+        for (u32 c = 0; c < archetype.chunks.size(); c++) {
+            const Chunk& chunk = archetype.chunks[c];
+            if (!has_chunk_changed(archetype, chunk, current_system)) {
+                count_system_entities(0, chunk.count);
+                continue;
             }
+            get_query_columns<Terms...>(archetype, chunk, column_data);
+            chunk_function(column_data, chunk.count);
+            count_system_entities(chunk.count, 0);
         }
     }
+
+    current_change_version = prev_change_version;
 }
 
-DEF_SYSTEM(trs_local_to_parent_system) {
-    auto local_to_parent = (Local_To_Parent*) components[0];
-    auto pos = (Position*) components[1];
-    auto rot = (Rotation*) components[2];
-    auto scl = (Scale*) components[3];
+/**
+ * Calls the function for every entity that matches the query terms, e.g.
+ * world_query<Local_To_World, Optional<Position>>(world, [](Local_To_World& l, Position* p) {...});
+ * Component ids and sizes are resolved at compile time and the function
+ * gets inlined into the loop over each chunk.
+ *
+ * When called from a system with Flag_Parallel the chunks are split into batches
+ * that run on the job system, the function must then be safe to call from multiple threads.
+ * Chunks are skipped when none of the components the system declared with Flag_Changed has changed.
+ * Entities that have components the system declared with Flag_Exclude are skipped as well.
+ */
+template <typename... Terms, typename Function>
+void
+world_query(World* world, Function function) {
+    auto chunk_function = [&function](u8** columns, u32 count) {
+        world_query_chunk<Terms...>(function, columns, count, std::index_sequence_for<Terms...>());
+    };
+    iterate_query_chunks<Terms...>(world, chunk_function);
+}
+
+/**
+ * Same as world_query but the function is called once per chunk with the number of
+ * entities and a pointer to the start of each column, e.g.
+ * world_query_chunks<Local_To_World, Optional<const Position>>(world, [](u32 count, Local_To_World* l, const Position* p) {...});
+ * Optional columns are NULL when the chunk doesn't have the component. Useful for
+ * processing many entities at once e.g. with SIMD.
+ */
+template <typename... Terms, typename Function>
+void
+world_query_chunks(World* world, Function function) {
+    auto chunk_function = [&function](u8** columns, u32 count) {
+        world_query_chunk_columns<Terms...>(function, columns, count, std::index_sequence_for<Terms...>());
+    };
+    iterate_query_chunks<Terms...>(world, chunk_function);
+}
+
+/***************************************************************************
+ * Basic Non-hierarchical Transform System
+ ***************************************************************************/
 
-    if (!pos && !rot && !scl) return; // NOTE(alexander): need at least one of these
+DEF_QUERY_SYSTEM(convert_euler_rotation_system) {
+    world_query<const Euler_Rotation, Rotation>(world, [](const Euler_Rotation& euler_rot, Rotation& rot) {
+        // NOTE(alexander): y - points upwards, but glm uses z instead
+        glm::quat rot_x(glm::vec3(0.0f, euler_rot.v.x, 0.0f));
+        glm::quat rot_y(glm::vec3(euler_rot.v.y, 0.0f, 0.0f));
+        glm::quat rot_z(glm::vec3(0.0f, 0.0f, euler_rot.v.z));
+        rot.q = rot_z * rot_y * rot_x;
+    });
+}
 
+static inline Affine_Transform
+trs_matrix(const Position* pos, const Rotation* rot, const Scale* scl) {
     glm::mat4 T = pos ? glm::translate(glm::mat4(1.0f), pos->v) : glm::mat4(1.0f);
     glm::mat4 R = rot ? glm::toMat4(rot->q)                     : glm::mat4(1.0f);
     glm::mat4 S = scl ? glm::scale(glm::mat4(1.0f), scl->v)     : glm::mat4(1.0f);
-
-    local_to_parent->m = T * R * S;
+    return affine_from_mat4(T * R * S);
 }
 
-DEF_SYSTEM(hierarchical_local_to_world_system) {
-    auto parent = (Parent*) components[0];
-    auto local_to_world = (Local_To_World*) components[1];
-    auto local_to_parent = (Local_To_Parent*) components[2];
-
-    // usize test = (usize) (((u8*) parent) - &world->components[Parent_ID][0]);
-    auto parent_local_to_world = get_component(world, parent->handle, Local_To_World);
-    local_to_world->m = parent_local_to_world->m * local_to_parent->m;
+// NOTE(alexander): whole chunks at once, see compute_trs_matrices
+DEF_QUERY_SYSTEM(trs_local_to_world_system) {
+    world_query_chunks<Local_To_World, Optional<const Position>, Optional<const Rotation>, Optional<const Scale>>
+        (world, [](u32 count, Local_To_World* local_to_world, const Position* pos, const Rotation* rot, const Scale* scl) {
+            if (!pos && !rot && !scl) return; // NOTE(alexander): need at least one of these
+            compute_trs_matrices(&local_to_world[0].m, pos, rot, scl, count);
+        });
 }
 
 void
-push_hierarchical_transform_systems(std::vector<System>& systems) {
-    push_transform_systems(systems);
-
-    System parent = {};
-    parent.on_update = &parent_system;
-    use_component(parent, Parent);
-    push_system(systems, parent);
-
-    System trs_parent = {};
-    trs_parent.on_update = &trs_local_to_parent_system;
-    use_component(trs_parent, Local_To_Parent);
-    use_component(trs_parent, Position, System::Flag_Optional);
-    use_component(trs_parent, Rotation, System::Flag_Optional);
-    use_component(trs_parent, Scale,    System::Flag_Optional);
-    push_system(systems, trs_parent);
-
-    System hierarchical_world = {};
-    hierarchical_world.on_update = &hierarchical_local_to_world_system;
-    use_component(hierarchical_world, Parent);
-    use_component(hierarchical_world, Local_To_World);
-    use_component(hierarchical_world, Local_To_Parent);
-    push_system(systems, hierarchical_world);
+push_transform_systems(std::vector<System>& systems) {
+    System euler_conv = {};
+    euler_conv.name = "convert_euler_rotation_system";
+    euler_conv.on_query = &convert_euler_rotation_system;
+    euler_conv.flags = System::Flag_Parallel;
+    use_component(euler_conv, Euler_Rotation, System::Flag_Read_Only | System::Flag_Changed);
+    use_component(euler_conv, Rotation);
+    push_system(systems, euler_conv);
+
+    System trs_world = {};
+    trs_world.name = "trs_local_to_world_system";
+    trs_world.on_query = &trs_local_to_world_system;
+    trs_world.flags = System::Flag_Parallel;
+    use_component(trs_world, Local_To_World);
+    use_component(trs_world, Position, System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    use_component(trs_world, Rotation, System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    use_component(trs_world, Scale,    System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    push_system(systems, trs_world);
 }
 
 /***************************************************************************
@@ -451,52 +2278,24 @@ DEF_SYSTEM(prepare_camera_system) {
 void
 push_camera_systems(std::vector<System>& systems) {
     System view_system = {};
+    view_system.name = "rt_view_matrix_system";
     view_system.on_update = &rt_view_matrix_system;
     use_component(view_system, Camera);
-    use_component(view_system, Position, System::Flag_Optional);
-    use_component(view_system, Rotation, System::Flag_Optional);
+    use_component(view_system, Position, System::Flag_Optional | System::Flag_Read_Only);
+    use_component(view_system, Rotation, System::Flag_Optional | System::Flag_Read_Only);
     push_system(systems, view_system);
 
     System projection_system = {};
+    projection_system.name = "set_projection_system";
     projection_system.on_update = &set_projection_system;
     use_component(projection_system, Camera);
     push_system(systems, projection_system);
 
     System prepare_system = {};
+    prepare_system.name = "prepare_camera_system";
     prepare_system.on_update = &prepare_camera_system;
+    prepare_system.flags = System::Flag_Main_Thread; // NOTE(alexander): writes to the renderer
     use_component(prepare_system, Camera);
-    use_component(prepare_system, Position, System::Flag_Optional);
+    use_component(prepare_system, Position, System::Flag_Optional | System::Flag_Read_Only);
     push_system(systems, prepare_system);
 }
-
-/***************************************************************************
- * Rendering Systems
- ***************************************************************************/
-
-DEF_SYSTEM(mesh_renderer_system) {
-    assert(data && "missing targeted camera for rendering to");
-
-    auto camera = get_component(world, *((Entity_Handle*) data), Camera);
-    auto mesh_renderer = (Mesh_Renderer*) components[0];
-    auto local_to_world = (Local_To_World*) components[1];
-
-    assert(camera && "missing camera component on target camera entity");
-
-    glm::mat4 model_matrix = local_to_world ? local_to_world->m : glm::mat4(1.0f);
-    const Mesh mesh = mesh_renderer->mesh;
-    const Material material = mesh_renderer->material;
-
-    Renderer* renderer = &world->renderer;
-    apply_material(renderer, material, model_matrix, camera->view, camera->proj, camera->view_proj);
-    draw_mesh(mesh);
-}
-
-void
-push_mesh_renderer_system(std::vector<System>& systems, Entity_Handle* camera) {
-    System system = {};
-    system.data = camera;
-    system.on_update = &mesh_renderer_system;
-    use_component(system, Mesh_Renderer);
-    use_component(system, Local_To_World, System::Flag_Optional);
-    push_system(systems, system);
-}
@@ -19,6 +19,11 @@ operator==(const Entity_Handle& a, const Entity_Handle& b) {
     return a.id == b.id;
 }
 
+inline bool
+operator!=(const Entity_Handle& a, const Entity_Handle& b) {
+    return a.id != b.id;
+}
+
 namespace std {
     template <>
     struct hash<Entity_Handle> {
@@ -28,30 +33,153 @@ namespace std {
     };
 }
 
-static u32 next_component_id = 0;
+// NOTE(alexander): reserved handle that never refers to an entity, used e.g. to terminate lists
+static const Entity_Handle null_entity_handle = { 0xFFFFFFFF };
+
+static constexpr u32 max_component_types = 64;
+
+typedef void (*Component_Construct)(void* data, u32 count);
+typedef void (*Component_Relocate)(void* dst, void* src, u32 count); // move to dst and destroy src
+typedef void (*Component_Destroy)(void* data, u32 count);
+typedef void (*Component_Copy)(void* dst, const void* src, u32 count); // count copies of src in dst
+
+struct Snapshot_Fixup;
+typedef void (*Component_Snapshot)(Snapshot_Fixup* fixup, void* dst, const void* src, u32 count);
+
+/**
+ * Runtime information about a registered component type, used by the archetype storage
+ * to lay out the chunk columns and to construct, move and destroy the components.
+ * Trivial components have no functions, they are zero initialized and moved around with memcpy.
+ */
+struct Component_Info {
+    const char* name;
+    u32 size;
+    u32 alignment;
+    bool is_trivial; // trivially copyable and destructible, i.e. can be relocated with memcpy
+    Component_Construct construct;
+    Component_Relocate relocate;
+    Component_Destroy destroy;
+    Component_Copy copy;
+    Component_Snapshot snapshot; // fixes up pointers in the component, see REGISTER_SNAPSHOT_FUNCTION
+};
+
+// NOTE(alexander): indexed by component id, filled in by REGISTER_COMPONENT
+static Component_Info component_infos[max_component_types];
+
+template <typename T>
+static void
+construct_component_array(void* data, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        new ((T*) data + i) T();
+    }
+}
+
+template <typename T>
+static void
+relocate_component_array(void* dst, void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        new ((T*) dst + i) T(std::move(((T*) src)[i]));
+        ((T*) src)[i].~T();
+    }
+}
+
+template <typename T>
+static void
+destroy_component_array(void* data, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        ((T*) data)[i].~T();
+    }
+}
+
+template <typename T>
+static void
+copy_component_array(void* dst, const void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        new ((T*) dst + i) T(*(const T*) src);
+    }
+}
+
+template <typename T>
+static bool
+register_component_info(u32 id, u32 size, const char* name) {
+    Component_Info info = {};
+    info.name = name;
+    info.size = size;
+    info.alignment = (u32) alignof(T);
+    info.is_trivial = size == 0 || (std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value);
+    if (!info.is_trivial) {
+        info.construct = &construct_component_array<T>;
+        info.relocate = &relocate_component_array<T>;
+        info.destroy = &destroy_component_array<T>;
+        info.copy = &copy_component_array<T>;
+    }
+    component_infos[id] = info;
+    return true;
+}
+
+/**
+ * Compile time information about a registered component type, e.g. Component_Type<Position>::id.
+ * Component ids are assigned in registration order using __COUNTER__, so they are known at
+ * compile time and can be used to specialize typed queries (see world_query).
+ */
+template <typename T>
+struct Component_Type;
+
+static constexpr u32 component_id_counter_base = __COUNTER__ + 1;
 
 #define REGISTER_COMPONENT(type) \
-    static const u32 type ## _ID = next_component_id++;    \
-    static const u32 type ## _SIZE = sizeof(type) + sizeof(Entity_Handle)
+    template <>                                                         \
+    struct Component_Type<type> {                                       \
+        static constexpr u32 id = __COUNTER__ - component_id_counter_base; \
+        static constexpr u32 size = sizeof(type);                       \
+        static_assert(id < max_component_types, "too many component types registered"); \
+    };                                                                  \
+    static const u32 type ## _ID = Component_Type<type>::id;           \
+    static const u32 type ## _SIZE = Component_Type<type>::size;       \
+    static const bool type ## _REGISTERED = register_component_info<type>(type ## _ID, type ## _SIZE, #type)
+
+/**
+ * Tags are empty components that take up no space in the chunks, they are only
+ * used to filter which entities a system iterates, see System::Flag_Exclude.
+ */
+#define REGISTER_TAG(type) \
+    template <>                                                         \
+    struct Component_Type<type> {                                       \
+        static constexpr u32 id = __COUNTER__ - component_id_counter_base; \
+        static constexpr u32 size = 0;                                  \
+        static_assert(id < max_component_types, "too many component types registered"); \
+        static_assert(std::is_empty<type>::value, "tags cannot store any data"); \
+    };                                                                  \
+    static const u32 type ## _ID = Component_Type<type>::id;           \
+    static const u32 type ## _SIZE = Component_Type<type>::size;       \
+    static const bool type ## _REGISTERED = register_component_info<type>(type ## _ID, type ## _SIZE, #type)
+
+/**
+ * Components that store pointers or non trivial data has to register a function that
+ * converts them to and from references when a world snapshot is saved and loaded, see world_snapshot.cpp.
+ * Must come after the REGISTER_COMPONENT of the same type.
+ */
+#define REGISTER_SNAPSHOT_FUNCTION(type, function) \
+    static const bool type ## _SNAPSHOT_REGISTERED = (component_infos[type ## _ID].snapshot = &function, true)
+
+// NOTE(alexander): bit set of component ids, e.g. the components of an archetype
+typedef u64 Component_Mask;
+
+static inline Component_Mask
+component_mask_bit(u32 id) {
+    return (Component_Mask) 1 << id;
+}
 
 /***************************************************************************
  * Common Components
  ***************************************************************************/
 
 struct Local_To_World {
-    glm::mat4 m;
+    Affine_Transform m;
 };
 
 struct Local_To_Parent {
-    glm::mat4 m;
-};
-
-struct Parent {
-    Entity_Handle handle;
-};
-
-struct Child {
-    Entity_Handle handle;
+    Affine_Transform m;
 };
 
 struct Position {
@@ -92,39 +220,192 @@ struct Mesh_Renderer {
     Material material;
 };
 
+// NOTE(alexander): world space bounds of the Mesh_Renderer, kept up to date by world_bounds_system
+struct World_Bounds {
+    glm::vec3 center;
+    glm::vec3 extents; // half size of the axis aligned box
+    f32 radius; // bounding sphere with the same center
+};
+
 struct Debug_Name {
     std::string s;
 };
 
+// NOTE(alexander): tag, entities with this are skipped by the mesh renderer
+struct Hidden {};
+
 REGISTER_COMPONENT(Local_To_World);
 REGISTER_COMPONENT(Local_To_Parent);
-REGISTER_COMPONENT(Parent);
-REGISTER_COMPONENT(Child);
 REGISTER_COMPONENT(Position);
 REGISTER_COMPONENT(Euler_Rotation);
 REGISTER_COMPONENT(Rotation);
 REGISTER_COMPONENT(Scale);
 REGISTER_COMPONENT(Camera);
 REGISTER_COMPONENT(Mesh_Renderer);
+REGISTER_COMPONENT(World_Bounds);
 REGISTER_COMPONENT(Debug_Name);
+REGISTER_TAG(Hidden);
 
 /**
- * Handle to a particular instance of a component.
+ * Chunks are fixed size blocks of memory that stores the components of entities
+ * that share the same archetype. Each component type is stored in its own contiguous
+ * column inside the chunk, the first column always stores the entity handles.
+ * The chunk ends with the change version of each column, i.e. when it was last written to.
+ *
+ * +-----------------+-----------------+-----------------+-----+-----------------+
+ * | Entity_Handle[] | Component A[]   | Component B[]   | ... | Change versions |
+ * +-----------------+-----------------+-----------------+-----+-----------------+
  */
-struct Component_Handle {
-    u32 id;
-    usize offset; // in bytes
+struct Chunk {
+    u8* data;
+    u32 count; // number of entities stored in this chunk
+    u32 page; // index of the page in the chunk pool that owns the data
+};
+
+/**
+ * Chunks are allocated from large pages that are never resized, so chunk data stays
+ * at the same address until the pool is compacted (see compact_chunk_pool).
+ * Free chunks are linked together in a free list, the first bytes of a free chunk
+ * stores the next free chunk.
+ */
+struct Chunk_Page {
+    u8* memory; // allocated memory, data is aligned within it
+    u8* data;
+    u64 used_mask; // one bit per chunk in the page
+};
+
+struct Chunk_Pool {
+    std::vector<Chunk_Page> pages;
+    u8* free_list;
+    u32 num_used_chunks;
+
+    // NOTE(alexander): pages adopted from a loaded world snapshot, unmapped when the world is cleared
+    u8* mapped_memory;
+    usize mapped_size;
+};
+
+/**
+ * Archetype is a unique set of component types, every entity that has exactly
+ * this set of components is stored together in the chunks of this archetype.
+ * All chunks except the last one are always completely filled.
+ */
+struct Archetype {
+    Component_Mask component_mask; // signature of the archetype, one bit per component id
+    std::vector<u32> component_ids; // sorted in ascending order
+    std::vector<u32> component_sizes;
+    std::vector<u32> column_offsets; // byte offset of each component column inside a chunk
+    bool is_trivial; // every component is trivial, so chunks can be moved with memcpy
+    u32 change_versions_offset; // byte offset of the u32 change version per column
+    std::vector<Chunk> chunks;
+    u32 chunk_capacity; // max number of entities stored per chunk
+
+    // NOTE(alexander): sparse lookup tables indexed by component id, -1 if not available
+    i32 component_columns[max_component_types]; // column index of component id
+    i32 add_edges[max_component_types]; // archetype index after adding component id
+    i32 remove_edges[max_component_types]; // archetype index after removing component id
 };
 
 /**
- * An entity is just an array of components that is identified by its handle.
+ * An entity is identified by its handle and refers to a row in one of the
+ * chunks of its archetype, where all its component data is stored.
  */
 struct Entity {
     Entity_Handle handle;
-    std::vector<Component_Handle> components;
+    u32 archetype;
+    u32 chunk;
+    u32 row;
+};
+
+/**
+ * Set of components used to spawn many entities at once, see spawn_entities.
+ */
+struct Archetype_Template {
+    std::vector<u32> component_ids; // sorted in ascending order
+    std::vector<u32> component_sizes;
+};
+
+static constexpr u32 invalid_prefab_index = 0xFFFFFFFF;
+
+/**
+ * One entity of a prefab, the links are indices into Prefab::entities
+ * (or invalid_prefab_index) laid out the same way as Hierarchy_Node.
+ */
+struct Prefab_Entity {
+    Archetype_Template components;
+    std::vector<u32> data_offsets; // where each component is stored in Prefab::data
+    u32 parent;
+    u32 first_child;
+    u32 last_child;
+    u32 next_sibling;
+    u32 prev_sibling;
+    u32 depth; // relative to the root
+};
+
+/**
+ * Copy of a whole hierarchy of entities and their components, recorded once
+ * with make_prefab and spawned any number of times with instantiate_prefab.
+ * Must be destroyed with destroy_prefab since it may own non trivial components.
+ */
+struct Prefab {
+    std::vector<Prefab_Entity> entities; // parents comes before their children, entity 0 is the root
+    std::vector<u8> data;
+};
+
+/**
+ * Structural changes recorded while systems are iterating, e.g. spawning
+ * entities or adding components. These are played back later at a sync point
+ * when it is safe to move entities between archetypes.
+ */
+struct Entity_Command {
+    enum Type {
+        Spawn,
+        Despawn,
+        Add_Component,
+        Remove_Component,
+    };
+
+    Type type;
+    Entity_Handle handle;
+    u32 component_id;
+    u32 component_size;
+    u32 data_offset; // where the initial component data is stored in the command buffer, index into objects if non trivial
+};
+
+struct Entity_Command_Buffer {
+    std::vector<Entity_Command> commands;
+    std::vector<u8> data;
+    std::vector<u8*> objects; // non trivial component data, allocated one by one so it's never relocated
 };
 
 struct World;
+struct Job_System;
+
+/**
+ * Observer function type takes a batch of entities that had the observed component
+ * added, removed or modified since the last sync point, see flush_observers.
+ */
+typedef void (*OnObserveComponent)(World* world, const Entity_Handle* entities, u32 count, void* data);
+
+/**
+ * Observers let other systems keep their own indices of entities up to date
+ * (e.g. spatial indices or name lookups) without rescanning every component array.
+ * Events are recorded by the structural changes and delivered in batches per
+ * component type at sync points, removals first, then additions and modifications.
+ */
+struct Component_Observer {
+    enum Event {
+        On_Add,
+        On_Remove, // NOTE(alexander): reported afterwards, the entity may already be despawned
+        On_Modified, // chunk granularity same as System::Flag_Changed, includes added and moved entities
+        Num_Events,
+    };
+
+    const char* name;
+    void* data;
+    OnObserveComponent on_event;
+    u32 component_id;
+    Event event;
+};
 
 /**
  * On update system function pointer type takes the
@@ -135,21 +416,141 @@ typedef void (*OnUpdateSystem)(World* world, f32 dt, Entity_Handle entity, void*
 #define DEF_SYSTEM(system_name) \
     void system_name(World* world, f32 dt, Entity_Handle handle, void** components, void* data)
 
+/**
+ * On update query system function pointer type is called once per update
+ * and iterates the entities itself, usually using a typed world_query.
+ */
+typedef void (*OnUpdateQuerySystem)(World* world, f32 dt, void* data);
+
+#define DEF_QUERY_SYSTEM(system_name) \
+    void system_name(World* world, f32 dt, void* data)
+
+static constexpr u32 system_stats_history = 128; // number of runs kept for the rolling timings
+
+/**
+ * Statistics of the latest runs of a system, collected by update_systems.
+ * Visited entities were iterated by the system, skipped entities are in the
+ * matching chunks but were filtered out since nothing they use changed.
+ */
+struct System_Stats {
+    f32 times[system_stats_history]; // in milliseconds, ring buffer
+    u32 num_times;
+    u32 next_time; // the oldest time once the buffer is full
+    u32 num_entities_visited; // during the last run
+    u32 num_entities_skipped; // during the last run
+};
+
+// NOTE(alexander): summary of the times in System_Stats, in milliseconds
+struct System_Timings {
+    f32 min_time;
+    f32 avg_time;
+    f32 max_time;
+    f32 p99_time;
+};
+
 /**
  * System is just a function that takes some number of components as input.
  * This is a helper structure that defines the function pointer to call and
  * its components to take in as argument (i.e. void** components argument).
+ * Query systems (on_query) iterate by themselves, the components they use
+ * should still be declared.
+ *
+ * The declared components and their access flags are used by the scheduler
+ * to figure out which systems can safely run at the same time.
  */
 struct System {
     enum {
-        Flag_Optional = 1,
+        // Component flags, see use_component
+        Flag_Optional      = 1<<0,
+        Flag_Read_Only     = 1<<1, // component is never written to
+        Flag_Random_Access = 1<<2, // only accessed through get_component on other entities, not iterated
+        Flag_Changed       = 1<<3, // only iterate chunks where this component changed since the last run
+        Flag_Exclude       = 1<<4, // skip entities that have this component, e.g. a tag
+
+        // System flags
+        Flag_Main_Thread   = 1<<8, // e.g. uses OpenGL or modifies global state
+        Flag_Exclusive     = 1<<9, // cannot run at the same time as any other system
+        Flag_Parallel      = 1<<10, // entities are split into batches that run on multiple threads
     };
 
+    const char* name; // shown in the performance window
     void* data;
     OnUpdateSystem on_update;
+    OnUpdateQuerySystem on_query;
+    u32 flags;
+    u32 min_batch_size; // number of entities per batch for parallel systems, 0 uses the default
+    u32 last_run_version; // world change version when this system last ran
     std::vector<u32> component_ids;
     std::vector<u32> component_sizes;
     std::vector<u32> component_flags;
+
+    // NOTE(alexander): built by use_component, an archetype matches if it has every required
+    // component and none of the excluded, optional and random access components doesn't matter.
+    Component_Mask required_mask;
+    Component_Mask optional_mask;
+    Component_Mask excluded_mask;
+    Component_Mask read_only_mask; // components that get_component won't mark as changed
+
+    // NOTE(alexander): archetypes are never removed so the matches are cached and
+    // only the archetypes created since the last run has to be checked.
+    const World* matched_world;
+    u32 num_matched_archetypes; // number of world archetypes checked so far
+    std::vector<u32> matching_archetypes;
+
+    System_Stats stats;
+};
+
+/**
+ * Schedule is a dependency graph between systems built from their component declarations,
+ * a system depends on every earlier system that writes a component it uses (or vice versa).
+ * Systems without dependencies between them are run concurrently on the worlds job system.
+ */
+struct System_Schedule {
+    std::vector<System>* systems;
+    std::vector<std::vector<u32>> dependents; // systems waiting for system i to finish
+    std::vector<u32> dependency_counts; // number of systems that system i waits for
+};
+
+/**
+ * Entities with a parent or children are bucketed by their depth in the hierarchy,
+ * every entity in a level stores the index of its parent in the level above.
+ */
+// NOTE(alexander): where the transforms of an entity in the hierarchy are stored, NULL if it doesn't have them
+struct Hierarchy_Location {
+    const Local_To_Parent* local_to_parent;
+    const u32* local_to_parent_version;
+    Local_To_World* local_to_world;
+    u32* local_to_world_version;
+};
+
+struct Hierarchy_Level {
+    std::vector<Entity_Handle> entities;
+    std::vector<u32> parents; // index of the parent in the level above, unused for the roots
+    std::vector<Hierarchy_Location> locations; // cached, see refresh_hierarchy_locations
+    std::vector<Affine_Transform> world_matrices; // scratch space used when propagating transforms
+    std::vector<u8> changed; // scratch space, if the world matrix changed during propagation
+};
+
+/**
+ * Links of an entity to its parent, children and siblings (or null_entity_handle).
+ * Siblings form a doubly linked list so a child can be attached or detached in constant time.
+ */
+struct Hierarchy_Node {
+    Entity_Handle parent;
+    Entity_Handle first_child;
+    Entity_Handle last_child;
+    Entity_Handle next_sibling;
+    Entity_Handle prev_sibling;
+};
+
+static constexpr u32 invalid_hierarchy_depth = 0xFFFFFFFF; // the entity is not in the hierarchy
+
+struct Hierarchy {
+    std::vector<Hierarchy_Level> levels; // level 0 holds the roots
+    std::vector<Hierarchy_Node> nodes; // links by entity index, see iterate_descendants
+    std::vector<u32> depths; // depth by entity index, see invalid_hierarchy_depth
+    std::vector<u32> indices; // index into the level by entity index
+    bool are_locations_valid; // cleared when the levels change or their entities are moved
 };
 
 /**
@@ -162,19 +563,61 @@ struct World {
 
     std::vector<Entity> entities; // all the live entities
     std::vector<u32> handles; // lookup entity by handle, NOTE: only valid if the entity itself is alive!!!
-    std::unordered_map<u32, std::vector<u8>> components; // where component data is stored
+    std::vector<Archetype> archetypes; // where component data is stored, first one is always empty
+    Chunk_Pool chunk_pool; // where the chunks of every archetype are allocated from
+    Hierarchy hierarchy;
+
+    Job_System* job_system; // optional, used for running systems in parallel
+    std::atomic<u32> structural_change_locks; // number of systems iterating, no entities can move meanwhile
+    std::atomic<u32> change_version; // incremented every time a system runs
+
+    std::vector<Entity_Command_Buffer> command_buffers; // one per thread in the job system
+    std::mutex reserved_entities_mutex; // cmd_spawn_entity is called from every job thread
+    u32 num_reserved_entities; // spawned by command buffers but not yet played back
+    u32 num_reserved_new_indices; // reserved entities that didn't reuse a removed index
+
+    std::vector<Component_Observer> observers; // notified in the order they were added
+    Component_Mask observed_masks[Component_Observer::Num_Events]; // components observed by each event
+    std::vector<Entity_Handle> observer_events[Component_Observer::Num_Events - 1][max_component_types]; // pending adds and removes
+    u32 observer_flush_version; // change version of the last flush, chunks written after are modified
 
     Renderer renderer;
 };
 
 inline bool is_alive(World* world, Entity_Handle entity);
 Entity_Handle spawn_entity(World* world);
+void spawn_entities(World* world, u32 count, const Archetype_Template* archetype_template, Entity_Handle* out_handles);
 void despawn_entity(World* world, Entity_Handle entity);
+void despawn_entities(World* world, const Entity_Handle* handles, u32 count);
+void _add_template_component(Archetype_Template* archetype_template, u32 id, usize size);
 Entity_Handle copy_entity(World* world, Entity_Handle entity);
+Prefab make_prefab(World* world, Entity_Handle root);
+void instantiate_prefab(World* world, const Prefab* prefab, u32 count, Entity_Handle* out_roots);
+void destroy_prefab(Prefab* prefab);
+void clear_world(World* world);
 
 void* _add_component(World* world, Entity* handle, u32 id, usize size);
 bool _remove_component(World* world, Entity* handle, u32 id, usize size);
 void* _get_component(World* world, Entity* handle, u32 id, usize size);
+inline bool _has_component(World* world, Entity* handle, u32 id);
+void add_child(World* world, Entity_Handle parent, Entity_Handle child);
+void remove_child(World* world, Entity_Handle child);
+void remove_from_hierarchy(World* world, Entity_Handle entity);
+Entity_Handle get_parent(World* world, Entity_Handle entity);
+Entity_Handle get_first_child(World* world, Entity_Handle entity);
+Entity_Handle get_next_sibling(World* world, Entity_Handle entity);
+Entity_Command_Buffer* get_command_buffer(World* world);
+Entity_Handle cmd_spawn_entity(Entity_Command_Buffer* cmd, World* world);
+void cmd_despawn_entity(Entity_Command_Buffer* cmd, Entity_Handle entity);
+void* _cmd_add_component(Entity_Command_Buffer* cmd, Entity_Handle entity, u32 id, usize size);
+void _cmd_remove_component(Entity_Command_Buffer* cmd, Entity_Handle entity, u32 id, usize size);
+void play_back_command_buffers(World* world);
+void _observe_component(World* world, u32 id, Component_Observer::Event event, OnObserveComponent on_event, void* data, const char* name);
+void flush_observers(World* world);
 void _use_component(System& system, u32 id, u32 size, u32 flags=0);
 void push_system(std::vector<System>& systems, System system);
-void update_systems(const std::vector<System>& systems, f32 dt);
+void update_systems(World* world, std::vector<System>& systems, f32 dt);
+System_Schedule build_system_schedule(std::vector<System>* systems);
+void update_systems(World* world, System_Schedule* schedule, f32 dt);
+System_Timings get_system_timings(const System_Stats* stats);
+void compact_chunk_pool(World* world);
@@ -0,0 +1,739 @@
+
+/***************************************************************************
+ * ECS benchmarks
+ * Headless executable (lab_ecs_bench) that times the hot paths of the ECS
+ * without creating a window or an OpenGL context. Every benchmark runs at
+ * each entity count and the results are printed as JSON to stdout so two
+ * runs can be diffed, e.g. lab_ecs_bench > before.json
+ *
+ * Usage: lab_ecs_bench [--threads N] [--trs-kernel scalar|sse|avx2]
+ *                      [--cull-kernel scalar|sse|avx2] [entity counts...]
+ * By default systems run on the calling thread at 1k, 100k and 1M entities
+ * and the transform systems use the best kernel the cpu supports. Before
+ * timing anything the SIMD kernels are checked against the scalar kernels.
+ * rss_growth_bytes is the largest growth of the resident set during one run.
+ ***************************************************************************/
+
+#include "main.h"
+#include "job_system.cpp"
+#include "transform_kernels.cpp"
+#include "frustum_culling.cpp"
+#include "ecs.cpp"
+#include "hierarchy.cpp"
+#include "prefab.cpp"
+#include "world_snapshot.cpp"
+
+// NOTE(alexander): current resident set size of the process in bytes, defined at the end of the file
+static usize get_current_rss();
+
+struct Benchmark_Run {
+    World* world;
+    u32 num_entities;
+    std::vector<Entity_Handle> handles;
+    std::chrono::time_point<std::chrono::high_resolution_clock> begin;
+    f64 seconds; // only the timed part of the run
+};
+
+// NOTE(alexander): sets up the world, times the interesting part and returns the number of operations timed
+typedef u64 (*Benchmark_Function)(Benchmark_Run* run);
+
+struct Benchmark {
+    const char* name;
+    Benchmark_Function function;
+};
+
+struct Benchmark_Result {
+    const char* name;
+    u32 num_entities;
+    u32 num_runs;
+    u64 num_ops; // per run
+    f64 min_seconds;
+    f64 total_seconds;
+    usize rss_growth; // largest growth of the resident set during a single run
+};
+
+static constexpr u32 num_update_frames = 10;
+static constexpr u32 hierarchy_branching = 8;
+
+static inline void
+begin_timing(Benchmark_Run* run) {
+    run->begin = std::chrono::high_resolution_clock::now();
+}
+
+static inline void
+end_timing(Benchmark_Run* run) {
+    auto end = std::chrono::high_resolution_clock::now();
+    run->seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - run->begin).count() / 1000000000.0;
+}
+
+static void
+spawn_benchmark_entities(Benchmark_Run* run, const Archetype_Template* archetype_template) {
+    run->handles.resize(run->num_entities);
+    spawn_entities(run->world, run->num_entities, archetype_template, run->handles.data());
+}
+
+/***************************************************************************
+ * Structural changes and random access
+ ***************************************************************************/
+
+static u64
+bench_spawn_entity(Benchmark_Run* run) {
+    World* world = run->world;
+    run->handles.resize(run->num_entities);
+
+    begin_timing(run);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        run->handles[i] = spawn_entity(world);
+    }
+    end_timing(run);
+    return run->num_entities;
+}
+
+static u64
+bench_despawn_entity(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    World* world = run->world;
+    begin_timing(run);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        despawn_entity(world, run->handles[i]);
+    }
+    end_timing(run);
+    return run->num_entities;
+}
+
+// NOTE(alexander): despawns every other entity in a random order, so most of the rows are moved
+static u64
+bench_despawn_entities(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    World* world = run->world;
+    std::vector<Entity_Handle> despawned;
+    for (u32 i = 0; i < run->num_entities; i++) {
+        Position* pos = get_component(world, run->handles[i], Position);
+        pos->v.x = (f32) i;
+        if (i % 2 == 0) despawned.push_back(run->handles[i]);
+    }
+    std::shuffle(despawned.begin(), despawned.end(), std::mt19937(1234));
+
+    begin_timing(run);
+    despawn_entities(world, despawned.data(), (u32) despawned.size());
+    end_timing(run);
+
+    // NOTE(alexander): checked in release builds as well, the benchmarks are usually built without asserts
+    u32 num_mismatches = 0;
+    for (u32 i = 0; i < run->num_entities; i++) {
+        bool is_kept = i % 2 == 1;
+        Position* pos = is_kept && is_alive(world, run->handles[i]) ? get_component(world, run->handles[i], Position) : NULL;
+        if (is_alive(world, run->handles[i]) != is_kept || (is_kept && (!pos || pos->v.x != (f32) i))) {
+            num_mismatches++;
+        }
+    }
+    if (num_mismatches > 0 || world->entities.size() != run->num_entities - despawned.size()) {
+        fprintf(stderr, "despawn_entities failed, %u of %u entities are wrong\n", num_mismatches, run->num_entities);
+        exit(1);
+    }
+    return despawned.size();
+}
+
+static u64
+bench_add_component(Benchmark_Run* run) {
+    spawn_benchmark_entities(run, NULL);
+
+    World* world = run->world;
+    begin_timing(run);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        add_component(world, run->handles[i], Position);
+    }
+    end_timing(run);
+    return run->num_entities;
+}
+
+static u64
+bench_get_component(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    add_template_component(&archetype_template, Scale);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    // NOTE(alexander): random order so the lookups are not just walking the chunks in order
+    std::mt19937 rng(1234);
+    std::shuffle(run->handles.begin(), run->handles.end(), rng);
+
+    World* world = run->world;
+    begin_timing(run);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        Position* pos = get_component(world, run->handles[i], Position);
+        pos->v.x += 1.0f;
+    }
+    end_timing(run);
+    return run->num_entities;
+}
+
+static u64
+bench_remove_component(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    World* world = run->world;
+    begin_timing(run);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        remove_component(world, run->handles[i], Rotation);
+    }
+    end_timing(run);
+    return run->num_entities;
+}
+
+static void
+count_observed_entities(World* world, const Entity_Handle* entities, u32 count, void* data) {
+    *(u64*) data += count;
+}
+
+// NOTE(alexander): same as add_component but with an observer, includes delivering the events
+static u64
+bench_observed_add_component(Benchmark_Run* run) {
+    spawn_benchmark_entities(run, NULL);
+
+    World* world = run->world;
+    u64 num_observed = 0;
+    observe_component(world, Position, On_Add, &count_observed_entities, &num_observed);
+
+    begin_timing(run);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        add_component(world, run->handles[i], Position);
+    }
+    flush_observers(world);
+    end_timing(run);
+    assert(num_observed == run->num_entities && "every added component should be observed");
+    return run->num_entities;
+}
+
+/***************************************************************************
+ * Systems
+ ***************************************************************************/
+
+DEF_QUERY_SYSTEM(bench_move_system) {
+    world_query<Position>(world, [dt](Position& pos) {
+        pos.v.x += dt;
+    });
+}
+
+DEF_QUERY_SYSTEM(bench_trs_system) {
+    world_query<Local_To_World, const Position, const Rotation, const Scale>
+        (world, [](Local_To_World& local_to_world, const Position& pos, const Rotation& rot, const Scale& scl) {
+            local_to_world.m = trs_matrix(&pos, &rot, &scl);
+        });
+}
+
+// NOTE(alexander): the first update finds the matching archetypes, it is not part of the timing
+static void
+time_update_systems(Benchmark_Run* run, std::vector<System>& systems) {
+    update_systems(run->world, systems, 0.016f);
+
+    begin_timing(run);
+    for (u32 frame = 0; frame < num_update_frames; frame++) {
+        update_systems(run->world, systems, 0.016f);
+    }
+    end_timing(run);
+}
+
+static u64
+bench_update_systems_single(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Position);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    std::vector<System> systems;
+    System move = {};
+    move.name = "bench_move_system";
+    move.on_query = &bench_move_system;
+    move.flags = System::Flag_Parallel;
+    use_component(move, Position);
+    push_system(systems, move);
+
+    time_update_systems(run, systems);
+    return (u64) run->num_entities*num_update_frames;
+}
+
+static u64
+bench_update_systems_multi(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Local_To_World);
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    add_template_component(&archetype_template, Scale);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    std::vector<System> systems;
+    System trs = {};
+    trs.name = "bench_trs_system";
+    trs.on_query = &bench_trs_system;
+    trs.flags = System::Flag_Parallel;
+    use_component(trs, Local_To_World);
+    use_component(trs, Position, System::Flag_Read_Only);
+    use_component(trs, Rotation, System::Flag_Read_Only);
+    use_component(trs, Scale, System::Flag_Read_Only);
+    push_system(systems, trs);
+
+    time_update_systems(run, systems);
+    return (u64) run->num_entities*num_update_frames;
+}
+
+// NOTE(alexander): every entity moves so the transform systems recompute every matrix each frame
+static u64
+bench_transform_systems(Benchmark_Run* run) {
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Local_To_World);
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    add_template_component(&archetype_template, Scale);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    std::vector<System> systems;
+    System move = {};
+    move.name = "bench_move_system";
+    move.on_query = &bench_move_system;
+    move.flags = System::Flag_Parallel;
+    use_component(move, Position);
+    push_system(systems, move);
+    push_transform_systems(systems);
+
+    time_update_systems(run, systems);
+    return (u64) run->num_entities*num_update_frames;
+}
+
+/**
+ * Single tree where every parent has hierarchy_branching children, the root
+ * moves every frame so the whole tree has to be propagated again. Shuffled
+ * trees are linked in a random order, so the levels don't start out in the
+ * same order as the chunks.
+ */
+static u64
+time_hierarchy_propagation(Benchmark_Run* run, bool is_shuffled) {
+    World* world = run->world;
+    Archetype_Template root_template = {};
+    add_template_component(&root_template, Local_To_World);
+    add_template_component(&root_template, Position);
+    add_template_component(&root_template, Rotation);
+
+    Archetype_Template child_template = root_template;
+    add_template_component(&child_template, Local_To_Parent);
+
+    run->handles.resize(run->num_entities);
+    spawn_entities(world, 1, &root_template, run->handles.data());
+    spawn_entities(world, run->num_entities - 1, &child_template, run->handles.data() + 1);
+    if (is_shuffled) {
+        std::shuffle(run->handles.begin() + 1, run->handles.end(), std::mt19937(1234));
+    }
+    for (u32 i = 1; i < run->num_entities; i++) {
+        Position* pos = get_component(world, run->handles[i], Position);
+        pos->v = glm::vec3(1.0f, 0.0f, 0.0f);
+        add_child(world, run->handles[(i - 1)/hierarchy_branching], run->handles[i]);
+    }
+
+    std::vector<System> systems;
+    push_hierarchical_transform_systems(systems);
+    update_systems(world, systems, 0.016f);
+
+    begin_timing(run);
+    for (u32 frame = 0; frame < num_update_frames; frame++) {
+        Position* root_pos = get_component(world, run->handles[0], Position);
+        root_pos->v.y += 1.0f;
+        update_systems(world, systems, 0.016f);
+    }
+    end_timing(run);
+    return (u64) run->num_entities*num_update_frames;
+}
+
+static u64
+bench_hierarchy_propagation(Benchmark_Run* run) {
+    return time_hierarchy_propagation(run, false);
+}
+
+static u64
+bench_hierarchy_propagation_shuffled(Benchmark_Run* run) {
+    return time_hierarchy_propagation(run, true);
+}
+
+/**
+ * Scatters copies of a snowman like prefab (a root with five descendants)
+ * until there are about as many entities as requested.
+ */
+static u64
+bench_instantiate_prefab(Benchmark_Run* run) {
+    World* world = run->world;
+    Archetype_Template root_template = {};
+    add_template_component(&root_template, Local_To_World);
+    add_template_component(&root_template, Position);
+    add_template_component(&root_template, Rotation);
+    add_template_component(&root_template, Scale);
+
+    Archetype_Template child_template = root_template;
+    add_template_component(&child_template, Local_To_Parent);
+
+    Entity_Handle parts[6];
+    spawn_entities(world, 1, &root_template, &parts[0]);
+    spawn_entities(world, 5, &child_template, &parts[1]);
+    add_child(world, parts[0], parts[1]);
+    add_child(world, parts[1], parts[2]);
+    add_child(world, parts[1], parts[3]);
+    add_child(world, parts[1], parts[4]);
+    add_child(world, parts[2], parts[5]);
+
+    Prefab prefab = make_prefab(world, parts[0]);
+    u32 num_instances = max(run->num_entities/array_count(parts), 1u);
+    run->handles.resize(num_instances);
+
+    begin_timing(run);
+    instantiate_prefab(world, &prefab, num_instances, run->handles.data());
+    end_timing(run);
+
+    destroy_prefab(&prefab);
+    return (u64) num_instances*array_count(parts);
+}
+
+/**
+ * Unit cubes scattered over a wide world with a camera in the middle looking along -z,
+ * so most of them are outside the frustum like in the simple world scene.
+ */
+static u64
+bench_frustum_culling(Benchmark_Run* run) {
+    World* world = run->world;
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, World_Bounds);
+    spawn_benchmark_entities(run, &archetype_template);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<f32> dist(-500.0f, 500.0f);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        World_Bounds* bounds = get_component(world, run->handles[i], World_Bounds);
+        bounds->center = glm::vec3(dist(rng), dist(rng)*0.1f, dist(rng));
+        bounds->extents = glm::vec3(0.5f);
+        bounds->radius = sqrtf(0.75f);
+    }
+
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f/9.0f, 0.1f, 300.0f);
+    Frustum frustum = make_frustum(proj*glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    std::vector<u8> visible;
+    u32 num_visible = 0;
+
+    begin_timing(run);
+    for (u32 frame = 0; frame < num_update_frames; frame++) {
+        world_query_chunks<const World_Bounds>(world, [&](u32 count, const World_Bounds* bounds) {
+            visible.resize(count);
+            num_visible += cull_bounds(&frustum, bounds, count, visible.data());
+        });
+    }
+    end_timing(run);
+
+    // NOTE(alexander): checked in release builds as well, the benchmarks are usually built without asserts
+    if (num_visible >= run->num_entities*num_update_frames) {
+        fprintf(stderr, "frustum culling failed, none of the %u bounds were culled\n", run->num_entities);
+        exit(1);
+    }
+    return (u64) run->num_entities*num_update_frames;
+}
+
+/**
+ * Saves the world and loads it back into the same world, checks that every entity
+ * came back with the same components and parent. Small counts only fill part of
+ * the last chunk page which is still written in full.
+ */
+static u64
+bench_save_load_snapshot(Benchmark_Run* run) {
+    static const char* snapshot_path = "lab_ecs_bench.snapshot";
+    World* world = run->world;
+    Archetype_Template archetype_template = {};
+    add_template_component(&archetype_template, Position);
+    add_template_component(&archetype_template, Rotation);
+    add_template_component(&archetype_template, Debug_Name);
+    spawn_benchmark_entities(run, &archetype_template);
+    for (u32 i = 0; i < run->num_entities; i++) {
+        Position* pos = get_component(world, run->handles[i], Position);
+        pos->v = glm::vec3((f32) i, 0.0f, 0.0f);
+        Debug_Name* name = get_component(world, run->handles[i], Debug_Name);
+        name->s = "Entity " + std::to_string(i);
+        if (i > 0) add_child(world, run->handles[(i - 1)/hierarchy_branching], run->handles[i]);
+    }
+
+    Snapshot_Assets assets = {};
+    begin_timing(run);
+    bool is_saved = save_world_snapshot(world, snapshot_path, &assets);
+    bool is_loaded = is_saved && load_world_snapshot(world, snapshot_path, &assets);
+    end_timing(run);
+
+    // NOTE(alexander): checked in release builds as well, the benchmarks are usually built without asserts
+    u32 num_mismatches = is_loaded ? 0 : run->num_entities;
+    for (u32 i = 0; i < run->num_entities && is_loaded; i++) {
+        Entity_Handle entity = run->handles[i];
+        Position* pos = get_component(world, entity, Position);
+        Debug_Name* name = get_component(world, entity, Debug_Name);
+        Entity_Handle parent = i > 0 ? run->handles[(i - 1)/hierarchy_branching] : null_entity_handle;
+        if (!pos || pos->v.x != (f32) i ||
+            !name || name->s != "Entity " + std::to_string(i) ||
+            get_parent(world, entity) != parent) {
+            num_mismatches++;
+        }
+    }
+
+    // NOTE(alexander): the loaded chunks are mapped from the file, release them before removing it
+    clear_world(world);
+    remove(snapshot_path);
+    if (num_mismatches > 0) {
+        fprintf(stderr, "snapshot round trip failed, %u of %u entities were not restored\n",
+                num_mismatches, run->num_entities);
+        exit(1);
+    }
+    return run->num_entities;
+}
+
+/***************************************************************************
+ * Kernel checks
+ ***************************************************************************/
+
+static bool
+is_kernel_supported(void* kernel) {
+#if TRS_KERNEL_X64
+    if (kernel == (void*) &trs_kernel_avx2 || kernel == (void*) &cull_kernel_avx2) return cpu_supports_avx2();
+#endif
+    return true;
+}
+
+/**
+ * Runs every SIMD kernel the cpu supports on the same random input as the scalar
+ * kernel and exits if the results differ. The count is not a multiple of 8 so the
+ * remainder paths are checked too. The transforms only have to be close since
+ * the AVX2 kernel uses fused multiply adds.
+ */
+static void
+check_kernels_match_scalar() {
+    static constexpr u32 count = 1027;
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<f32> dist(-1.0f, 1.0f);
+
+    std::vector<Position> pos(count);
+    std::vector<Rotation> rot(count);
+    std::vector<Scale> scl(count);
+    std::vector<World_Bounds> bounds(count);
+    for (u32 i = 0; i < count; i++) {
+        pos[i].v = glm::vec3(dist(rng), dist(rng), dist(rng))*100.0f;
+        rot[i].q = glm::normalize(glm::quat(dist(rng), dist(rng), dist(rng), dist(rng)));
+        scl[i].v = glm::vec3(dist(rng), dist(rng), dist(rng))*2.0f;
+        bounds[i].center = glm::vec3(dist(rng)*500.0f, dist(rng)*50.0f, dist(rng)*500.0f);
+        bounds[i].extents = glm::vec3(1.0f + dist(rng)*0.5f);
+        bounds[i].radius = glm::length(bounds[i].extents);
+    }
+
+    std::vector<Affine_Transform> expected_transforms(count);
+    std::vector<Affine_Transform> transforms(count);
+    trs_kernel_scalar(expected_transforms.data(), pos.data(), rot.data(), scl.data(), count);
+    for (int k = 1; k < array_count(trs_kernels); k++) {
+        if (!is_kernel_supported((void*) trs_kernels[k].kernel)) continue;
+        trs_kernels[k].kernel(transforms.data(), pos.data(), rot.data(), scl.data(), count);
+        for (u32 i = 0; i < count; i++) {
+            for (int row = 0; row < 3; row++) {
+                glm::vec4 diff = glm::abs(transforms[i].rows[row] - expected_transforms[i].rows[row]);
+                if (diff.x > 1e-3f || diff.y > 1e-3f || diff.z > 1e-3f || diff.w > 1e-3f) {
+                    fprintf(stderr, "trs kernel `%s` doesn't match the scalar kernel at index %u\n", trs_kernels[k].name, i);
+                    exit(1);
+                }
+            }
+        }
+    }
+
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f/9.0f, 0.1f, 300.0f);
+    Frustum frustum = make_frustum(proj*glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    std::vector<u8> expected_visible(count);
+    std::vector<u8> visible(count);
+    u32 expected_num_visible = cull_kernel_scalar(&frustum, bounds.data(), count, expected_visible.data());
+    for (int k = 1; k < array_count(cull_kernels); k++) {
+        if (!is_kernel_supported((void*) cull_kernels[k].kernel)) continue;
+        u32 num_visible = cull_kernels[k].kernel(&frustum, bounds.data(), count, visible.data());
+        if (num_visible != expected_num_visible || visible != expected_visible) {
+            fprintf(stderr, "cull kernel `%s` doesn't match the scalar kernel, %u visible instead of %u\n",
+                    cull_kernels[k].name, num_visible, expected_num_visible);
+            exit(1);
+        }
+    }
+}
+
+/***************************************************************************
+ * Running and reporting
+ ***************************************************************************/
+
+static const Benchmark benchmarks[] = {
+    { "spawn_entity",                   &bench_spawn_entity },
+    { "despawn_entity",                 &bench_despawn_entity },
+    { "despawn_entities",               &bench_despawn_entities },
+    { "add_component",                  &bench_add_component },
+    { "get_component",                  &bench_get_component },
+    { "remove_component",               &bench_remove_component },
+    { "observed_add_component",         &bench_observed_add_component },
+    { "update_systems_single",          &bench_update_systems_single },
+    { "update_systems_multi",           &bench_update_systems_multi },
+    { "transform_systems",              &bench_transform_systems },
+    { "hierarchy_propagation",          &bench_hierarchy_propagation },
+    { "hierarchy_propagation_shuffled", &bench_hierarchy_propagation_shuffled },
+    { "instantiate_prefab",             &bench_instantiate_prefab },
+    { "frustum_culling",                &bench_frustum_culling },
+    { "save_load_snapshot",             &bench_save_load_snapshot },
+};
+
+// NOTE(alexander): small counts are repeated more to get a stable minimum
+static u32
+get_num_benchmark_runs(u32 num_entities) {
+    u32 num_runs = 1000000/num_entities;
+    return num_runs < 3 ? 3 : min(num_runs, 100u);
+}
+
+static Benchmark_Result
+run_benchmark(const Benchmark& benchmark, u32 num_entities, Job_System* job_system) {
+    Benchmark_Result result = {};
+    result.name = benchmark.name;
+    result.num_entities = num_entities;
+    result.num_runs = get_num_benchmark_runs(num_entities);
+
+    for (u32 i = 0; i < result.num_runs; i++) {
+        World world = {};
+        world.job_system = job_system;
+
+        Benchmark_Run run = {};
+        run.world = &world;
+        run.num_entities = num_entities;
+        usize rss_before = get_current_rss();
+        result.num_ops = benchmark.function(&run);
+        usize rss_after = get_current_rss();
+        clear_world(&world);
+
+        // NOTE(alexander): memory freed by an earlier run may be reused without growing the resident set
+        if (rss_after > rss_before && rss_after - rss_before > result.rss_growth) {
+            result.rss_growth = rss_after - rss_before;
+        }
+
+        if (i == 0 || run.seconds < result.min_seconds) {
+            result.min_seconds = run.seconds;
+        }
+        result.total_seconds += run.seconds;
+    }
+
+    return result;
+}
+
+static void
+print_benchmark_result(const Benchmark_Result& result, bool is_last) {
+    f64 ns_per_op = result.min_seconds*1000000000.0/(f64) result.num_ops;
+    f64 mean_ns_per_op = result.total_seconds*1000000000.0/((f64) result.num_ops*result.num_runs);
+    f64 ops_per_second = result.min_seconds > 0.0 ? (f64) result.num_ops/result.min_seconds : 0.0;
+
+    printf("    {\"name\": \"%s\", \"entities\": %u, \"runs\": %u, \"ops\": %llu, "
+           "\"ns_per_op\": %.3f, \"ns_per_op_mean\": %.3f, \"ops_per_second\": %.0f, \"rss_growth_bytes\": %llu}%s\n",
+           result.name, result.num_entities, result.num_runs, (unsigned long long) result.num_ops,
+           ns_per_op, mean_ns_per_op, ops_per_second, (unsigned long long) result.rss_growth,
+           is_last ? "" : ",");
+    fflush(stdout);
+}
+
+int
+main(int argc, char** argv) {
+    std::vector<u32> entity_counts;
+    u32 num_threads = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = (u32) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trs-kernel") == 0 && i + 1 < argc) {
+            if (!set_trs_kernel(argv[++i])) {
+                fprintf(stderr, "trs kernel `%s` is not supported on this cpu\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cull-kernel") == 0 && i + 1 < argc) {
+            if (!set_cull_kernel(argv[++i])) {
+                fprintf(stderr, "cull kernel `%s` is not supported on this cpu\n", argv[i]);
+                return 1;
+            }
+        } else if (atoi(argv[i]) > 0) {
+            entity_counts.push_back((u32) atoi(argv[i]));
+        } else {
+            fprintf(stderr, "usage: %s [--threads N] [--trs-kernel scalar|sse|avx2] [--cull-kernel scalar|sse|avx2] [entity counts...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (entity_counts.size() == 0) {
+        entity_counts = { 1000, 100000, 1000000 };
+    }
+
+    check_kernels_match_scalar();
+
+    Job_System* job_system = NULL;
+    if (num_threads > 0) {
+        job_system = new Job_System();
+        initialize_job_system(job_system, num_threads);
+    }
+
+    printf("{\n");
+    printf("  \"chunk_size\": %u,\n", (u32) chunk_size);
+    printf("  \"threads\": %u,\n", num_threads);
+    printf("  \"trs_kernel\": \"%s\",\n", get_trs_kernel_name());
+    printf("  \"cull_kernel\": \"%s\",\n", get_cull_kernel_name());
+    printf("  \"update_frames\": %u,\n", num_update_frames);
+    printf("  \"benchmarks\": [\n");
+    for (int i = 0; i < entity_counts.size(); i++) {
+        for (int j = 0; j < array_count(benchmarks); j++) {
+            Benchmark_Result result = run_benchmark(benchmarks[j], entity_counts[i], job_system);
+            print_benchmark_result(result, i + 1 == entity_counts.size() && j + 1 == array_count(benchmarks));
+        }
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    if (job_system) {
+        shutdown_job_system(job_system);
+        delete job_system;
+    }
+    return 0;
+}
+
+// NOTE(alexander): don't expose this to the rest of the codebase!
+#include "platform.cpp"
+
+#ifdef _WIN32
+#include <psapi.h>
+
+static usize
+get_current_rss() {
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (usize) counters.WorkingSetSize;
+}
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+
+static usize
+get_current_rss() {
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) return 0;
+    return (usize) info.resident_size;
+}
+#else
+#include <unistd.h>
+
+static usize
+get_current_rss() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+    unsigned long long num_pages = 0, num_resident_pages = 0;
+    int num_read = fscanf(file, "%llu %llu", &num_pages, &num_resident_pages);
+    fclose(file);
+    if (num_read != 2) return 0;
+    return (usize) num_resident_pages*(usize) sysconf(_SC_PAGESIZE);
+}
+#endif
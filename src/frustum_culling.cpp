@@ -0,0 +1,220 @@
+/***************************************************************************
+ * Frustum culling
+ * Tests the world space bounds of many entities against the six planes of
+ * the camera frustum at once. A bound is visible unless it is completely
+ * behind one of the planes, how far it reaches towards a plane is the
+ * smallest of the projected box extents and the sphere radius. Like the
+ * transform kernels this uses AVX2 (8 bounds at a time) or SSE (4 at a time)
+ * on x64 depending on the cpu, otherwise a scalar loop.
+ ***************************************************************************/
+
+// NOTE(alexander): planes are normalized, points inside the frustum has a positive distance
+struct Frustum {
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+/**
+ * Extracts the frustum planes from the rows of view_proj (Gribb/Hartmann),
+ * i.e. the clip space conditions -w <= x, y, z <= w in world space.
+ */
+Frustum
+make_frustum(const glm::mat4& view_proj) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]);
+    }
+
+    Frustum frustum;
+    for (int i = 0; i < 3; i++) {
+        frustum.planes[i*2 + 0] = rows[3] + rows[i];
+        frustum.planes[i*2 + 1] = rows[3] - rows[i];
+    }
+    for (int i = 0; i < 6; i++) {
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    }
+    return frustum;
+}
+
+/**
+ * Transforms the local bounds of the mesh, the box becomes the world space box around
+ * the transformed local box and the radius is scaled by the largest axis scale.
+ */
+void
+compute_world_bounds(World_Bounds* out, const Mesh& mesh, const Affine_Transform& m) {
+    glm::vec3 axis_scale_sq(0.0f);
+    for (int i = 0; i < 3; i++) {
+        glm::vec3 row = glm::vec3(m.rows[i]);
+        out->center[i] = glm::dot(row, mesh.bounds_center) + m.rows[i].w;
+        out->extents[i] = glm::dot(glm::abs(row), mesh.bounds_extents);
+        axis_scale_sq += row*row;
+    }
+    f32 max_scale_sq = max(axis_scale_sq.x, max(axis_scale_sq.y, axis_scale_sq.z));
+    out->radius = mesh.bounds_radius*sqrtf(max_scale_sq);
+}
+
+/**
+ * Writes 1 to visible for each bound that intersects the frustum and 0 otherwise,
+ * returns the number of visible bounds.
+ */
+typedef u32 (*Cull_Kernel)(const Frustum* frustum, const World_Bounds* bounds, u32 count, u8* visible);
+
+static u32
+cull_kernel_scalar(const Frustum* frustum, const World_Bounds* bounds, u32 count, u8* visible) {
+    u32 num_visible = 0;
+    for (u32 i = 0; i < count; i++) {
+        const World_Bounds& b = bounds[i];
+        bool is_inside = true;
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum->planes[p];
+            f32 distance = glm::dot(glm::vec3(plane), b.center) + plane.w;
+            f32 reach = min(glm::dot(glm::abs(glm::vec3(plane)), b.extents), b.radius);
+            is_inside = is_inside && distance + reach >= 0.0f;
+        }
+        visible[i] = is_inside;
+        num_visible += is_inside;
+    }
+    return num_visible;
+}
+
+#if TRS_KERNEL_X64
+
+static constexpr u32 bounds_stride = sizeof(World_Bounds)/sizeof(f32);
+
+/***************************************************************************
+ * SSE kernel, 4 bounds at a time
+ ***************************************************************************/
+
+static u32
+cull_kernel_sse(const Frustum* frustum, const World_Bounds* bounds, u32 count, u8* visible) {
+    const __m128 zero = _mm_setzero_ps();
+
+    u32 num_visible = 0;
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 cx = load_strided4(&bounds[i].center.x, bounds_stride, 0.0f);
+        __m128 cy = load_strided4(&bounds[i].center.y, bounds_stride, 0.0f);
+        __m128 cz = load_strided4(&bounds[i].center.z, bounds_stride, 0.0f);
+        __m128 ex = load_strided4(&bounds[i].extents.x, bounds_stride, 0.0f);
+        __m128 ey = load_strided4(&bounds[i].extents.y, bounds_stride, 0.0f);
+        __m128 ez = load_strided4(&bounds[i].extents.z, bounds_stride, 0.0f);
+        __m128 r  = load_strided4(&bounds[i].radius, bounds_stride, 0.0f);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum->planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx),
+                                                    _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz),
+                                                    _mm_set1_ps(plane.w)));
+            __m128 box_reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex),
+                                                     _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey)),
+                                          _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez));
+            __m128 reach = _mm_min_ps(box_reach, r);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), zero));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++) {
+            visible[i + k] = (mask >> k) & 1;
+            num_visible += visible[i + k];
+        }
+    }
+
+    return num_visible + cull_kernel_scalar(frustum, bounds + i, count - i, visible + i);
+}
+
+/***************************************************************************
+ * AVX2 kernel, 8 bounds at a time
+ ***************************************************************************/
+
+TARGET_AVX2 static u32
+cull_kernel_avx2(const Frustum* frustum, const World_Bounds* bounds, u32 count, u8* visible) {
+    const __m256 zero = _mm256_setzero_ps();
+
+    u32 num_visible = 0;
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 cx = load_strided8(&bounds[i].center.x, bounds_stride, 0.0f);
+        __m256 cy = load_strided8(&bounds[i].center.y, bounds_stride, 0.0f);
+        __m256 cz = load_strided8(&bounds[i].center.z, bounds_stride, 0.0f);
+        __m256 ex = load_strided8(&bounds[i].extents.x, bounds_stride, 0.0f);
+        __m256 ey = load_strided8(&bounds[i].extents.y, bounds_stride, 0.0f);
+        __m256 ez = load_strided8(&bounds[i].extents.z, bounds_stride, 0.0f);
+        __m256 r  = load_strided8(&bounds[i].radius, bounds_stride, 0.0f);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum->planes[p];
+            __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(plane.x), cx, _mm256_set1_ps(plane.w));
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(plane.y), cy, distance);
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(plane.z), cz, distance);
+            __m256 box_reach = _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.x)), ex);
+            box_reach = _mm256_fmadd_ps(_mm256_set1_ps(fabsf(plane.y)), ey, box_reach);
+            box_reach = _mm256_fmadd_ps(_mm256_set1_ps(fabsf(plane.z)), ez, box_reach);
+            __m256 reach = _mm256_min_ps(box_reach, r);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++) {
+            visible[i + k] = (mask >> k) & 1;
+            num_visible += visible[i + k];
+        }
+    }
+
+    return num_visible + cull_kernel_sse(frustum, bounds + i, count - i, visible + i);
+}
+
+#endif
+
+struct Cull_Kernel_Info {
+    const char* name;
+    Cull_Kernel kernel;
+};
+
+static const Cull_Kernel_Info cull_kernels[] = {
+    { "scalar", &cull_kernel_scalar },
+#if TRS_KERNEL_X64
+    { "sse",    &cull_kernel_sse },
+    { "avx2",   &cull_kernel_avx2 },
+#endif
+};
+
+static const Cull_Kernel_Info*
+find_best_cull_kernel() {
+#if TRS_KERNEL_X64
+    return cpu_supports_avx2() ? &cull_kernels[2] : &cull_kernels[1];
+#else
+    return &cull_kernels[0];
+#endif
+}
+
+// NOTE(alexander): the kernel used by the mesh renderer, see set_cull_kernel
+static const Cull_Kernel_Info* current_cull_kernel = find_best_cull_kernel();
+
+static inline u32
+cull_bounds(const Frustum* frustum, const World_Bounds* bounds, u32 count, u8* visible) {
+    return current_cull_kernel->kernel(frustum, bounds, count, visible);
+}
+
+const char*
+get_cull_kernel_name() {
+    return current_cull_kernel->name;
+}
+
+/**
+ * Overrides the kernel chosen at startup, e.g. to compare them in benchmarks.
+ * Returns false if the kernel doesn't exist or isn't supported by this cpu.
+ */
+bool
+set_cull_kernel(const char* name) {
+    for (int i = 0; i < array_count(cull_kernels); i++) {
+        if (strcmp(cull_kernels[i].name, name) != 0) continue;
+#if TRS_KERNEL_X64
+        if (cull_kernels[i].kernel == &cull_kernel_avx2 && !cpu_supports_avx2()) return false;
+#endif
+        current_cull_kernel = &cull_kernels[i];
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,500 @@
+/***************************************************************************
+ * Hierarchy
+ * The links between parents and children are stored by entity index in
+ * Hierarchy::nodes, so walking a subtree or moving it to another parent
+ * never has to look up any components. Entities in the hierarchy are also
+ * bucketed by their depth, level 0 holds the roots (entities with children
+ * but without a parent). Each entity knows the index of its parent in the
+ * level above, so transforms are propagated one level at a time by
+ * streaming through the levels in order. Each level is kept sorted by
+ * where its entities are stored and caches where their transforms are,
+ * so the chunks are also read and written in order.
+ ***************************************************************************/
+
+static const Hierarchy_Node empty_hierarchy_node = {
+    null_entity_handle, null_entity_handle, null_entity_handle, null_entity_handle, null_entity_handle
+};
+
+static inline u32
+get_hierarchy_depth(World* world, Entity_Handle entity) {
+    u32 index = get_entity_index(entity);
+    const Hierarchy& hierarchy = world->hierarchy;
+    return index < hierarchy.depths.size() ? hierarchy.depths[index] : invalid_hierarchy_depth;
+}
+
+static inline u32
+get_hierarchy_index(World* world, Entity_Handle entity) {
+    return world->hierarchy.indices[get_entity_index(entity)];
+}
+
+// NOTE(alexander): entities that were never part of the hierarchy may be past the end of the node array
+static inline const Hierarchy_Node&
+read_hierarchy_node(World* world, Entity_Handle entity) {
+    u32 index = get_entity_index(entity);
+    const Hierarchy& hierarchy = world->hierarchy;
+    return index < hierarchy.nodes.size() ? hierarchy.nodes[index] : empty_hierarchy_node;
+}
+
+// NOTE(alexander): the node has to exist, see reserve_hierarchy_node
+static inline Hierarchy_Node&
+get_hierarchy_node(World* world, Entity_Handle entity) {
+    return world->hierarchy.nodes[get_entity_index(entity)];
+}
+
+static void
+reserve_hierarchy_node(World* world, Entity_Handle entity) {
+    Hierarchy& hierarchy = world->hierarchy;
+    u32 index = get_entity_index(entity);
+    if (index >= hierarchy.nodes.size()) {
+        hierarchy.nodes.resize(index + 1, empty_hierarchy_node);
+        hierarchy.depths.resize(index + 1, invalid_hierarchy_depth);
+        hierarchy.indices.resize(index + 1, 0);
+    }
+}
+
+Entity_Handle
+get_parent(World* world, Entity_Handle entity) {
+    return read_hierarchy_node(world, entity).parent;
+}
+
+Entity_Handle
+get_first_child(World* world, Entity_Handle entity) {
+    return read_hierarchy_node(world, entity).first_child;
+}
+
+Entity_Handle
+get_next_sibling(World* world, Entity_Handle entity) {
+    return read_hierarchy_node(world, entity).next_sibling;
+}
+
+/**
+ * Calls fn(Entity_Handle) for every descendant of root in depth first order,
+ * parents are always visited before their children. The root itself is not visited.
+ * The hierarchy cannot be changed from inside fn.
+ */
+template <typename Function>
+void
+iterate_descendants(World* world, Entity_Handle root, Function fn) {
+    const std::vector<Hierarchy_Node>& nodes = world->hierarchy.nodes;
+    Entity_Handle entity = read_hierarchy_node(world, root).first_child;
+    while (entity != null_entity_handle) {
+        fn(entity);
+
+        const Hierarchy_Node* node = &nodes[get_entity_index(entity)];
+        if (node->first_child != null_entity_handle) {
+            entity = node->first_child;
+            continue;
+        }
+
+        // NOTE(alexander): go up until there is a sibling to continue with, or back at the root
+        while (node->next_sibling == null_entity_handle) {
+            entity = node->parent;
+            if (entity == root) return;
+            node = &nodes[get_entity_index(entity)];
+        }
+        entity = node->next_sibling;
+    }
+}
+
+static void
+insert_into_hierarchy_level(World* world, Entity_Handle entity, u32 depth, u32 parent_index) {
+    Hierarchy& hierarchy = world->hierarchy;
+    if (depth >= hierarchy.levels.size()) {
+        hierarchy.levels.resize(depth + 1);
+    }
+    reserve_hierarchy_node(world, entity);
+
+    u32 index = get_entity_index(entity);
+    Hierarchy_Level& level = hierarchy.levels[depth];
+    hierarchy.depths[index] = depth;
+    hierarchy.indices[index] = (u32) level.entities.size();
+    level.entities.push_back(entity);
+    level.parents.push_back(parent_index);
+    hierarchy.are_locations_valid = false;
+}
+
+// NOTE(alexander): the children of the entity are assumed to be in the level below it
+static void
+set_children_parent_index(World* world, Entity_Handle entity, u32 depth, u32 parent_index) {
+    Entity_Handle child = read_hierarchy_node(world, entity).first_child;
+    if (child == null_entity_handle) return;
+
+    Hierarchy_Level& level = world->hierarchy.levels[depth + 1];
+    while (child != null_entity_handle) {
+        level.parents[get_hierarchy_index(world, child)] = parent_index;
+        child = get_hierarchy_node(world, child).next_sibling;
+    }
+}
+
+// NOTE(alexander): fills the hole with the last entity in the level (swap and pop)
+static void
+remove_from_hierarchy_level(World* world, Entity_Handle entity) {
+    Hierarchy& hierarchy = world->hierarchy;
+    u32 depth = get_hierarchy_depth(world, entity);
+    u32 index = get_hierarchy_index(world, entity);
+    Hierarchy_Level& level = hierarchy.levels[depth];
+
+    u32 last = (u32) level.entities.size() - 1;
+    if (index != last) {
+        Entity_Handle moved = level.entities[last];
+        level.entities[index] = moved;
+        level.parents[index] = level.parents[last];
+        hierarchy.indices[get_entity_index(moved)] = index;
+        set_children_parent_index(world, moved, depth, index);
+    }
+    level.entities.pop_back();
+    level.parents.pop_back();
+    hierarchy.depths[get_entity_index(entity)] = invalid_hierarchy_depth;
+    hierarchy.are_locations_valid = false;
+
+    while (hierarchy.levels.size() > 0 && hierarchy.levels[hierarchy.levels.size() - 1].entities.size() == 0) {
+        hierarchy.levels.pop_back();
+    }
+}
+
+// NOTE(alexander): children are removed first so the parent indices stays valid for the rest of the level
+static void
+remove_subtree_from_hierarchy(World* world, Entity_Handle entity) {
+    Entity_Handle child = get_hierarchy_node(world, entity).first_child;
+    while (child != null_entity_handle) {
+        remove_subtree_from_hierarchy(world, child);
+        child = get_hierarchy_node(world, child).next_sibling;
+    }
+    remove_from_hierarchy_level(world, entity);
+}
+
+// NOTE(alexander): parents are visited before their children, so the index of the parent is always known
+static void
+insert_subtree_into_hierarchy(World* world, Entity_Handle entity, u32 depth, u32 parent_index) {
+    insert_into_hierarchy_level(world, entity, depth, parent_index);
+    iterate_descendants(world, entity, [world](Entity_Handle descendant) {
+        Entity_Handle parent = get_hierarchy_node(world, descendant).parent;
+        insert_into_hierarchy_level(world, descendant,
+                                    get_hierarchy_depth(world, parent) + 1,
+                                    get_hierarchy_index(world, parent));
+    });
+}
+
+static void
+link_child(World* world, Entity_Handle parent_handle, Entity_Handle child_handle) {
+    Hierarchy_Node& parent = get_hierarchy_node(world, parent_handle);
+    Hierarchy_Node& child = get_hierarchy_node(world, child_handle);
+    child.parent = parent_handle;
+    child.prev_sibling = parent.last_child;
+    child.next_sibling = null_entity_handle;
+
+    // NOTE(alexander): append last to preserve the order children were added in
+    if (parent.last_child != null_entity_handle) {
+        get_hierarchy_node(world, parent.last_child).next_sibling = child_handle;
+    } else {
+        parent.first_child = child_handle;
+    }
+    parent.last_child = child_handle;
+}
+
+// NOTE(alexander): unlinks the child from its parent, the parent is removed from the hierarchy if it has no children left
+static void
+unlink_child(World* world, Entity_Handle child_handle) {
+    Hierarchy_Node& child = get_hierarchy_node(world, child_handle);
+    Entity_Handle parent_handle = child.parent;
+    Hierarchy_Node& parent = get_hierarchy_node(world, parent_handle);
+
+    if (child.prev_sibling != null_entity_handle) {
+        get_hierarchy_node(world, child.prev_sibling).next_sibling = child.next_sibling;
+    } else {
+        parent.first_child = child.next_sibling;
+    }
+    if (child.next_sibling != null_entity_handle) {
+        get_hierarchy_node(world, child.next_sibling).prev_sibling = child.prev_sibling;
+    } else {
+        parent.last_child = child.prev_sibling;
+    }
+    child.parent = null_entity_handle;
+    child.next_sibling = null_entity_handle;
+    child.prev_sibling = null_entity_handle;
+
+    if (parent.first_child == null_entity_handle && get_hierarchy_depth(world, parent_handle) == 0) {
+        remove_from_hierarchy_level(world, parent_handle);
+    }
+}
+
+// NOTE(alexander): makes sure the children are recomputed even if their local transform didn't change
+static void
+mark_local_to_parent_changed(World* world, Entity_Handle entity) {
+    Entity* e = get_entity(world, entity);
+    const Archetype& archetype = world->archetypes[e->archetype];
+    int column = find_component_column(archetype, Local_To_Parent_ID);
+    if (column >= 0) {
+        get_change_versions(archetype, archetype.chunks[e->chunk])[column] = get_write_version(world);
+    }
+}
+
+/**
+ * Attaches the child and its whole subtree last in the list of children of the parent,
+ * if the child already has a parent then it is moved over to the new one.
+ */
+void
+add_child(World* world, Entity_Handle parent_handle, Entity_Handle child_handle) {
+    assert(parent_handle != child_handle && "entity cannot be a child of itself");
+    assert(world->structural_change_locks == 0 && "cannot change the hierarchy while systems are iterating");
+
+    reserve_hierarchy_node(world, parent_handle);
+    reserve_hierarchy_node(world, child_handle);
+
+    Entity_Handle ancestor = parent_handle;
+    while (ancestor != null_entity_handle) {
+        assert(ancestor != child_handle && "cannot add an ancestor as a child");
+        ancestor = get_hierarchy_node(world, ancestor).parent;
+    }
+
+    if (get_hierarchy_depth(world, child_handle) != invalid_hierarchy_depth) {
+        remove_subtree_from_hierarchy(world, child_handle);
+    }
+    if (get_hierarchy_node(world, child_handle).parent != null_entity_handle) {
+        unlink_child(world, child_handle);
+    }
+    link_child(world, parent_handle, child_handle);
+
+    u32 parent_depth = get_hierarchy_depth(world, parent_handle);
+    if (parent_depth == invalid_hierarchy_depth) {
+        insert_into_hierarchy_level(world, parent_handle, 0, 0);
+        parent_depth = 0;
+    }
+    insert_subtree_into_hierarchy(world, child_handle, parent_depth + 1, get_hierarchy_index(world, parent_handle));
+    mark_local_to_parent_changed(world, child_handle);
+}
+
+/**
+ * Detaches the child and its whole subtree from its parent,
+ * the child becomes a root if it has children of its own.
+ */
+void
+remove_child(World* world, Entity_Handle child_handle) {
+    assert(world->structural_change_locks == 0 && "cannot change the hierarchy while systems are iterating");
+    if (get_parent(world, child_handle) == null_entity_handle) return;
+
+    remove_subtree_from_hierarchy(world, child_handle);
+    unlink_child(world, child_handle);
+
+    // NOTE(alexander): without a parent the local transform becomes the world transform
+    auto local_to_parent = read_component(world, child_handle, Local_To_Parent);
+    auto local_to_world = get_component(world, child_handle, Local_To_World);
+    if (local_to_parent && local_to_world) {
+        local_to_world->m = local_to_parent->m;
+    }
+
+    if (get_first_child(world, child_handle) != null_entity_handle) {
+        insert_subtree_into_hierarchy(world, child_handle, 0, 0);
+    }
+}
+
+// NOTE(alexander): called before despawning an entity, its children are detached and becomes roots
+void
+remove_from_hierarchy(World* world, Entity_Handle entity) {
+    if (get_hierarchy_depth(world, entity) == invalid_hierarchy_depth) return;
+
+    remove_child(world, entity);
+    for (;;) {
+        Entity_Handle child = get_first_child(world, entity);
+        if (child == null_entity_handle) break;
+        remove_child(world, child);
+    }
+}
+
+/***************************************************************************
+ * Hierarchical Transform System
+ ***************************************************************************/
+
+DEF_QUERY_SYSTEM(trs_local_to_parent_system) {
+    world_query_chunks<Local_To_Parent, Optional<const Position>, Optional<const Rotation>, Optional<const Scale>>
+        (world, [](u32 count, Local_To_Parent* local_to_parent, const Position* pos, const Rotation* rot, const Scale* scl) {
+            if (!pos && !rot && !scl) return; // NOTE(alexander): need at least one of these
+            compute_trs_matrices(&local_to_parent[0].m, pos, rot, scl, count);
+        });
+}
+
+static Hierarchy_Location
+find_hierarchy_location(World* world, Entity_Handle entity) {
+    Hierarchy_Location location = {};
+    const Entity* e = get_entity(world, entity);
+    const Archetype& archetype = world->archetypes[e->archetype];
+    const Chunk& chunk = archetype.chunks[e->chunk];
+    u32* versions = get_change_versions(archetype, chunk);
+
+    int column = find_component_column(archetype, Local_To_Parent_ID);
+    if (column >= 0) {
+        location.local_to_parent = (const Local_To_Parent*) get_component_column(archetype, chunk, column) + e->row;
+        location.local_to_parent_version = versions + column;
+    }
+    column = find_component_column(archetype, Local_To_World_ID);
+    if (column >= 0) {
+        location.local_to_world = (Local_To_World*) get_component_column(archetype, chunk, column) + e->row;
+        location.local_to_world_version = versions + column;
+    }
+    return location;
+}
+
+/**
+ * Sorts the entities in every level by archetype, chunk and row and caches where
+ * their transforms are stored. Only done when the levels have changed or any of
+ * their entities were moved, see Hierarchy::are_locations_valid.
+ */
+static void
+refresh_hierarchy_locations(World* world) {
+    Hierarchy& hierarchy = world->hierarchy;
+    std::vector<u64> keys;
+    std::vector<u32> order;
+    std::vector<u32> remap; // new index of each entity in the previous level
+    std::vector<Entity_Handle> entities;
+    std::vector<u32> parents;
+
+    for (u32 depth = 0; depth < hierarchy.levels.size(); depth++) {
+        Hierarchy_Level& level = hierarchy.levels[depth];
+        u32 count = (u32) level.entities.size();
+        keys.resize(count);
+        order.resize(count);
+        for (u32 i = 0; i < count; i++) {
+            const Entity* entity = get_entity(world, level.entities[i]);
+            keys[i] = ((u64) entity->archetype << 40) | ((u64) entity->chunk << 16) | entity->row;
+            order[i] = i;
+            if (depth > 0) level.parents[i] = remap[level.parents[i]];
+        }
+        std::sort(order.begin(), order.end(), [&keys](u32 a, u32 b) {
+            return keys[a] < keys[b];
+        });
+
+        remap.resize(count);
+        entities.resize(count);
+        parents.resize(count);
+        level.locations.resize(count);
+        for (u32 i = 0; i < count; i++) {
+            remap[order[i]] = i;
+            entities[i] = level.entities[order[i]];
+            parents[i] = level.parents[order[i]];
+            hierarchy.indices[get_entity_index(entities[i])] = i;
+            level.locations[i] = find_hierarchy_location(world, entities[i]);
+        }
+        level.entities.swap(entities);
+        level.parents.swap(parents);
+    }
+    hierarchy.are_locations_valid = true;
+}
+
+struct Hierarchy_Pass {
+    Hierarchy_Level* parent_level;
+    Hierarchy_Level* level;
+    u32 last_run_version;
+};
+
+/**
+ * A child is only recomputed when its local transform or the world transform
+ * of its parent changed, entities without Local_To_World still pass on their transform.
+ */
+static void
+propagate_hierarchy_level(void* data, u32 begin, u32 end) {
+    Hierarchy_Pass* pass = (Hierarchy_Pass*) data;
+    Hierarchy_Level* level = pass->level;
+    Hierarchy_Level* parent_level = pass->parent_level;
+
+    for (u32 i = begin; i < end; i++) {
+        const Hierarchy_Location& location = level->locations[i];
+        u32 parent_index = level->parents[i];
+        bool is_changed = parent_level->changed[parent_index] != 0;
+        Affine_Transform local_matrix = affine_identity();
+        if (location.local_to_parent) {
+            is_changed = is_changed || is_newer_version(*location.local_to_parent_version, pass->last_run_version);
+            local_matrix = location.local_to_parent->m;
+        }
+
+        if (is_changed || !location.local_to_world) {
+            level->world_matrices[i] = affine_multiply(parent_level->world_matrices[parent_index], local_matrix);
+            if (location.local_to_world) location.local_to_world->m = level->world_matrices[i];
+        } else {
+            level->world_matrices[i] = location.local_to_world->m;
+        }
+        level->changed[i] = is_changed;
+    }
+}
+
+DEF_QUERY_SYSTEM(hierarchical_local_to_world_system) {
+    Hierarchy& hierarchy = world->hierarchy;
+    if (hierarchy.levels.size() == 0) return;
+
+    // NOTE(alexander): entities only gain or lose transforms when they are moved, so everything
+    // is recomputed after a refresh, e.g. the children of a root that lost its Local_To_World
+    bool is_refreshed = !hierarchy.are_locations_valid;
+    if (is_refreshed) {
+        refresh_hierarchy_locations(world);
+    }
+
+    u32 last_run_version = current_system ? current_system->last_run_version : 0;
+    u32 write_version = get_write_version(world);
+
+    // Roots keeps their own world transform
+    Hierarchy_Level& roots = hierarchy.levels[0];
+    roots.world_matrices.resize(roots.entities.size());
+    roots.changed.resize(roots.entities.size());
+    for (u32 i = 0; i < roots.entities.size(); i++) {
+        const Hierarchy_Location& location = roots.locations[i];
+        if (location.local_to_world) {
+            roots.world_matrices[i] = location.local_to_world->m;
+            roots.changed[i] = is_refreshed || is_newer_version(*location.local_to_world_version, last_run_version);
+        } else {
+            roots.world_matrices[i] = affine_identity();
+            roots.changed[i] = is_refreshed;
+        }
+        count_system_entities(roots.changed[i], !roots.changed[i]);
+    }
+
+    // Then every level in order, all parents in a level are done before any of their children
+    for (u32 depth = 1; depth < hierarchy.levels.size(); depth++) {
+        Hierarchy_Level& level = hierarchy.levels[depth];
+        u32 count = (u32) level.entities.size();
+        level.world_matrices.resize(count);
+        level.changed.resize(count);
+
+        Hierarchy_Pass pass;
+        pass.parent_level = &hierarchy.levels[depth - 1];
+        pass.level = &level;
+        pass.last_run_version = last_run_version;
+        if (should_iterate_in_parallel(world)) {
+            parallel_for(world->job_system, count, get_min_batch_size(current_system), &propagate_hierarchy_level, &pass);
+        } else {
+            propagate_hierarchy_level(&pass, 0, count);
+        }
+
+        // NOTE(alexander): marked afterwards, since entities in the same chunk may be written by different threads
+        u32 num_changed = 0;
+        for (u32 i = 0; i < count; i++) {
+            if (!level.changed[i]) continue;
+            num_changed++;
+            if (level.locations[i].local_to_world_version) {
+                *level.locations[i].local_to_world_version = write_version;
+            }
+        }
+        count_system_entities(num_changed, count - num_changed);
+    }
+}
+
+void
+push_hierarchical_transform_systems(std::vector<System>& systems) {
+    push_transform_systems(systems);
+
+    System trs_parent = {};
+    trs_parent.name = "trs_local_to_parent_system";
+    trs_parent.on_query = &trs_local_to_parent_system;
+    trs_parent.flags = System::Flag_Parallel;
+    use_component(trs_parent, Local_To_Parent);
+    use_component(trs_parent, Position, System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    use_component(trs_parent, Rotation, System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    use_component(trs_parent, Scale,    System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    push_system(systems, trs_parent);
+
+    System hierarchical_world = {};
+    hierarchical_world.name = "hierarchical_local_to_world_system";
+    hierarchical_world.on_query = &hierarchical_local_to_world_system;
+    hierarchical_world.flags = System::Flag_Parallel;
+    use_component(hierarchical_world, Local_To_World);
+    use_component(hierarchical_world, Local_To_Parent, System::Flag_Read_Only);
+    push_system(systems, hierarchical_world);
+}
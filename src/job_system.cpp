@@ -0,0 +1,233 @@
+
+/***************************************************************************
+ * Job system
+ * Thread pool where each worker owns a queue of jobs, workers take the most
+ * recently pushed job from their own queue and steal the oldest job from
+ * other queues when they run out of work. Threads that are not workers push
+ * to a shared queue and can help out by calling run_next_job e.g. while
+ * waiting for other jobs to complete.
+ ***************************************************************************/
+
+typedef void (*Job_Function)(void* data);
+
+struct Job {
+    Job_Function function;
+    void* data;
+};
+
+struct Job_Queue {
+    std::deque<Job> jobs;
+    std::mutex mutex;
+};
+
+struct Job_System {
+    std::vector<std::thread> workers;
+    std::vector<Job_Queue*> queues; // one per worker, the last one is shared by all other threads
+    std::atomic<u32> num_pending_jobs;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    std::atomic<bool> is_running;
+};
+
+// NOTE(alexander): index of the queue owned by this thread, or -1 if this is not a worker thread
+static thread_local int job_worker_index = -1;
+
+static inline Job_Queue*
+get_local_job_queue(Job_System* job_system) {
+    if (job_worker_index >= 0) {
+        return job_system->queues[job_worker_index];
+    }
+    return job_system->queues[job_system->queues.size() - 1];
+}
+
+// NOTE(alexander): each worker has its own index, all other threads share the last one
+u32
+get_job_thread_index(Job_System* job_system) {
+    return job_worker_index >= 0 ? (u32) job_worker_index : (u32) job_system->queues.size() - 1;
+}
+
+u32
+get_num_job_threads(Job_System* job_system) {
+    return (u32) job_system->queues.size();
+}
+
+static bool
+try_pop_job(Job_System* job_system, Job* job) {
+    if (job_system->num_pending_jobs == 0) {
+        return false;
+    }
+
+    // Take the latest job from our own queue first, it is most likely still in cache
+    Job_Queue* local_queue = get_local_job_queue(job_system);
+    {
+        std::lock_guard<std::mutex> lock(local_queue->mutex);
+        if (!local_queue->jobs.empty()) {
+            *job = local_queue->jobs.back();
+            local_queue->jobs.pop_back();
+            job_system->num_pending_jobs--;
+            return true;
+        }
+    }
+
+    // Otherwise steal the oldest job from someone else, starting with our neighbour
+    usize num_queues = job_system->queues.size();
+    usize start = job_worker_index >= 0 ? job_worker_index + 1 : 0;
+    for (usize i = 0; i < num_queues; i++) {
+        Job_Queue* queue = job_system->queues[(start + i) % num_queues];
+        if (queue == local_queue) continue;
+
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->jobs.empty()) {
+            *job = queue->jobs.front();
+            queue->jobs.pop_front();
+            job_system->num_pending_jobs--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+job_system_worker_proc(Job_System* job_system, int worker_index) {
+    job_worker_index = worker_index;
+
+    for (;;) {
+        Job job;
+        if (try_pop_job(job_system, &job)) {
+            job.function(job.data);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(job_system->sleep_mutex);
+        job_system->wake_up.wait(lock, [job_system] {
+            return !job_system->is_running || job_system->num_pending_jobs > 0;
+        });
+
+        if (!job_system->is_running) {
+            return;
+        }
+    }
+}
+
+void
+initialize_job_system(Job_System* job_system, u32 num_workers) {
+    job_system->is_running = true;
+    job_system->num_pending_jobs = 0;
+    for (u32 i = 0; i < num_workers + 1; i++) {
+        job_system->queues.push_back(new Job_Queue());
+    }
+    for (u32 i = 0; i < num_workers; i++) {
+        job_system->workers.push_back(std::thread(job_system_worker_proc, job_system, (int) i));
+    }
+}
+
+void
+push_job(Job_System* job_system, Job_Function function, void* data) {
+    Job job = { function, data };
+    Job_Queue* queue = get_local_job_queue(job_system);
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->jobs.push_back(job);
+        job_system->num_pending_jobs++;
+    }
+
+    // NOTE(alexander): lock to make sure a worker can't miss the wake up between checking and waiting
+    {
+        std::lock_guard<std::mutex> lock(job_system->sleep_mutex);
+    }
+    job_system->wake_up.notify_one();
+}
+
+// NOTE(alexander): runs one queued job on the calling thread, returns false if there was nothing to run
+bool
+run_next_job(Job_System* job_system) {
+    Job job;
+    if (!try_pop_job(job_system, &job)) {
+        return false;
+    }
+
+    job.function(job.data);
+    return true;
+}
+
+/***************************************************************************
+ * Parallel for
+ ***************************************************************************/
+
+typedef void (*Parallel_For_Function)(void* data, u32 begin, u32 end);
+
+struct Parallel_For_Batch {
+    Parallel_For_Function function;
+    void* data;
+    u32 begin;
+    u32 end;
+    std::atomic<u32>* num_remaining;
+};
+
+static void
+run_parallel_for_batch(void* data) {
+    Parallel_For_Batch* batch = (Parallel_For_Batch*) data;
+    batch->function(batch->data, batch->begin, batch->end);
+    (*batch->num_remaining)--; // NOTE(alexander): batch may be freed after this point
+}
+
+/**
+ * Splits the range [0, count) into batches of at least batch_size and runs them
+ * on the job system, the calling thread runs the first batch and then helps out
+ * with other jobs until every batch is done.
+ */
+void
+parallel_for(Job_System* job_system, u32 count, u32 batch_size, Parallel_For_Function function, void* data) {
+    if (count == 0) return;
+    if (batch_size == 0) batch_size = 1;
+
+    u32 num_batches = (count + batch_size - 1)/batch_size;
+    if (!job_system || num_batches == 1) {
+        function(data, 0, count);
+        return;
+    }
+
+    std::atomic<u32> num_remaining(num_batches - 1);
+    std::vector<Parallel_For_Batch> batches(num_batches);
+    for (u32 i = 0; i < num_batches; i++) {
+        Parallel_For_Batch& batch = batches[i];
+        batch.function = function;
+        batch.data = data;
+        batch.begin = i*batch_size;
+        batch.end = min(batch.begin + batch_size, count);
+        batch.num_remaining = &num_remaining;
+    }
+
+    // NOTE(alexander): push in reverse so the batches we pop from our own queue stay in order
+    for (u32 i = num_batches - 1; i > 0; i--) {
+        push_job(job_system, &run_parallel_for_batch, &batches[i]);
+    }
+    function(data, batches[0].begin, batches[0].end);
+
+    while (num_remaining > 0) {
+        if (!run_next_job(job_system)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void
+shutdown_job_system(Job_System* job_system) {
+    {
+        std::lock_guard<std::mutex> lock(job_system->sleep_mutex);
+        job_system->is_running = false;
+    }
+    job_system->wake_up.notify_all();
+
+    for (int i = 0; i < job_system->workers.size(); i++) {
+        job_system->workers[i].join();
+    }
+    job_system->workers.clear();
+
+    for (int i = 0; i < job_system->queues.size(); i++) {
+        delete job_system->queues[i];
+    }
+    job_system->queues.clear();
+}
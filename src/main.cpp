@@ -3,12 +3,20 @@
 #include "geometry.cpp"
 #include "hdr_loader.cpp"
 #include "renderer.cpp"
+#include "job_system.cpp"
+#include "transform_kernels.cpp"
+#include "frustum_culling.cpp"
 #include "ecs.cpp"
+#include "hierarchy.cpp"
+#include "prefab.cpp"
+#include "render_systems.cpp"
+#include "world_snapshot.cpp"
 #include "koch_snowflake.cpp"    // Lab 1
 #include "triangulation.cpp"     // Lab 2
 #include "basic_3d_graphics.cpp" // Lab 3
 #include "simple_world.cpp"      // Lab 4
 #include "world_editor.cpp"      // Lab 4
+#include "performance_window.cpp"
 
 bool
 was_pressed(Button_State* state) {
@@ -291,6 +299,14 @@ main() {
     auto simple_world_scene = new Simple_World_Scene();
     auto world_editor = new World_Editor();
     world_editor->world = &simple_world_scene->world;
+    world_editor->assets = &simple_world_scene->assets;
+
+    // Setup job system, the main thread also runs jobs so leave one core for it
+    auto job_system = new Job_System();
+    u32 num_cores = std::thread::hardware_concurrency();
+    initialize_job_system(job_system, num_cores > 1 ? num_cores - 1 : 1);
+    basic_3d_graphics_scene->world.job_system = job_system;
+    simple_world_scene->world.job_system = job_system;
     Scene_Type current_scene_type = Scene_Simple_World;
 
     // Setup ImGui
@@ -299,7 +315,7 @@ main() {
     ImGui_ImplOpenGL3_Init(glsl_version);
     ImGuiIO& io = ImGui::GetIO();
     std::ostringstream path_stream;
-    path_stream << res_folder;
+    path_stream << get_resource_folder();
     path_stream << "fonts/roboto.ttf";
     std::string filepath = path_stream.str();
     io.Fonts->AddFontFromFileTTF(filepath.c_str(), 18.0f);
@@ -315,6 +331,9 @@ main() {
         target_frame_time = 1.0f/(f32) mode->refreshRate;
     }
 
+    Performance_Window performance_window = {};
+    initialize_performance_window(&performance_window);
+
     // Main program loop
     u32 fps = 0;
     u32 fps_counter = 0;
@@ -359,7 +378,7 @@ main() {
                         }
                     }
 
-                    update_systems(&basic_3d_graphics_scene->world, basic_3d_graphics_scene->main_systems, target_frame_time);
+                    update_systems(&basic_3d_graphics_scene->world, &basic_3d_graphics_scene->main_schedule, target_frame_time);
                 } break;
 
                 case Scene_Simple_World: {
@@ -369,7 +388,7 @@ main() {
                             return 1;
                         }
                     }
-                    update_systems(&simple_world_scene->world, simple_world_scene->main_systems, target_frame_time);
+                    update_systems(&simple_world_scene->world, &simple_world_scene->main_schedule, target_frame_time);
                 } break;
 
                 case Scene_World_Editor: {
@@ -417,10 +436,32 @@ main() {
                 } break;
             }
 
-            static bool show_performance = true;
-            ImGui::Begin("Performance", &show_performance);
-            ImGui::Text("FPS: %u", fps);
-            ImGui::End();
+            // Timings of the systems in the current scene
+            System_Group system_groups[2];
+            u32 num_system_groups = 0;
+            const Render_Stats* render_stats = NULL;
+            switch (current_scene_type) {
+                case Scene_Basic_3D_Graphics: {
+                    system_groups[num_system_groups++] = { "main_systems", &basic_3d_graphics_scene->main_systems };
+                    system_groups[num_system_groups++] = { "rendering_pipeline", &basic_3d_graphics_scene->rendering_pipeline };
+                    render_stats = &basic_3d_graphics_scene->world.renderer.stats;
+                } break;
+
+                case Scene_Simple_World: {
+                    system_groups[num_system_groups++] = { "main_systems", &simple_world_scene->main_systems };
+                    system_groups[num_system_groups++] = { "rendering_pipeline", &simple_world_scene->rendering_pipeline };
+                    render_stats = &simple_world_scene->world.renderer.stats;
+                } break;
+
+                case Scene_World_Editor: {
+                    system_groups[num_system_groups++] = { "main_systems", &world_editor->main_systems };
+                    system_groups[num_system_groups++] = { "rendering_pipeline", &world_editor->rendering_pipeline };
+                    render_stats = &world_editor->world->renderer.stats;
+                } break;
+
+                default: break;
+            }
+            draw_performance_window(&performance_window, fps, system_groups, num_system_groups, render_stats);
 
             // Menu bar for switching between scenes
             if (ImGui::BeginMainMenuBar()) {
@@ -444,6 +485,23 @@ main() {
                 ImGui::EndFrame();
             }
 
+            // NOTE(alexander): end of the frame is the only sync point where the chunks may move
+            switch (current_scene_type) {
+                case Scene_Basic_3D_Graphics: {
+                    compact_chunk_pool(&basic_3d_graphics_scene->world);
+                } break;
+
+                case Scene_Simple_World: {
+                    compact_chunk_pool(&simple_world_scene->world);
+                } break;
+
+                case Scene_World_Editor: {
+                    compact_chunk_pool(world_editor->world);
+                } break;
+
+                default: break;
+            }
+
             // Reset input state
             window.input.mouse_delta_x = 0.0f;
             window.input.mouse_delta_y = 0.0f;
@@ -486,6 +544,8 @@ main() {
         }
     }
 
+    shutdown_job_system(job_system);
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -496,21 +556,4 @@ main() {
 }
 
 // NOTE(alexander): don't expose this to the rest of the codebase!
-#include <sys/types.h>
-#include <sys/stat.h>
-
-const char*
-find_resource_folder() {
-    struct stat info;
-
-    if (stat("res", &info) == 0 && info.st_mode & S_IFDIR) {
-        return "res/";
-    }
-
-    if (stat("../res", &info) == 0 && info.st_mode & S_IFDIR) {
-        return "../res/";
-    }
-
-    assert(0 && "Failed to find res folder!");
-    return "";
-}
+#include "platform.cpp"
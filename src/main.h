@@ -14,8 +14,13 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <deque>
+#include <algorithm>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
 
 #include <glm.hpp>
 #include <gtx/hash.hpp>
@@ -121,6 +126,7 @@ struct Window {
     bool is_focused;
 };
 
+#include "affine_transform.h"
 #include "renderer.h"
 #include "ecs.h"
 
@@ -136,7 +142,9 @@ void opengl_debug_callback(GLenum source,
 
 std::string read_entire_file_to_string(std::string filepath);
 
-const char* find_resource_folder();
+// NOTE(alexander): the path to the resource folder e.g. res/, it's searched for on the first call
+const char* get_resource_folder();
 
-// NOTE(alexander): the path to the resource folder e.g. res/
-static const char* res_folder = find_resource_folder();
+// NOTE(alexander): maps the entire file copy on write, i.e. writes to the memory never reaches the file
+u8* map_file_copy_on_write(const char* filepath, usize* size);
+void unmap_file(u8* data, usize size);
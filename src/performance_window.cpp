@@ -0,0 +1,195 @@
+
+/***************************************************************************
+ * Performance window
+ * Shows the timings of every system in the current scene as a table that
+ * can be sorted by clicking the column headers, each row also shows the
+ * history of the latest runs. The table can be saved to a CSV file.
+ ***************************************************************************/
+
+enum System_Stats_Column {
+    System_Stats_Column_Name,
+    System_Stats_Column_Avg,
+    System_Stats_Column_Min,
+    System_Stats_Column_Max,
+    System_Stats_Column_P99,
+    System_Stats_Column_Visited,
+    System_Stats_Column_Skipped,
+    System_Stats_Column_History,
+    System_Stats_Column_Count,
+};
+
+static const char* system_stats_column_names[System_Stats_Column_Count] = {
+    "System", "Avg (ms)", "Min (ms)", "Max (ms)", "P99 (ms)", "Visited", "Skipped", "History",
+};
+
+static const char* unnamed_system_name = "Unnamed System";
+
+struct Performance_Window {
+    bool is_open;
+    System_Stats_Column sort_column;
+    bool sort_descending;
+    char csv_path[256];
+};
+
+// NOTE(alexander): group of systems shown together e.g. the main systems of a scene
+struct System_Group {
+    const char* name;
+    std::vector<System>* systems;
+};
+
+void
+initialize_performance_window(Performance_Window* window) {
+    window->is_open = true;
+    window->sort_column = System_Stats_Column_Avg;
+    window->sort_descending = true;
+    snprintf(window->csv_path, sizeof(window->csv_path), "%ssystem_timings.csv", get_resource_folder());
+}
+
+static inline const char*
+get_system_name(const System& system) {
+    return system.name ? system.name : unnamed_system_name;
+}
+
+static f32
+get_system_sort_key(const System& system, const System_Timings& timings, System_Stats_Column column) {
+    switch (column) {
+        case System_Stats_Column_Avg:     return timings.avg_time;
+        case System_Stats_Column_Min:     return timings.min_time;
+        case System_Stats_Column_Max:     return timings.max_time;
+        case System_Stats_Column_P99:     return timings.p99_time;
+        case System_Stats_Column_Visited: return (f32) system.stats.num_entities_visited;
+        case System_Stats_Column_Skipped: return (f32) system.stats.num_entities_skipped;
+        default:                          return 0.0f;
+    }
+}
+
+static void
+draw_system_stats_table(Performance_Window* window, const System_Group& group) {
+    std::vector<System>& systems = *group.systems;
+    std::vector<System_Timings> timings(systems.size());
+    std::vector<u32> order(systems.size());
+    for (u32 i = 0; i < systems.size(); i++) {
+        timings[i] = get_system_timings(&systems[i].stats);
+        order[i] = i;
+    }
+
+    System_Stats_Column column = window->sort_column;
+    bool descending = window->sort_descending;
+    std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+        if (column == System_Stats_Column_Name) {
+            int cmp = strcmp(get_system_name(systems[a]), get_system_name(systems[b]));
+            return descending ? cmp > 0 : cmp < 0;
+        }
+        f32 key_a = get_system_sort_key(systems[a], timings[a], column);
+        f32 key_b = get_system_sort_key(systems[b], timings[b], column);
+        return descending ? key_a > key_b : key_a < key_b;
+    });
+
+    ImGui::PushID(group.name);
+    ImGui::Columns(System_Stats_Column_Count, "system_stats");
+    if (ImGui::GetColumnWidth(0) < 200.0f) {
+        ImGui::SetColumnWidth(0, 260.0f); // NOTE(alexander): make room for the system names the first time
+    }
+
+    for (int i = 0; i < System_Stats_Column_Count; i++) {
+        bool is_sorted = i == window->sort_column;
+        if (i != System_Stats_Column_History &&
+            ImGui::Selectable(system_stats_column_names[i], is_sorted)) {
+            if (is_sorted) {
+                window->sort_descending = !window->sort_descending;
+            } else {
+                window->sort_column = (System_Stats_Column) i;
+                window->sort_descending = i != System_Stats_Column_Name;
+            }
+        } else if (i == System_Stats_Column_History) {
+            ImGui::TextUnformatted(system_stats_column_names[i]);
+        }
+        ImGui::NextColumn();
+    }
+    ImGui::Separator();
+
+    for (u32 i = 0; i < order.size(); i++) {
+        const System& system = systems[order[i]];
+        const System_Timings& t = timings[order[i]];
+        ImGui::TextUnformatted(get_system_name(system));        ImGui::NextColumn();
+        ImGui::Text("%.3f", t.avg_time);                        ImGui::NextColumn();
+        ImGui::Text("%.3f", t.min_time);                        ImGui::NextColumn();
+        ImGui::Text("%.3f", t.max_time);                        ImGui::NextColumn();
+        ImGui::Text("%.3f", t.p99_time);                        ImGui::NextColumn();
+        ImGui::Text("%u", system.stats.num_entities_visited);  ImGui::NextColumn();
+        ImGui::Text("%u", system.stats.num_entities_skipped);  ImGui::NextColumn();
+
+        // NOTE(alexander): once the history is full the oldest time is the next one to be replaced
+        const System_Stats& stats = system.stats;
+        int offset = stats.num_times < system_stats_history ? 0 : (int) stats.next_time;
+        ImGui::PushID(order[i]);
+        ImGui::PlotLines("##history", stats.times, (int) stats.num_times, offset, NULL,
+                         0.0f, FLT_MAX, ImVec2(ImGui::GetColumnWidth() - 16.0f, 18.0f));
+        ImGui::PopID();
+        ImGui::NextColumn();
+    }
+
+    ImGui::Columns(1);
+    ImGui::PopID();
+}
+
+/**
+ * Writes the same table as the performance window, one row per system
+ * with the timings in milliseconds.
+ */
+bool
+write_system_stats_csv(const char* filepath, const System_Group* groups, u32 num_groups) {
+    FILE* file = fopen(filepath, "wb");
+    if (!file) {
+        printf("[Performance] cannot open `%s` for writing\n", filepath);
+        return false;
+    }
+
+    fprintf(file, "group,system,avg_ms,min_ms,max_ms,p99_ms,visited,skipped,runs\n");
+    for (u32 i = 0; i < num_groups; i++) {
+        const std::vector<System>& systems = *groups[i].systems;
+        for (u32 j = 0; j < systems.size(); j++) {
+            const System_Stats& stats = systems[j].stats;
+            System_Timings timings = get_system_timings(&stats);
+            fprintf(file, "%s,%s,%.4f,%.4f,%.4f,%.4f,%u,%u,%u\n",
+                    groups[i].name, get_system_name(systems[j]),
+                    timings.avg_time, timings.min_time, timings.max_time, timings.p99_time,
+                    stats.num_entities_visited, stats.num_entities_skipped, stats.num_times);
+        }
+    }
+
+    fclose(file);
+    printf("[Performance] saved system timings to `%s`\n", filepath);
+    return true;
+}
+
+// NOTE(alexander): render_stats is optional, only scenes rendered with a Renderer has them
+void
+draw_performance_window(Performance_Window* window, u32 fps, const System_Group* groups, u32 num_groups,
+                        const Render_Stats* render_stats) {
+    if (!window->is_open) return;
+
+    ImGui::Begin("Performance", &window->is_open);
+    ImGui::Text("FPS: %u", fps);
+    if (render_stats) {
+        ImGui::Text("Draw calls: %u (%u meshes, %u instances), binds: %u shaders, %u textures, %u meshes",
+                    render_stats->num_draw_calls, render_stats->num_mesh_draws, render_stats->num_instances,
+                    render_stats->num_shader_binds, render_stats->num_texture_binds, render_stats->num_mesh_binds);
+        ImGui::Text("Visible: %u, culled: %u", render_stats->num_visible, render_stats->num_culled);
+    }
+
+    if (num_groups > 0) {
+        ImGui::InputText("##csv_path", window->csv_path, sizeof(window->csv_path));
+        ImGui::SameLine();
+        if (ImGui::Button("Save CSV")) {
+            write_system_stats_csv(window->csv_path, groups, num_groups);
+        }
+    }
+
+    for (u32 i = 0; i < num_groups; i++) {
+        if (ImGui::CollapsingHeader(groups[i].name, ImGuiTreeNodeFlags_DefaultOpen)) {
+            draw_system_stats_table(window, groups[i]);
+        }
+    }
+    ImGui::End();
+}
@@ -0,0 +1,95 @@
+
+/***************************************************************************
+ * Platform
+ * Operating system specific functions declared in main.h, this is included
+ * last since the system headers define macros that clash with our code
+ * e.g. near and far on windows.
+ ***************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+static const char*
+find_resource_folder() {
+    struct stat info;
+
+    if (stat("res", &info) == 0 && info.st_mode & S_IFDIR) {
+        return "res/";
+    }
+
+    if (stat("../res", &info) == 0 && info.st_mode & S_IFDIR) {
+        return "../res/";
+    }
+
+    assert(0 && "Failed to find res folder!");
+    return "";
+}
+
+// NOTE(alexander): not found during static initialization so e.g. lab_ecs_bench can run from any directory
+const char*
+get_resource_folder() {
+    static const char* res_folder = find_resource_folder();
+    return res_folder;
+}
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+u8*
+map_file_copy_on_write(const char* filepath, usize* size) {
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    // NOTE(alexander): the view keeps the file open after the handles are closed
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) return NULL;
+    u8* data = (u8*) MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data) return NULL;
+
+    *size = (usize) file_size.QuadPart;
+    return data;
+}
+
+void
+unmap_file(u8* data, usize size) {
+    UnmapViewOfFile(data);
+}
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+u8*
+map_file_copy_on_write(const char* filepath, usize* size) {
+    int file = open(filepath, O_RDONLY);
+    if (file < 0) return NULL;
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        close(file);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, (usize) info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) return NULL;
+
+    *size = (usize) info.st_size;
+    return (u8*) data;
+}
+
+void
+unmap_file(u8* data, usize size) {
+    munmap(data, size);
+}
+#endif
@@ -0,0 +1,189 @@
+
+/***************************************************************************
+ * Prefabs
+ * A prefab stores a hierarchy of entities in depth first order together
+ * with a copy of all their components. Instantiating it spawns each prefab
+ * entity count times at once, the chunk rows are filled straight from the
+ * prefab data and the hierarchy links are remapped to the new handles in
+ * a single pass, without going through add_component or add_child.
+ ***************************************************************************/
+
+/**
+ * Records the root, all of its descendants and their components. The entities
+ * themselves are left as they are, e.g. they can be used as the first instance.
+ */
+Prefab
+make_prefab(World* world, Entity_Handle root) {
+    assert(is_alive(world, root) && "cannot make a prefab from a despawned entity");
+
+    std::vector<Entity_Handle> handles;
+    handles.push_back(root);
+    iterate_descendants(world, root, [&handles](Entity_Handle entity) {
+        handles.push_back(entity);
+    });
+
+    Prefab prefab;
+    prefab.entities.resize(handles.size());
+    std::unordered_map<u32, u32> prefab_indices; // by entity index
+    usize data_size = 0;
+    for (u32 i = 0; i < handles.size(); i++) {
+        const Entity* entity = get_entity(world, handles[i]);
+        const Archetype& archetype = world->archetypes[entity->archetype];
+        prefab_indices[get_entity_index(handles[i])] = i;
+
+        Prefab_Entity& prefab_entity = prefab.entities[i];
+        prefab_entity.components.component_ids = archetype.component_ids;
+        prefab_entity.components.component_sizes = archetype.component_sizes;
+        for (int j = 0; j < archetype.component_ids.size(); j++) {
+            data_size = align_forward(data_size, component_infos[archetype.component_ids[j]].alignment);
+            prefab_entity.data_offsets.push_back((u32) data_size);
+            data_size += archetype.component_sizes[j];
+        }
+
+        prefab_entity.parent = invalid_prefab_index;
+        prefab_entity.first_child = invalid_prefab_index;
+        prefab_entity.last_child = invalid_prefab_index;
+        prefab_entity.next_sibling = invalid_prefab_index;
+        prefab_entity.prev_sibling = invalid_prefab_index;
+        prefab_entity.depth = 0;
+        if (i == 0) continue;
+
+        // NOTE(alexander): parents are recorded first, so appending keeps the order of the children
+        u32 parent_index = prefab_indices[get_entity_index(get_parent(world, handles[i]))];
+        Prefab_Entity& parent = prefab.entities[parent_index];
+        prefab_entity.parent = parent_index;
+        prefab_entity.prev_sibling = parent.last_child;
+        prefab_entity.depth = parent.depth + 1;
+        if (parent.last_child != invalid_prefab_index) {
+            prefab.entities[parent.last_child].next_sibling = i;
+        } else {
+            parent.first_child = i;
+        }
+        parent.last_child = i;
+    }
+
+    // NOTE(alexander): never resized after this, non trivial components cannot be moved around with memcpy
+    prefab.data.resize(data_size);
+    for (u32 i = 0; i < handles.size(); i++) {
+        const Entity* entity = get_entity(world, handles[i]);
+        const Archetype& archetype = world->archetypes[entity->archetype];
+        const Chunk& chunk = archetype.chunks[entity->chunk];
+        const Prefab_Entity& prefab_entity = prefab.entities[i];
+        for (int j = 0; j < archetype.component_ids.size(); j++) {
+            u32 size = archetype.component_sizes[j];
+            copy_components(archetype.component_ids[j],
+                            prefab.data.data() + prefab_entity.data_offsets[j],
+                            get_component_column(archetype, chunk, j) + entity->row*size,
+                            1);
+        }
+    }
+
+    return prefab;
+}
+
+static inline Entity_Handle
+get_prefab_instance(const Entity_Handle* handles, u32 count, u32 prefab_index, u32 instance) {
+    return prefab_index == invalid_prefab_index ? null_entity_handle : handles[prefab_index*count + instance];
+}
+
+// NOTE(alexander): handles holds count instances of each prefab entity after each other
+static void
+link_prefab_instances(World* world, const Prefab* prefab, u32 count, const Entity_Handle* handles) {
+    Hierarchy& hierarchy = world->hierarchy;
+    for (u32 i = 0; i < prefab->entities.size(); i++) {
+        u32 depth = prefab->entities[i].depth;
+        if (depth >= hierarchy.levels.size()) {
+            hierarchy.levels.resize(depth + 1);
+        }
+        Hierarchy_Level& level = hierarchy.levels[depth];
+        level.entities.reserve(level.entities.size() + count);
+        level.parents.reserve(level.parents.size() + count);
+    }
+
+    for (u32 i = 0; i < prefab->entities.size(); i++) {
+        const Prefab_Entity& prefab_entity = prefab->entities[i];
+        for (u32 k = 0; k < count; k++) {
+            Entity_Handle entity = handles[i*count + k];
+            reserve_hierarchy_node(world, entity);
+
+            Hierarchy_Node& node = get_hierarchy_node(world, entity);
+            node.parent       = get_prefab_instance(handles, count, prefab_entity.parent, k);
+            node.first_child  = get_prefab_instance(handles, count, prefab_entity.first_child, k);
+            node.last_child   = get_prefab_instance(handles, count, prefab_entity.last_child, k);
+            node.next_sibling = get_prefab_instance(handles, count, prefab_entity.next_sibling, k);
+            node.prev_sibling = get_prefab_instance(handles, count, prefab_entity.prev_sibling, k);
+
+            u32 parent_index = node.parent != null_entity_handle ? get_hierarchy_index(world, node.parent) : 0;
+            insert_into_hierarchy_level(world, entity, prefab_entity.depth, parent_index);
+        }
+    }
+}
+
+/**
+ * Spawns count copies of the prefab, the roots of the new hierarchies are written
+ * to out_roots, if not NULL. The roots have no parent.
+ */
+void
+instantiate_prefab(World* world, const Prefab* prefab, u32 count, Entity_Handle* out_roots) {
+    assert(world->structural_change_locks == 0 && "cannot spawn entities while systems are iterating");
+    assert(world->num_reserved_entities == 0 && "play back command buffers before spawning more entities");
+    assert(prefab->entities.size() > 0 && "prefab is empty");
+    if (world->archetypes.size() == 0) {
+        find_or_create_archetype(world, std::vector<u32>(), std::vector<u32>());
+    }
+
+    u32 num_entities = (u32) prefab->entities.size();
+    std::vector<Entity_Handle> handles((usize) num_entities*count);
+    std::vector<const u8*> sources;
+    for (u32 i = 0; i < num_entities; i++) {
+        const Prefab_Entity& prefab_entity = prefab->entities[i];
+        u32 archetype_index = find_or_create_archetype(world, prefab_entity.components.component_ids,
+                                                       prefab_entity.components.component_sizes);
+
+        sources.resize(prefab_entity.data_offsets.size());
+        for (int j = 0; j < sources.size(); j++) {
+            sources[j] = prefab->data.data() + prefab_entity.data_offsets[j];
+        }
+        spawn_archetype_rows(world, archetype_index, count, sources.data(), handles.data() + (usize) i*count);
+    }
+
+    if (num_entities > 1) {
+        link_prefab_instances(world, prefab, count, handles.data());
+    }
+
+    if (out_roots) {
+        memcpy(out_roots, handles.data(), count*sizeof(Entity_Handle));
+    }
+}
+
+void
+destroy_prefab(Prefab* prefab) {
+    for (u32 i = 0; i < prefab->entities.size(); i++) {
+        const Prefab_Entity& prefab_entity = prefab->entities[i];
+        for (int j = 0; j < prefab_entity.data_offsets.size(); j++) {
+            destroy_components(prefab_entity.components.component_ids[j],
+                               prefab->data.data() + prefab_entity.data_offsets[j],
+                               1);
+        }
+    }
+    prefab->entities.clear();
+    prefab->data.clear();
+}
+
+/**
+ * Copies the entity together with its components and all of its descendants,
+ * the copy is added as the last child of the same parent as the entity.
+ */
+Entity_Handle
+copy_entity(World* world, Entity_Handle entity) {
+    Prefab prefab = make_prefab(world, entity);
+    Entity_Handle copy;
+    instantiate_prefab(world, &prefab, 1, &copy);
+    destroy_prefab(&prefab);
+
+    Entity_Handle parent = get_parent(world, entity);
+    if (parent != null_entity_handle) {
+        add_child(world, parent, copy);
+    }
+    return copy;
+}
@@ -0,0 +1,80 @@
+
+/***************************************************************************
+ * Rendering Systems
+ ***************************************************************************/
+
+// NOTE(alexander): only chunks where the mesh or the transform changed are updated
+DEF_QUERY_SYSTEM(world_bounds_system) {
+    world_query_chunks<World_Bounds, const Mesh_Renderer, Optional<const Local_To_World>>
+        (world, [](u32 count, World_Bounds* bounds, const Mesh_Renderer* mesh_renderer, const Local_To_World* local_to_world) {
+            Affine_Transform identity = affine_identity();
+            for (u32 i = 0; i < count; i++) {
+                compute_world_bounds(&bounds[i], mesh_renderer[i].mesh, local_to_world ? local_to_world[i].m : identity);
+            }
+        });
+}
+
+DEF_QUERY_SYSTEM(mesh_renderer_system) {
+    assert(data && "missing targeted camera for rendering to");
+
+    auto camera = get_component(world, *((Entity_Handle*) data), Camera);
+    assert(camera && "missing camera component on target camera entity");
+
+    // NOTE(alexander): the draws are recorded first and then sorted so the state changes can be shared
+    Renderer* renderer = &world->renderer;
+    Render_Queue* queue = &renderer->queue;
+    begin_render_queue(queue);
+
+    // NOTE(alexander): whole chunks are culled at once, entities without World_Bounds are always drawn
+    const Frustum frustum = make_frustum(camera->view_proj);
+    const glm::mat4& view = camera->view;
+    glm::vec4 view_z(view[0][2], view[1][2], view[2][2], view[3][2]); // NOTE(alexander): row of the view space z
+    world_query_chunks<const Mesh_Renderer, Optional<const World_Bounds>, Optional<const Local_To_World>>
+        (world, [renderer, queue, &frustum, view_z](u32 count, const Mesh_Renderer* mesh_renderer,
+                                                    const World_Bounds* bounds, const Local_To_World* local_to_world) {
+            std::vector<u8>& visible = queue->visible;
+            visible.resize(count);
+            if (bounds) {
+                u32 num_visible = cull_bounds(&frustum, bounds, count, visible.data());
+                renderer->stats.num_visible += num_visible;
+                renderer->stats.num_culled += count - num_visible;
+            } else {
+                memset(visible.data(), 1, count);
+                renderer->stats.num_visible += count;
+            }
+
+            for (u32 i = 0; i < count; i++) {
+                if (!visible[i]) continue;
+                Affine_Transform model_matrix = local_to_world ? local_to_world[i].m : affine_identity();
+                f32 view_depth = -glm::dot(view_z, glm::vec4(affine_translation(model_matrix), 1.0f));
+                push_draw_command(queue, mesh_renderer[i].material, mesh_renderer[i].mesh, model_matrix, view_depth);
+            }
+        });
+
+    sort_render_queue(queue);
+    submit_render_queue(renderer, queue, camera->view, camera->proj, camera->view_proj);
+}
+
+void
+push_mesh_renderer_system(std::vector<System>& systems, Entity_Handle* camera) {
+    System bounds = {};
+    bounds.name = "world_bounds_system";
+    bounds.on_query = &world_bounds_system;
+    bounds.flags = System::Flag_Parallel;
+    use_component(bounds, World_Bounds);
+    use_component(bounds, Mesh_Renderer, System::Flag_Read_Only | System::Flag_Changed);
+    use_component(bounds, Local_To_World, System::Flag_Optional | System::Flag_Read_Only | System::Flag_Changed);
+    push_system(systems, bounds);
+
+    System system = {};
+    system.name = "mesh_renderer_system";
+    system.data = camera;
+    system.on_query = &mesh_renderer_system;
+    system.flags = System::Flag_Main_Thread;
+    use_component(system, Mesh_Renderer, System::Flag_Read_Only);
+    use_component(system, World_Bounds, System::Flag_Optional | System::Flag_Read_Only);
+    use_component(system, Local_To_World, System::Flag_Optional | System::Flag_Read_Only);
+    use_component(system, Camera, System::Flag_Random_Access | System::Flag_Read_Only);
+    use_component(system, Hidden, System::Flag_Exclude);
+    push_system(systems, system);
+}
@@ -1,29 +1,57 @@
 
-Mesh
-create_mesh_from_builder(Mesh_Builder* mb) {
-    Mesh mesh = {};
-    GLsizei vertex_count = (GLsizei) mb->vertices.size();
-    GLsizei index_count  = (GLsizei) mb->indices.size();
 
-    if (index_count == 0) mesh.count = vertex_count;
-    else                  mesh.count = index_count;
-
-    // Create vertex array object
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // Create vertex buffer
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex)*vertex_count, &mb->vertices[0].pos.x, GL_STATIC_DRAW);
+// NOTE(alexander): shared by every mesh, see Geometry_Arena
+static Geometry_Arena geometry_arena;
+
+static constexpr u32 min_arena_vertices = 1 << 16;
+static constexpr u32 min_arena_indices  = 1 << 18;
+
+// NOTE(alexander): replaces the buffer with a larger one and copies over the used part
+static void
+grow_geometry_buffer(GLuint* buffer, usize used_size, usize new_size) {
+    GLuint new_buffer;
+    glGenBuffers(1, &new_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+    if (*buffer) {
+        glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used_size);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, buffer);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    *buffer = new_buffer;
+}
 
-    // Create index buffer
-    if (index_count > 0) {
-        glGenBuffers(1, &mesh.ibo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(u16)*index_count, &mb->indices[0], GL_STATIC_DRAW);
+/**
+ * Makes room for the vertices and indices of another mesh, the vertex array
+ * is kept and only pointed to the new buffers so bound state stays valid.
+ */
+static void
+reserve_geometry_arena(Geometry_Arena* arena, u32 vertex_count, u32 index_count) {
+    bool has_grown = false;
+    if (arena->num_vertices + vertex_count > arena->vertex_capacity) {
+        u32 capacity = max(arena->vertex_capacity*2, min_arena_vertices);
+        while (capacity < arena->num_vertices + vertex_count) capacity *= 2;
+        grow_geometry_buffer(&arena->vbo, sizeof(Vertex)*arena->num_vertices, sizeof(Vertex)*capacity);
+        arena->vertex_capacity = capacity;
+        has_grown = true;
+    }
+    if (arena->num_indices + index_count > arena->index_capacity) {
+        u32 capacity = max(arena->index_capacity*2, min_arena_indices);
+        while (capacity < arena->num_indices + index_count) capacity *= 2;
+        grow_geometry_buffer(&arena->ibo, sizeof(u16)*arena->num_indices, sizeof(u16)*capacity);
+        arena->index_capacity = capacity;
+        has_grown = true;
     }
+    if (!has_grown) return;
 
+    if (!arena->vao) {
+        glGenVertexArrays(1, &arena->vao);
+    }
+    glBindVertexArray(arena->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->ibo);
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
@@ -34,13 +62,71 @@ create_mesh_from_builder(Mesh_Builder* mb) {
     // Reset state
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
+}
+
+// NOTE(alexander): the number of mesh ids that fits in the draw key, see Draw_Key
+static constexpr u32 max_mesh_ids = 1 << 12;
+
+/**
+ * Copies the mesh into the geometry arena, everything is drawn indexed so
+ * meshes without indices gets one index per vertex.
+ */
+Mesh
+create_mesh_from_builder(Mesh_Builder* mb) {
+    Geometry_Arena* arena = &geometry_arena;
+    u32 vertex_count = (u32) mb->vertices.size();
+    std::vector<u16> sequential_indices;
+    const std::vector<u16>* indices = &mb->indices;
+    if (mb->indices.size() == 0) {
+        assert(vertex_count <= 65536 && "running out of indices");
+        sequential_indices.resize(vertex_count);
+        for (u32 i = 0; i < vertex_count; i++) sequential_indices[i] = (u16) i;
+        indices = &sequential_indices;
+    }
+    u32 index_count = (u32) indices->size();
+
+    reserve_geometry_arena(arena, vertex_count, index_count);
+
+    assert(arena->num_meshes + 1 < max_mesh_ids && "too many meshes to fit in the draw key");
+    Mesh mesh = {};
+    mesh.id = ++arena->num_meshes;
+    mesh.base_vertex = (GLint) arena->num_vertices;
+    mesh.first_index = arena->num_indices;
+    mesh.count = (GLsizei) index_count;
+
+    // NOTE(alexander): uploaded through the copy target so the bound vertex array isn't touched
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(Vertex)*arena->num_vertices, sizeof(Vertex)*vertex_count, mb->vertices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->ibo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(u16)*arena->num_indices, sizeof(u16)*index_count, indices->data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    arena->num_vertices += vertex_count;
+    arena->num_indices += index_count;
 
     mesh.mode = GL_TRIANGLES;
 
+    // Compute the bounding box and the bounding sphere around its center
+    if (vertex_count > 0) {
+        glm::vec3 min_pos = mb->vertices[0].pos;
+        glm::vec3 max_pos = mb->vertices[0].pos;
+        for (int i = 1; i < vertex_count; i++) {
+            const glm::vec3& pos = mb->vertices[i].pos;
+            for (int k = 0; k < 3; k++) {
+                min_pos[k] = min(min_pos[k], pos[k]);
+                max_pos[k] = max(max_pos[k], pos[k]);
+            }
+        }
+        mesh.bounds_center = (min_pos + max_pos)*0.5f;
+        mesh.bounds_extents = (max_pos - min_pos)*0.5f;
+
+        f32 radius_sq = 0.0f;
+        for (int i = 0; i < vertex_count; i++) {
+            glm::vec3 offset = mb->vertices[i].pos - mesh.bounds_center;
+            radius_sq = max(radius_sq, glm::dot(offset, offset));
+        }
+        mesh.bounds_radius = sqrtf(radius_sq);
+    }
+
     return mesh;
 }
 
@@ -70,135 +156,554 @@ begin_frame(const glm::vec4& clear_color, const glm::vec4& viewport, bool depth_
     
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    if (renderer) renderer->prev_material = Material_Type_None;
-}
-
-inline void
-apply_material(Renderer* renderer,
-               const Material& material,
-               const glm::mat4& model_matrix,
-               const glm::mat4& view_matrix,
-               const glm::mat4& projection_matrix,
-               const glm::mat4& view_proj_matrix) {
-
-    // TODO(alexander): shoud maybe be separate from this function!!!
-    // Prepare material, use shader and set global settings e.g. lighting information
-    if (renderer->prev_material != material.type) {
-        switch (material.type) {
-            case Material_Type_Basic: {
-                const Basic_Shader* shader = material.Basic.shader;
-                glUseProgram(shader->program);
-                glUniform1f(shader->u_light_attenuation, renderer->light_attenuation);
-                glUniform1f(shader->u_light_intensity, renderer->light_intensity);
-            } break;
-        
-            case Material_Type_Phong: {
-                const Phong_Shader* shader = material.Phong.shader;
-                glUseProgram(shader->program);
-
-                glUniform3fv(shader->u_view_pos, 1, glm::value_ptr(renderer->view_pos));
-
-                {
-                    Directional_Light& l = renderer->directional_light;
-                    glUniform3fv(shader->directional_light.u_direction, 1, glm::value_ptr(l.direction));
-                    glUniform3fv(shader->directional_light.u_ambient,   1, glm::value_ptr(l.ambient));
-                    glUniform3fv(shader->directional_light.u_diffuse,   1, glm::value_ptr(l.diffuse));
-                    glUniform3fv(shader->directional_light.u_specular,  1, glm::value_ptr(l.specular));
-                }
-
-                for (int i = 0; i < MAX_POINT_LIGHTS; i++) {
-                    Point_Light& l = renderer->point_lights[i];
-                    glUniform3fv(shader->point_lights[i].u_position,  1, glm::value_ptr(l.position));
-                    glUniform1f (shader->point_lights[i].u_constant,                    l.constant);
-                    glUniform1f (shader->point_lights[i].u_linear,                      l.linear);
-                    glUniform1f (shader->point_lights[i].u_quadratic,                   l.quadratic);
-                    glUniform3fv(shader->point_lights[i].u_ambient,   1, glm::value_ptr(l.ambient));
-                    glUniform3fv(shader->point_lights[i].u_diffuse,   1, glm::value_ptr(l.diffuse));
-                    glUniform3fv(shader->point_lights[i].u_specular,  1, glm::value_ptr(l.specular));
-                }
-
-                glUniform3fv(shader->u_fog_color, 1, glm::value_ptr(renderer->fog_color));
-                glUniform1f(shader->u_fog_density, renderer->fog_density);
-                glUniform1f(shader->u_fog_gradient, renderer->fog_gradient);
-            } break;
-
-            case Material_Type_Sky: {
-                const Sky_Shader* shader = material.Sky.shader;
-                glUseProgram(shader->program);
-                glUniform3fv(shader->u_fog_color, 1, glm::value_ptr(renderer->fog_color));
-            } break;
+    if (renderer) {
+        renderer->state = {};
+        renderer->stats = {};
+    }
+}
+
+static inline GLuint
+get_material_program(const Material& material) {
+    switch (material.type) {
+        case Material_Type_Basic: return material.Basic.shader->program;
+        case Material_Type_Phong: return material.Phong.shader->program;
+        case Material_Type_Sky:   return material.Sky.shader->program;
+        default:                  return 0;
+    }
+}
+
+// NOTE(alexander): the global settings e.g. lighting information and camera are in the uniform blocks
+static void
+bind_material_shader(Renderer* renderer, const Material& material) {
+    GLuint program = get_material_program(material);
+    if (renderer->state.program == program) return;
+    renderer->state.program = program;
+    renderer->state.has_material = false;
+    renderer->stats.num_shader_binds++;
+
+    switch (material.type) {
+        case Material_Type_Basic: {
+            glUseProgram(material.Basic.shader->program);
+        } break;
+
+        case Material_Type_Phong: {
+            const Phong_Shader* shader = material.Phong.shader;
+            glUseProgram(shader->program);
+            glUniform1i(shader->u_diffuse, 0);
+            glUniform1i(shader->u_specular, 1);
+        } break;
+
+        case Material_Type_Sky: {
+            const Sky_Shader* shader = material.Sky.shader;
+            glUseProgram(shader->program);
+            glUniform1i(shader->u_map, 0);
+        } break;
+    }
+}
+
+static void
+upload_uniform_block(GLuint* buffer, Uniform_Block_Binding binding, const void* data, usize size) {
+    if (!*buffer) {
+        glGenBuffers(1, buffer);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, *buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, data, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, *buffer);
+}
+
+static void
+upload_frame_uniforms(Renderer* renderer) {
+    Frame_Uniforms frame = {};
+    const Directional_Light& d = renderer->directional_light;
+    frame.directional_light.direction = d.direction;
+    frame.directional_light.ambient   = d.ambient;
+    frame.directional_light.diffuse   = d.diffuse;
+    frame.directional_light.specular  = d.specular;
+
+    for (int i = 0; i < MAX_POINT_LIGHTS; i++) {
+        const Point_Light& l = renderer->point_lights[i];
+        frame.point_lights[i].position  = l.position;
+        frame.point_lights[i].constant  = l.constant;
+        frame.point_lights[i].linear    = l.linear;
+        frame.point_lights[i].quadratic = l.quadratic;
+        frame.point_lights[i].ambient   = l.ambient;
+        frame.point_lights[i].diffuse   = l.diffuse;
+        frame.point_lights[i].specular  = l.specular;
+    }
+
+    frame.fog_color = glm::vec3(renderer->fog_color);
+    frame.fog_density = renderer->fog_density;
+    frame.fog_gradient = renderer->fog_gradient;
+    frame.light_attenuation = renderer->light_attenuation;
+    frame.light_intensity = renderer->light_intensity;
+    upload_uniform_block(&renderer->frame_uniform_buffer, Uniform_Block_Frame, &frame, sizeof(frame));
+}
+
+static void
+upload_view_uniforms(Renderer* renderer,
+                     const glm::mat4& view_matrix,
+                     const glm::mat4& projection_matrix,
+                     const glm::mat4& view_proj_matrix) {
+    View_Uniforms view = {};
+    view.view_proj_transform = view_proj_matrix;
+
+    // Sky should not be moved by the camera!
+    glm::mat4 sky_view = view_matrix;
+    sky_view[3].x = 0.0f;
+    sky_view[3].y = 10.0f;
+    sky_view[3].z = 0.0f;
+    view.sky_transform = projection_matrix * sky_view;
+
+    view.view_pos = renderer->view_pos;
+    upload_uniform_block(&renderer->view_uniform_buffer, Uniform_Block_View, &view, sizeof(view));
+}
+
+static inline void
+bind_texture(Renderer* renderer, u32 unit, const Texture* texture) {
+    if (renderer->state.textures[unit] == texture->handle) return;
+    renderer->state.textures[unit] = texture->handle;
+    renderer->stats.num_texture_binds++;
+
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(texture->target, texture->handle);
+}
+
+// NOTE(alexander): every entity has its own copy of the material, so the parameters are compared instead
+static bool
+has_same_material_parameters(const Material& a, const Material& b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+        case Material_Type_Basic: return a.Basic.color == b.Basic.color;
+        case Material_Type_Phong: return a.Phong.color == b.Phong.color && a.Phong.shininess == b.Phong.shininess;
+        default:                  return true;
+    }
+}
+
+// NOTE(alexander): the texture handles of the material, draws with the same textures are sorted together
+static inline u64
+get_material_textures(const Material& material) {
+    switch (material.type) {
+        case Material_Type_Phong: return ((u64) material.Phong.diffuse->handle << 32) | material.Phong.specular->handle;
+        case Material_Type_Sky:   return (u64) material.Sky.map->handle << 32;
+        default:                  return 0;
+    }
+}
+
+static bool
+has_same_material(const Material& a, const Material& b) {
+    return get_material_program(a) == get_material_program(b) &&
+           get_material_textures(a) == get_material_textures(b) &&
+           has_same_material_parameters(a, b);
+}
+
+/***************************************************************************
+ * Material ids
+ ***************************************************************************/
+
+// NOTE(alexander): the number of ids that fits in the draw key fields, see Draw_Key
+static constexpr u32 max_shader_ids = 1 << 6;
+static constexpr u32 max_texture_ids = 1 << 12;
+static constexpr u32 max_material_ids = 1 << 12;
+
+struct Interned_Material {
+    Material material;
+    u16 shader_id;
+    u16 texture_id;
+};
+
+/**
+ * The distinct materials and the distinct shaders and texture sets they use,
+ * the index is the id except for materials where id 0 means not interned.
+ * Shared by every renderer just like the GL objects the ids refer to.
+ */
+struct Material_Registry {
+    std::vector<u64> programs;
+    std::vector<u64> texture_sets; // see get_material_textures
+    std::vector<Interned_Material> materials;
+};
+
+static Material_Registry material_registry;
+
+static u16
+intern_value(std::vector<u64>& values, u64 value, u32 max_count) {
+    for (u32 i = 0; i < values.size(); i++) {
+        if (values[i] == value) return (u16) i;
+    }
+    assert(values.size() < max_count && "too many distinct values to fit in the draw key");
+    values.push_back(value);
+    return (u16) (values.size() - 1);
+}
+
+/**
+ * Gives the material the id of the first interned material that has the same
+ * shader, textures and parameters. Called by push_draw_command the first time the
+ * material is drawn, the id is cached in the material so the next draws are sorted
+ * without comparing parameters. NOTE(alexander): changing the material afterwards
+ * doesn't break rendering, apply_material still compares the parameters, the draws
+ * are just sorted together with the old material until its id is reset to 0.
+ */
+void
+intern_material(const Material* material) {
+    Material_Registry* registry = &material_registry;
+    for (u32 i = 0; i < registry->materials.size(); i++) {
+        if (has_same_material(registry->materials[i].material, *material)) {
+            material->id = (u16) (i + 1);
+            return;
         }
     }
-    renderer->prev_material = material.type;
+
+    assert(registry->materials.size() + 1 < max_material_ids && "too many distinct materials to fit in the draw key");
+    Interned_Material interned;
+    interned.material = *material;
+    interned.shader_id = intern_value(registry->programs, get_material_program(*material), max_shader_ids);
+    interned.texture_id = intern_value(registry->texture_sets, get_material_textures(*material), max_texture_ids);
+    registry->materials.push_back(interned);
+    material->id = (u16) registry->materials.size();
+}
+
+/**
+ * Binds the shader, textures and material parameters. The model matrices are
+ * instance attributes (see draw_mesh) and the camera is in the View_Data block.
+ */
+void
+apply_material(Renderer* renderer, const Material& material) {
+    bind_material_shader(renderer, material);
+    bool upload_parameters = !renderer->state.has_material ||
+                             !has_same_material_parameters(renderer->state.material, material);
+    renderer->state.material = material;
+    renderer->state.has_material = true;
 
     // Set material specific parameters
     switch (material.type) {
         case Material_Type_Basic: {
             const Basic_Material* basic = &material.Basic;
-            glUniform4fv(basic->shader->u_color, 1, glm::value_ptr(basic->color));
-
-            glm::mat4 mvp_transform = view_proj_matrix * model_matrix;
-            glUniformMatrix4fv(basic->shader->u_mvp_transform, 1, GL_FALSE, glm::value_ptr(mvp_transform));
+            if (upload_parameters) {
+                glUniform4fv(basic->shader->u_color, 1, glm::value_ptr(basic->color));
+            }
         } break;
 
         case Material_Type_Phong: {
             const Phong_Material* phong = &material.Phong;
-            glUniformMatrix4fv(phong->shader->u_model_transform, 1, GL_FALSE, glm::value_ptr(model_matrix));
+            if (upload_parameters) {
+                glUniform3fv(phong->shader->u_color, 1, glm::value_ptr(phong->color));
+                glUniform1f(phong->shader->u_shininess, phong->shininess);
+            }
 
-            auto normal_matrix = glm::mat3(glm::transpose(glm::inverse(model_matrix)));
-            glUniformMatrix3fv(phong->shader->u_normal_transform, 1, GL_FALSE, glm::value_ptr(normal_matrix));
+            bind_texture(renderer, 0, phong->diffuse);
+            bind_texture(renderer, 1, phong->specular);
+        } break;
 
-            glUniform3fv(phong->shader->u_color, 1, glm::value_ptr(phong->color));
+        case Material_Type_Sky: {
+            bind_texture(renderer, 0, material.Sky.map);
+        } break;
+    }
+}
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(phong->diffuse->target, phong->diffuse->handle);
-            glUniform1i(phong->shader->u_diffuse, 0);
+/**
+ * Points the instance attributes of the arena vertex array at the instances starting
+ * at first_instance, multi draws use 0 and offset each mesh with its base instance instead.
+ */
+static void
+bind_instance_attributes(Renderer* renderer, u32 first_instance) {
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->instance_buffer);
+    usize offset = first_instance*sizeof(Instance_Data);
+    for (int i = 0; i < 3; i++) {
+        GLuint model_row = 3 + i;
+        glEnableVertexAttribArray(model_row);
+        glVertexAttribPointer(model_row, 4, GL_FLOAT, GL_FALSE, sizeof(Instance_Data),
+                              (GLvoid*) (offset + offsetof(Instance_Data, model_rows) + i*sizeof(glm::vec4)));
+        glVertexAttribDivisor(model_row, 1);
+
+        GLuint normal_row = 6 + i;
+        glEnableVertexAttribArray(normal_row);
+        glVertexAttribPointer(normal_row, 3, GL_FLOAT, GL_FALSE, sizeof(Instance_Data),
+                              (GLvoid*) (offset + offsetof(Instance_Data, normal_rows) + i*sizeof(glm::vec4)));
+        glVertexAttribDivisor(normal_row, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(phong->specular->target, phong->specular->handle);
-            glUniform1i(phong->shader->u_specular, 1);
+static void
+bind_geometry_arena(Renderer* renderer) {
+    if (renderer->state.vao == geometry_arena.vao) return;
+    glBindVertexArray(geometry_arena.vao);
+    renderer->state.vao = geometry_arena.vao;
+    renderer->stats.num_mesh_binds++;
+}
 
-            glUniform1f(phong->shader->u_shininess, phong->shininess);
+static void
+set_face_culling(Renderer* renderer, bool is_two_sided) {
+    if (renderer->state.is_culling_disabled == is_two_sided) return;
+    if (is_two_sided) {
+        glDisable(GL_CULL_FACE);
+    } else {
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+    }
+    renderer->state.is_culling_disabled = is_two_sided;
+}
 
-            glm::mat4 mvp_transform = view_proj_matrix * model_matrix;
-            glUniformMatrix4fv(phong->shader->u_mvp_transform, 1, GL_FALSE, glm::value_ptr(mvp_transform));
+/**
+ * Draws num_instances copies of the mesh, instance data is read from the instance
+ * buffer starting at first_instance (uploaded by submit_render_queue).
+ */
+void
+draw_mesh(Renderer* renderer, const Mesh& mesh, u32 first_instance, u32 num_instances) {
+    bind_geometry_arena(renderer);
+    bind_instance_attributes(renderer, first_instance);
+    set_face_culling(renderer, mesh.is_two_sided);
+
+    glDrawElementsInstancedBaseVertex(mesh.mode, mesh.count, GL_UNSIGNED_SHORT,
+                                      (GLvoid*) (mesh.first_index*sizeof(u16)), num_instances, mesh.base_vertex);
+    renderer->stats.num_draw_calls++;
+    renderer->stats.num_mesh_draws++;
+    renderer->stats.num_instances += num_instances;
+}
 
-        } break;
+// NOTE(alexander): base instance in the indirect commands needs GL 4.2 as well, included in 4.3
+static inline bool
+has_multi_draw_indirect() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
 
-        case Material_Type_Sky: {
-            const Sky_Material* sky = &material.Sky;
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(sky->map->target, sky->map->handle);
-            glUniform1i(sky->shader->u_map, 0);
-
-            // Sky should not be moved by the camera!
-            glm::mat4 vp_transform = glm::mat4(view_matrix);
-            vp_transform[3].x = 0.0f;
-            vp_transform[3].y = 10.0f;
-            vp_transform[3].z = 0.0f;
-            vp_transform = projection_matrix * vp_transform;
-            glUniformMatrix4fv(sky->shader->u_vp_transform, 1, GL_FALSE, glm::value_ptr(vp_transform));
-        } break;
+/***************************************************************************
+ * Render queue
+ ***************************************************************************/
+
+void
+begin_render_queue(Render_Queue* queue) {
+    queue->commands.clear();
+    queue->keys.clear();
+}
+
+static u64
+make_draw_key(const Material& material, const Mesh& mesh, f32 view_depth) {
+    u64 pass = material.type == Material_Type_Sky ? Render_Pass_Background : Render_Pass_Opaque;
+
+    if (material.id == 0) intern_material(&material);
+    assert(material.id <= material_registry.materials.size() && "material id was not given by intern_material");
+    const Interned_Material& interned = material_registry.materials[material.id - 1];
+    u64 shader_id = interned.shader_id & 0x3F;
+    u64 texture_id = interned.texture_id & 0xFFF;
+    u64 material_id = material.id & 0xFFF;
+
+    // NOTE(alexander): the bits of positive floats are ordered the same way as the floats,
+    // the sign is always zero so the next 20 bits are used i.e. the exponent and 12 bits of the mantissa
+    f32 depth = max(view_depth, 0.0f);
+    u32 depth_bits;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    u64 depth_key = (depth_bits >> 11) & 0xFFFFF;
+
+    u64 mesh_id = mesh.id & 0xFFF;
+
+    return (pass << 62) | (shader_id << 56) | (texture_id << 44) | (material_id << 32) | (mesh_id << 20) | depth_key;
+}
+
+/**
+ * The view depth is the distance in front of the camera, used for sorting
+ * draws with the same state front to back so less pixels have to be shaded.
+ */
+void
+push_draw_command(Render_Queue* queue,
+                  const Material& material,
+                  const Mesh& mesh,
+                  const Affine_Transform& model_matrix,
+                  f32 view_depth) {
+    Draw_Key key;
+    key.key = make_draw_key(material, mesh, view_depth);
+    key.command = (u32) queue->commands.size();
+    queue->keys.push_back(key);
+
+    Draw_Command command;
+    command.material = &material;
+    command.mesh = &mesh;
+    command.model_matrix = model_matrix;
+    queue->commands.push_back(command);
+}
+
+/**
+ * Least significant digit radix sort on 8 bits at a time, the digits that
+ * are the same in every key are skipped, e.g. the pass and usually the shader.
+ * It is stable so draws with equal keys are kept in the order they were pushed.
+ * Returns either keys or scratch, whichever the result ended up in.
+ */
+static Draw_Key*
+radix_sort_draw_keys(Draw_Key* keys, Draw_Key* scratch, u32 count) {
+    u32 histograms[8][256] = {};
+    for (u32 i = 0; i < count; i++) {
+        u64 key = keys[i].key;
+        for (int d = 0; d < 8; d++) {
+            histograms[d][(key >> (d*8)) & 0xFF]++;
+        }
+    }
+
+    Draw_Key* src = keys;
+    Draw_Key* dst = scratch;
+    for (int d = 0; d < 8; d++) {
+        u32* histogram = histograms[d];
+        u32 shift = d*8;
+        if (histogram[(src[0].key >> shift) & 0xFF] == count) continue;
+
+        u32 offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            u32 digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
+        }
+
+        for (u32 i = 0; i < count; i++) {
+            dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+        std::swap(src, dst);
     }
+    return src;
 }
 
 void
-draw_mesh(const Mesh& mesh) {
-    // Draw mesh
-    glBindVertexArray(mesh.vao);
+sort_render_queue(Render_Queue* queue) {
+    if (queue->keys.size() < 2) return;
 
-    if (mesh.is_two_sided) {
-        glDisable(GL_CULL_FACE);
+    queue->sort_scratch.resize(queue->keys.size());
+    Draw_Key* sorted = radix_sort_draw_keys(queue->keys.data(), queue->sort_scratch.data(), (u32) queue->keys.size());
+    if (sorted != queue->keys.data()) {
+        queue->keys.swap(queue->sort_scratch);
+    }
+}
+
+// NOTE(alexander): draws can be in the same multi draw if they share everything but the mesh and model matrix
+static bool
+can_draw_together(const Draw_Command& a, const Draw_Command& b) {
+    if (a.mesh->mode != b.mesh->mode ||
+        a.mesh->is_two_sided != b.mesh->is_two_sided) {
+        return false;
     }
-    if (mesh.ibo > 0) {
-        glDrawElements(mesh.mode, mesh.count, GL_UNSIGNED_SHORT, 0);
+    return has_same_material(*a.material, *b.material);
+}
+
+// NOTE(alexander): draws can be instanced together if they only differ by their model matrix
+static bool
+can_instance_together(const Draw_Command& a, const Draw_Command& b) {
+    return a.mesh->first_index == b.mesh->first_index &&
+           a.mesh->base_vertex == b.mesh->base_vertex &&
+           a.mesh->count == b.mesh->count &&
+           can_draw_together(a, b);
+}
+
+/**
+ * Draws everything in the queue in the order of the keys, see sort_render_queue.
+ * Runs of draws that share the same mesh and material becomes one instanced indirect
+ * command, and consecutive commands with the same material are drawn with a single
+ * glMultiDrawElementsIndirect. Without GL 4.3 each command is drawn by itself instead.
+ * The instance data and indirect commands are uploaded at once before drawing,
+ * same with the camera (View_Data) and the first time each frame the lights (Frame_Data).
+ * Shaders, textures and material parameters are only bound when they change.
+ */
+void
+submit_render_queue(Renderer* renderer,
+                    Render_Queue* queue,
+                    const glm::mat4& view_matrix,
+                    const glm::mat4& projection_matrix,
+                    const glm::mat4& view_proj_matrix) {
+    if (queue->keys.size() == 0) return;
+
+    queue->instances.resize(queue->keys.size());
+    for (u32 i = 0; i < queue->keys.size(); i++) {
+        const Affine_Transform& model_matrix = queue->commands[queue->keys[i].command].model_matrix;
+        Instance_Data& instance = queue->instances[i];
+        glm::vec3 n0, n1, n2;
+        affine_inverse_transpose_rows(model_matrix, &n0, &n1, &n2);
+        for (int j = 0; j < 3; j++) instance.model_rows[j] = model_matrix.rows[j];
+        instance.normal_rows[0] = glm::vec4(n0, 0.0f);
+        instance.normal_rows[1] = glm::vec4(n1, 0.0f);
+        instance.normal_rows[2] = glm::vec4(n2, 0.0f);
+    }
+
+    if (!renderer->instance_buffer) {
+        glGenBuffers(1, &renderer->instance_buffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Instance_Data)*queue->instances.size(), queue->instances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (!renderer->state.is_frame_uploaded) {
+        upload_frame_uniforms(renderer);
+        renderer->state.is_frame_uploaded = true;
+    }
+    upload_view_uniforms(renderer, view_matrix, projection_matrix, view_proj_matrix);
+
+    queue->indirect_commands.clear();
+    queue->batches.clear();
+    u32 first = 0;
+    while (first < queue->keys.size()) {
+        const Draw_Command& command = queue->commands[queue->keys[first].command];
+        u32 end = first + 1;
+        while (end < queue->keys.size() &&
+               can_instance_together(command, queue->commands[queue->keys[end].command])) {
+            end++;
+        }
+
+        if (queue->batches.size() == 0 ||
+            !can_draw_together(queue->commands[queue->keys[queue->batches.back().first_draw].command], command)) {
+            Draw_Batch batch;
+            batch.first_command = (u32) queue->indirect_commands.size();
+            batch.num_commands = 0;
+            batch.first_draw = first;
+            queue->batches.push_back(batch);
+        }
+
+        Draw_Elements_Indirect_Command indirect;
+        indirect.count = (u32) command.mesh->count;
+        indirect.instance_count = end - first;
+        indirect.first_index = command.mesh->first_index;
+        indirect.base_vertex = command.mesh->base_vertex;
+        indirect.base_instance = first;
+        queue->indirect_commands.push_back(indirect);
+        queue->batches.back().num_commands++;
+        first = end;
+    }
+
+    if (has_multi_draw_indirect()) {
+        if (!renderer->indirect_buffer) {
+            glGenBuffers(1, &renderer->indirect_buffer);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer->indirect_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(Draw_Elements_Indirect_Command)*queue->indirect_commands.size(),
+                     queue->indirect_commands.data(), GL_STREAM_DRAW);
+
+        bind_geometry_arena(renderer);
+        bind_instance_attributes(renderer, 0);
+        for (const Draw_Batch& batch : queue->batches) {
+            const Draw_Command& command = queue->commands[queue->keys[batch.first_draw].command];
+            apply_material(renderer, *command.material);
+            set_face_culling(renderer, command.mesh->is_two_sided);
+
+            usize offset = batch.first_command*sizeof(Draw_Elements_Indirect_Command);
+            glMultiDrawElementsIndirect(command.mesh->mode, GL_UNSIGNED_SHORT, (GLvoid*) offset,
+                                        batch.num_commands, 0);
+            renderer->stats.num_draw_calls++;
+            renderer->stats.num_mesh_draws += batch.num_commands;
+        }
+        renderer->stats.num_instances += (u32) queue->keys.size();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
     } else {
-        glDrawArrays(mesh.mode, 0, mesh.count);
+        for (const Draw_Batch& batch : queue->batches) {
+            const Draw_Command& command = queue->commands[queue->keys[batch.first_draw].command];
+            apply_material(renderer, *command.material);
+            for (u32 i = 0; i < batch.num_commands; i++) {
+                const Draw_Elements_Indirect_Command& indirect = queue->indirect_commands[batch.first_command + i];
+                const Draw_Command& draw = queue->commands[queue->keys[indirect.base_instance].command];
+                draw_mesh(renderer, *draw.mesh, indirect.base_instance, indirect.instance_count);
+            }
+        }
     }
-    if (mesh.is_two_sided) {
+
+    if (renderer->state.is_culling_disabled) {
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
         glFrontFace(GL_CCW);
+        renderer->state.is_culling_disabled = false;
     }
 }
 
@@ -281,7 +786,7 @@ load_texture_2d_from_file(const char* filename,
                           bool use_anisotropic_filtering,
                           f32 max_anisotropy) {
     std::ostringstream path_stream;
-    path_stream << res_folder;
+    path_stream << get_resource_folder();
     path_stream << "textures/";
     path_stream << filename;
     std::string filepath = path_stream.str();
@@ -425,7 +930,7 @@ load_glsl_shader_from_sources(const char* vertex_shader, const char* fragment_sh
 static GLuint
 load_glsl_shader_from_file(const char* filename) {
     std::ostringstream path_stream;
-    path_stream << res_folder;
+    path_stream << get_resource_folder();
     path_stream << "shaders/";
     path_stream << filename;
     std::string filepath = path_stream.str();
@@ -465,15 +970,30 @@ compile_basic_2d_shader() {
     return shader;
 }
 
+/**
+ * Binds the shared uniform blocks used by the program to their fixed binding points,
+ * blocks that the program doesn't use are skipped.
+ */
+static void
+bind_uniform_blocks(GLuint program) {
+    GLuint frame_block = glGetUniformBlockIndex(program, "Frame_Data");
+    if (frame_block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, frame_block, Uniform_Block_Frame);
+    }
+
+    GLuint view_block = glGetUniformBlockIndex(program, "View_Data");
+    if (view_block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, view_block, Uniform_Block_View);
+    }
+}
+
 Basic_Shader
 compile_basic_shader() {
     Basic_Shader shader = {};
     GLuint program = load_glsl_shader_from_file("basic.glsl");
     shader.program = program;
-    shader.u_color             = glGetUniformLocation(program, "color");
-    shader.u_light_intensity   = glGetUniformLocation(program, "light_intensity");
-    shader.u_light_attenuation = glGetUniformLocation(program, "light_attenuation");
-    shader.u_mvp_transform     = glGetUniformLocation(program, "mvp_transform");
+    shader.u_color = glGetUniformLocation(program, "color");
+    bind_uniform_blocks(program);
     return shader;
 }
 
@@ -482,50 +1002,11 @@ compile_phong_shader() {
     Phong_Shader shader = {};
     GLuint program = load_glsl_shader_from_file("phong.glsl");
     shader.program = program;
-
-    shader.u_model_transform  = glGetUniformLocation(program, "model_transform");
-    shader.u_normal_transform = glGetUniformLocation(program, "normal_transform");
-    shader.u_mvp_transform    = glGetUniformLocation(program, "mvp_transform");
-
     shader.u_color     = glGetUniformLocation(program, "material.color");
     shader.u_diffuse   = glGetUniformLocation(program, "material.diffuse");
     shader.u_specular  = glGetUniformLocation(program, "material.specular");
     shader.u_shininess = glGetUniformLocation(program, "material.shininess");
-
-    shader.u_fog_color    = glGetUniformLocation(program, "fog_color");
-    shader.u_fog_density  = glGetUniformLocation(program, "fog_density");
-    shader.u_fog_gradient = glGetUniformLocation(program, "fog_gradient");
-
-    shader.u_view_pos = glGetUniformLocation(program, "view_pos");
-
-    shader.directional_light.u_direction = glGetUniformLocation(program, "directional_light.direction");
-    shader.directional_light.u_ambient = glGetUniformLocation(program, "directional_light.ambient");
-    shader.directional_light.u_diffuse = glGetUniformLocation(program, "directional_light.diffuse");
-    shader.directional_light.u_specular = glGetUniformLocation(program, "directional_light.specular");
- 
-    for (int i = 0; i < MAX_POINT_LIGHTS; i++) {
-        char buf[30];
-        snprintf(buf, 30, "point_lights[%d].position", i);
-        shader.point_lights[i].u_position = glGetUniformLocation(program, buf);
-        
-        snprintf(buf, 30, "point_lights[%d].constant", i);
-        shader.point_lights[i].u_constant = glGetUniformLocation(program, buf);
-
-        snprintf(buf, 30, "point_lights[%d].linear", i);
-        shader.point_lights[i].u_linear = glGetUniformLocation(program, buf);
-
-        snprintf(buf, 30, "point_lights[%d].quadratic", i);
-        shader.point_lights[i].u_quadratic = glGetUniformLocation(program, buf);
-
-        snprintf(buf, 30, "point_lights[%d].ambient", i);
-        shader.point_lights[i].u_ambient = glGetUniformLocation(program, buf);
-
-        snprintf(buf, 30, "point_lights[%d].diffuse", i);
-        shader.point_lights[i].u_diffuse = glGetUniformLocation(program, buf);
-        
-        snprintf(buf, 30, "point_lights[%d].specular", i);
-        shader.point_lights[i].u_specular = glGetUniformLocation(program, buf);
-    }
+    bind_uniform_blocks(program);
     return shader;
 }
 
@@ -534,8 +1015,7 @@ compile_sky_shader() {
     Sky_Shader shader = {};
     GLuint program = load_glsl_shader_from_file("sky.glsl");
     shader.program = program;
-    shader.u_map          = glGetUniformLocation(program, "material.map");
-    shader.u_fog_color    = glGetUniformLocation(program, "material.fog_color");
-    shader.u_vp_transform = glGetUniformLocation(program, "vp_transform");
+    shader.u_map = glGetUniformLocation(program, "material.map");
+    bind_uniform_blocks(program);
     return shader;
 }
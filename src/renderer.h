@@ -1,13 +1,38 @@
 
 #define MAX_POINT_LIGHTS 2
 
+/**
+ * Range of indices in the geometry arena, the indices are relative to base_vertex
+ * i.e. drawn with glDrawElementsBaseVertex using the arena vertex array.
+ */
 struct Mesh {
-    GLuint  vbo;
-    GLuint  ibo;
-    GLuint  vao;
-    GLsizei count;
+    u32     id; // dense id given by the geometry arena, used to sort the draws, 0 if it's not in the arena
+    GLint   base_vertex;
+    GLuint  first_index;
+    GLsizei count; // number of indices
     GLenum  mode; // e.g. GL_TRIANGLES
     bool is_two_sided; // aka. disable backface culling?
+
+    // NOTE(alexander): local space bounds, the sphere has the same center as the box
+    glm::vec3 bounds_center;
+    glm::vec3 bounds_extents; // half size of the axis aligned box
+    f32 bounds_radius;
+};
+
+/**
+ * All meshes are suballocated from one vertex buffer and one index buffer that share
+ * a single vertex array, so switching meshes doesn't bind anything and draws of different
+ * meshes can be merged into one multi draw. The buffers grow by doubling, meshes are never freed.
+ */
+struct Geometry_Arena {
+    GLuint vao;
+    GLuint vbo;
+    GLuint ibo;
+    u32 num_meshes;
+    u32 num_vertices;
+    u32 num_indices;
+    u32 vertex_capacity;
+    u32 index_capacity;
 };
 
 struct Height_Map {
@@ -29,54 +54,33 @@ struct Basic_2D_Shader {
     GLint u_mvp_transform;
 };
 
+/**
+ * Uniform blocks shared by the basic, phong and sky shaders, the programs have their
+ * blocks bound to these fixed binding points when compiled, see bind_uniform_blocks.
+ */
+enum Uniform_Block_Binding {
+    Uniform_Block_Frame, // Frame_Uniforms, uploaded once per frame
+    Uniform_Block_View, // View_Uniforms, uploaded once per submitted render queue
+};
+
+// NOTE(alexander): instanced, the model matrix is read from the Instance_Data attributes
 struct Basic_Shader {
     GLuint program;
     GLint u_color;
-    GLint u_light_attenuation;
-    GLint u_light_intensity;
-    GLint u_mvp_transform;
 };
 
+// NOTE(alexander): instanced, the model and normal matrices are read from the Instance_Data attributes
 struct Phong_Shader {
     GLuint program;
     GLint u_color;
     GLint u_diffuse;
     GLint u_specular;
     GLint u_shininess;
-
-    GLint u_model_transform;
-    GLint u_normal_transform;
-    GLint u_mvp_transform;
-
-    GLint u_fog_color; // usually same as clear color
-    GLint u_fog_density; // increase density -> more fog (shorter view distance)
-    GLint u_fog_gradient; // increase gradient -> sharper transition
-
-    GLint u_view_pos;
-
-    struct {
-        GLint u_direction;
-        GLint u_ambient;
-        GLint u_diffuse;
-        GLint u_specular;
-    } directional_light;
-    
-    struct {
-        GLint u_position;
-        GLint u_constant;
-        GLint u_linear;
-        GLint u_quadratic;
-        GLint u_ambient;
-        GLint u_diffuse;
-        GLint u_specular;
-    } point_lights[MAX_POINT_LIGHTS];
 };
 
 struct Sky_Shader {
     GLuint program;
     GLint u_map;
-    GLint u_fog_color;
-    GLint u_vp_transform;
 };
 
 enum Material_Type {
@@ -106,6 +110,7 @@ struct Sky_Material {
 
 struct Material {
     Material_Type type;
+    mutable u16 id; // cached by intern_material when the material is first drawn, used to sort the draws
     union {
         Basic_Material Basic;
         Phong_Material Phong;
@@ -157,8 +162,154 @@ struct Point_Light {
     glm::vec3 specular;
 };
 
+/**
+ * Draw recorded into the render queue, the material and mesh are not copied
+ * so they have to stay alive until the queue is submitted.
+ */
+struct Draw_Command {
+    const Material* material;
+    const Mesh* mesh;
+    Affine_Transform model_matrix;
+};
+
+/**
+ * Per instance vertex attributes, draws that share the same mesh and material
+ * are drawn with a single instanced draw call. Stored in the instance buffer
+ * at attribute locations 3-5 (model rows) and 6-8 (normal rows).
+ */
+struct Instance_Data {
+    glm::vec4 model_rows[3]; // same layout as Affine_Transform
+    glm::vec4 normal_rows[3]; // rows of the normal matrix, w is unused
+};
+
+/**
+ * Draws are sorted by a 64-bit key so draws that share the same shader, textures,
+ * material and mesh are submitted after each other and the state is only bound once.
+ * Opaque draws with the same state are sorted front to back by their view depth.
+ * The shader, textures and material are the small ids given by intern_material.
+ *
+ *  63 62 61    56 55        44 43        32 31        20 19               0
+ * +-----+--------+------------+------------+------------+------------------+
+ * |pass | shader |  textures  |  material  |    mesh    |      depth       |
+ * +-----+--------+------------+------------+------------+------------------+
+ */
+struct Draw_Key {
+    u64 key;
+    u32 command; // index into Render_Queue::commands
+};
+
+// NOTE(alexander): same layout as DrawElementsIndirectCommand read by glMultiDrawElementsIndirect
+struct Draw_Elements_Indirect_Command {
+    u32 count;
+    u32 instance_count;
+    u32 first_index;
+    i32 base_vertex;
+    u32 base_instance; // offsets the instance attributes, i.e. the first instance in Render_Queue::instances
+};
+
+/**
+ * Consecutive indirect commands that share the same material and face culling,
+ * drawn with one glMultiDrawElementsIndirect.
+ */
+struct Draw_Batch {
+    u32 first_command; // index into Render_Queue::indirect_commands
+    u32 num_commands;
+    u32 first_draw; // index into Render_Queue::keys, used for the material
+};
+
+enum Render_Pass {
+    Render_Pass_Opaque,
+    Render_Pass_Background, // e.g. the sky, drawn last so it is only shaded where nothing else was drawn
+};
+
+struct Render_Queue {
+    std::vector<Draw_Command> commands;
+    std::vector<Draw_Key> keys;
+    std::vector<Draw_Key> sort_scratch; // used by the radix sort
+    std::vector<Instance_Data> instances; // in the sorted order, filled in by submit_render_queue
+    std::vector<Draw_Elements_Indirect_Command> indirect_commands; // one per run of instanced draws
+    std::vector<Draw_Batch> batches;
+    std::vector<u8> visible; // frustum culling results of the chunk being recorded
+};
+
+// NOTE(alexander): what is currently bound, used to skip redundant state changes, reset by begin_frame
+struct Render_State {
+    GLuint program;
+    GLuint vao;
+    GLuint textures[2]; // by texture unit
+    bool is_culling_disabled;
+    bool is_frame_uploaded; // Frame_Uniforms for this frame
+    bool has_material;
+    Material material; // last material parameters uploaded to the bound program
+};
+
+// NOTE(alexander): counted since begin_frame, shown in the performance window
+struct Render_Stats {
+    u32 num_draw_calls;
+    u32 num_mesh_draws; // meshes drawn by the draw calls, a multi draw draws many
+    u32 num_instances; // drawn by the draw calls
+    u32 num_shader_binds;
+    u32 num_texture_binds;
+    u32 num_mesh_binds;
+    u32 num_visible; // entities that passed frustum culling
+    u32 num_culled;
+};
+
+/**
+ * The uniform blocks use the std140 layout, a vec3 is aligned to 16 bytes and the
+ * next scalar can be packed into its last 4 bytes, otherwise explicit padding is needed.
+ * Structs and arrays of structs are aligned to 16 bytes as well.
+ */
+struct Std140_Directional_Light {
+    glm::vec3 direction; f32 pad0;
+    glm::vec3 ambient;   f32 pad1;
+    glm::vec3 diffuse;   f32 pad2;
+    glm::vec3 specular;  f32 pad3;
+};
+
+struct Std140_Point_Light {
+    glm::vec3 position;
+    f32 constant;
+    f32 linear;
+    f32 quadratic;       f32 pad0[2];
+    glm::vec3 ambient;   f32 pad1;
+    glm::vec3 diffuse;   f32 pad2;
+    glm::vec3 specular;  f32 pad3;
+};
+
+// NOTE(alexander): same as the Frame_Data block in the shaders
+struct Frame_Uniforms {
+    Std140_Directional_Light directional_light;
+    Std140_Point_Light point_lights[MAX_POINT_LIGHTS];
+    glm::vec3 fog_color; // usually same as clear color
+    f32 fog_density; // increase density -> more fog (shorter view distance)
+    f32 fog_gradient; // increase gradient -> sharper transition
+    f32 light_attenuation;
+    f32 light_intensity;
+    f32 pad0;
+};
+
+// NOTE(alexander): same as the View_Data block in the shaders
+struct View_Uniforms {
+    glm::mat4 view_proj_transform;
+    glm::mat4 sky_transform; // view projection without the camera translation
+    glm::vec3 view_pos;
+    f32 pad0;
+};
+
+static_assert(sizeof(Std140_Directional_Light) == 64, "directional light doesn't match std140 layout");
+static_assert(sizeof(Std140_Point_Light) == 80, "point light doesn't match std140 layout");
+static_assert(offsetof(Frame_Uniforms, fog_color) == 64 + 80*MAX_POINT_LIGHTS, "frame uniforms doesn't match std140 layout");
+static_assert(offsetof(View_Uniforms, view_pos) == 128, "view uniforms doesn't match std140 layout");
+
 struct Renderer {
-    Material_Type prev_material;
+    Render_Queue queue;
+    GLuint instance_buffer; // created on first use, holds Render_Queue::instances
+    GLuint indirect_buffer; // created on first use, holds Render_Queue::indirect_commands
+    GLuint frame_uniform_buffer; // created on first use, holds Frame_Uniforms
+    GLuint view_uniform_buffer; // created on first use, holds View_Uniforms
+    Render_State state;
+    Render_Stats stats;
     Directional_Light directional_light;
     Point_Light point_lights[4];
     glm::vec3 view_pos;
@@ -177,13 +328,22 @@ void begin_frame(const glm::vec4& clear_color,
                  bool depth_testing=false,
                  Renderer* renderer=NULL);
 
-void apply_material(Renderer* renderer,
-                    const Material& material,
-                    const glm::mat4& model_matrix,
-                    const glm::mat4& view_matrix,
-                    const glm::mat4& projection_matrix,
-                    const glm::mat4& view_proj_matrix);
-void draw_mesh(const Mesh& mesh);
+void intern_material(const Material* material);
+void apply_material(Renderer* renderer, const Material& material);
+void draw_mesh(Renderer* renderer, const Mesh& mesh, u32 first_instance, u32 num_instances);
+
+void begin_render_queue(Render_Queue* queue);
+void push_draw_command(Render_Queue* queue,
+                       const Material& material,
+                       const Mesh& mesh,
+                       const Affine_Transform& model_matrix,
+                       f32 view_depth);
+void sort_render_queue(Render_Queue* queue);
+void submit_render_queue(Renderer* renderer,
+                         Render_Queue* queue,
+                         const glm::mat4& view_matrix,
+                         const glm::mat4& projection_matrix,
+                         const glm::mat4& view_proj_matrix);
 void end_frame();
 
 void initialize_camera_3d(Camera_3D* camera,
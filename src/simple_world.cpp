@@ -7,6 +7,7 @@
 struct Simple_World_Scene {
     World world;
     std::vector<System> main_systems;
+    System_Schedule main_schedule;
     std::vector<System> rendering_pipeline;
     Entity_Handle player;
     Entity_Handle player_camera;
@@ -25,6 +26,8 @@ struct Simple_World_Scene {
 
     Height_Map terrain;
 
+    Snapshot_Assets assets; // everything the entities refer to, used for saving and loading the world
+
     bool enable_wireframe;
     bool show_gui;
 
@@ -40,6 +43,16 @@ struct Player_Controller {
 
 REGISTER_COMPONENT(Player_Controller);
 
+static void
+snapshot_player_controller(Snapshot_Fixup* fixup, void* dst, const void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        snapshot_pointer(fixup, &((Player_Controller*) dst)[i].input, &((const Player_Controller*) src)[i].input);
+        snapshot_pointer(fixup, &((Player_Controller*) dst)[i].terrain, &((const Player_Controller*) src)[i].terrain);
+    }
+}
+
+REGISTER_SNAPSHOT_FUNCTION(Player_Controller, snapshot_player_controller);
+
 DEF_SYSTEM(player_controller_system) {
     auto pc  = (Player_Controller*) components[0];
     auto pos = (Position*)          components[1];
@@ -108,6 +121,17 @@ DEF_SYSTEM(player_controller_system) {
     if (camera_rot) camera_rot->v = rot->v;
 }
 
+static Affine_Transform
+euler_trs_transform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scl) {
+    glm::quat rot_x(glm::vec3(0.0f, rot.x, 0.0f));
+    glm::quat rot_y(glm::vec3(rot.y, 0.0f, 0.0f));
+    glm::quat rot_z(glm::vec3(0.0f, 0.0f, rot.z));
+    glm::mat4 T = glm::translate(glm::mat4(1.0f), pos);
+    glm::mat4 R = glm::toMat4(rot_z * rot_y * rot_x);
+    glm::mat4 S = glm::scale(glm::mat4(1.0f), scl);
+    return affine_from_mat4(T * R * S);
+}
+
 // NOTE(alexander): optimized entity for static meshes
 static Entity_Handle
 spawn_static_mesh_entity(World* world,
@@ -123,31 +147,22 @@ spawn_static_mesh_entity(World* world,
     auto name_component = add_component(world, entity, Debug_Name);
     name_component->s = std::string(name);
 
-    glm::quat rot_x(glm::vec3(0.0f, rot.x, 0.0f));
-    glm::quat rot_y(glm::vec3(rot.y, 0.0f, 0.0f));
-    glm::quat rot_z(glm::vec3(0.0f, 0.0f, rot.z));
-    glm::mat4 T = glm::translate(glm::mat4(1.0f), pos);
-    glm::mat4 R = glm::toMat4(rot_z * rot_y * rot_x);
-    glm::mat4 S = glm::scale(glm::mat4(1.0f), scl);
-
     if (parent_handle) {
         add_component(world, entity, Local_To_World);
         auto local_to_parent = add_component(world, entity, Local_To_Parent);
-        local_to_parent->m = T * R * S;
+        local_to_parent->m = euler_trs_transform(pos, rot, scl);
     } else {
         auto local_to_world = add_component(world, entity, Local_To_World);
-        local_to_world->m = T * R * S;
+        local_to_world->m = euler_trs_transform(pos, rot, scl);
     }
 
     auto renderer = add_component(world, entity, Mesh_Renderer);
     renderer->material = material;
     renderer->mesh = mesh;
+    add_component(world, entity, World_Bounds);
 
     if (parent_handle) {
-        auto parent = add_component(world, entity, Parent);
-        parent->handle = *parent_handle;
-        auto child = add_component(world, *parent_handle, Child);
-        child->handle = entity;
+        add_child(world, *parent_handle, entity);
     }
 
     return entity;
@@ -262,6 +277,29 @@ initialize_scene(Simple_World_Scene* scene, Window* window) {
     Material wood_material = carrot_material;
     wood_material.Phong.color = glm::vec3(0.4f, 0.15f, 0.075f);
 
+    // Register the assets so the world can be saved and loaded, see world_snapshot.cpp
+    Snapshot_Assets* assets = &scene->assets;
+    add_snapshot_mesh(assets, "cube", mesh_cube);
+    add_snapshot_mesh(assets, "terrain", mesh_terrain);
+    add_snapshot_mesh(assets, "sphere", mesh_sphere);
+    add_snapshot_mesh(assets, "sky", mesh_sky);
+    add_snapshot_mesh(assets, "cylinder", mesh_cylinder);
+    add_snapshot_mesh(assets, "cone", mesh_cone);
+    add_snapshot_mesh(assets, "conical_frustum", mesh_conical_frustum);
+    add_snapshot_pointer(assets, "phong_shader", &scene->phong_shader);
+    add_snapshot_pointer(assets, "sky_shader", &scene->sky_shader);
+    add_snapshot_pointer(assets, "texture_default", &scene->texture_default);
+    add_snapshot_pointer(assets, "texture_snow_01_diffuse", &scene->texture_snow_01_diffuse);
+    add_snapshot_pointer(assets, "texture_snow_01_specular", &scene->texture_snow_01_specular);
+    add_snapshot_pointer(assets, "texture_snow_02_diffuse", &scene->texture_snow_02_diffuse);
+    add_snapshot_pointer(assets, "texture_snow_02_specular", &scene->texture_snow_02_specular);
+    add_snapshot_pointer(assets, "texture_metal_diffuse", &scene->texture_metal_diffuse);
+    add_snapshot_pointer(assets, "texture_metal_specular", &scene->texture_metal_specular);
+    add_snapshot_pointer(assets, "texture_sky", &scene->texture_sky);
+    add_snapshot_pointer(assets, "terrain", &scene->terrain);
+    add_snapshot_pointer(assets, "window", window);
+    add_snapshot_pointer(assets, "input", &window->input);
+
     // Setup the world
     World* world = &scene->world;
 
@@ -306,6 +344,7 @@ initialize_scene(Simple_World_Scene* scene, Window* window) {
     add_component(world, player, Rotation);
     add_component(world, player, Euler_Rotation);
 
+    // NOTE(alexander): the sky follows the camera so it has no World_Bounds and is never culled
     Entity_Handle sky = spawn_entity(world);
     name = add_component(world, sky, Debug_Name);
     name->s = std::string("Sky");
@@ -319,16 +358,12 @@ initialize_scene(Simple_World_Scene* scene, Window* window) {
     renderer = add_component(world, terrain, Mesh_Renderer);
     renderer->mesh = mesh_terrain;
     renderer->material = snow_ground_material;
+    add_component(world, terrain, World_Bounds);
 
-    // Create many snowmen
-    for (int i = 0; i < 30; i++) {
-        glm::vec3 p(dist(rng), 0.0f, dist(rng));
-        glm::vec3 scale(comp(rng)*0.8f + 0.2f);
-        p.y = sample_point_at(&scene->terrain, p.x, p.z) + scale.x;
+    // Create many snowmen, the first one is built by hand and the rest are copies of it
+    {
         auto snowman_base = spawn_static_mesh_entity(world, "Snowman", snow_material, mesh_sphere, NULL,
-                                                     p,
-                                                     glm::vec3(comp(rng)*two_pi, 0.0f, 0.0f),
-                                                     scale);
+                                                     glm::vec3(0.0f));
 
         auto snowman_middle = spawn_static_mesh_entity(world, "Snowman Middle",
                                                        snow_material, mesh_sphere, &snowman_base,
@@ -359,15 +394,29 @@ initialize_scene(Simple_World_Scene* scene, Window* window) {
                                                        glm::vec3(0.0f),
                                                        glm::vec3(0.0f, half_pi, 0.0f),
                                                        glm::vec3(1.0f, 2.0f, 1.0f));
+
+        Entity_Handle snowmen[30];
+        snowmen[0] = snowman_base;
+        Prefab snowman_prefab = make_prefab(world, snowman_base);
+        instantiate_prefab(world, &snowman_prefab, array_count(snowmen) - 1, &snowmen[1]);
+        destroy_prefab(&snowman_prefab);
+
+        for (int i = 0; i < array_count(snowmen); i++) {
+            glm::vec3 p(dist(rng), 0.0f, dist(rng));
+            glm::vec3 scale(comp(rng)*0.8f + 0.2f);
+            p.y = sample_point_at(&scene->terrain, p.x, p.z) + scale.x;
+            glm::vec3 rot(comp(rng)*two_pi, 0.0f, 0.0f);
+            auto local_to_world = get_component(world, snowmen[i], Local_To_World);
+            local_to_world->m = euler_trs_transform(p, rot, scale);
+        }
     }
 
-    // Create lamp posts
-    for (int i = 0; i < MAX_POINT_LIGHTS; i++) {
-        auto p = glm::vec3(50.0f + 20.0f*i, 0.0f, 45.0f);
-        p.y = sample_point_at(&scene->terrain, p.x, p.z) - 0.2f;
+    // Create lamp posts, one for each point light
+    {
+        const glm::vec3 lamp_post_scale(0.4f, 1.0f, 0.4f);
         auto lamp_post_base = spawn_static_mesh_entity(world, "Lamp Post",
                                                        metal_material, mesh_cylinder, NULL,
-                                                       p, glm::vec3(0.0f), glm::vec3(0.4f, 1.0f, 0.4f));
+                                                       glm::vec3(0.0f), glm::vec3(0.0f), lamp_post_scale);
         spawn_static_mesh_entity(world, "Lamp Post Transition 1", metal_material,
                                  mesh_conical_frustum, &lamp_post_base,
                                  glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f), glm::vec3(1.0f, 0.1f, 1.0f));
@@ -424,19 +473,34 @@ initialize_scene(Simple_World_Scene* scene, Window* window) {
                                  glm::vec3(0.0f, pi+0.08f, 0.0f),
                                  glm::vec3(0.4f, 8.0f, 0.1f));
 
-        world->renderer.point_lights[i].position  = glm::vec3(p.x, p.y + 5.2f, p.z);
-        world->renderer.point_lights[i].constant  = 0.3f;
-        world->renderer.point_lights[i].linear    = 0.09f;
-        world->renderer.point_lights[i].quadratic = 0.032f;
-        world->renderer.point_lights[i].ambient   = glm::vec3(0.1f, 0.1f, 0.1f);
-        world->renderer.point_lights[i].diffuse   = glm::vec3(1.0f, 1.0f, 1.0f);
-        world->renderer.point_lights[i].specular  = glm::vec3(1.0f, 1.0f, 1.0f);
+        Entity_Handle lamp_posts[MAX_POINT_LIGHTS];
+        lamp_posts[0] = lamp_post_base;
+        Prefab lamp_post_prefab = make_prefab(world, lamp_post_base);
+        instantiate_prefab(world, &lamp_post_prefab, MAX_POINT_LIGHTS - 1, &lamp_posts[1]);
+        destroy_prefab(&lamp_post_prefab);
+
+        for (int i = 0; i < MAX_POINT_LIGHTS; i++) {
+            auto p = glm::vec3(50.0f + 20.0f*i, 0.0f, 45.0f);
+            p.y = sample_point_at(&scene->terrain, p.x, p.z) - 0.2f;
+            auto local_to_world = get_component(world, lamp_posts[i], Local_To_World);
+            local_to_world->m = euler_trs_transform(p, glm::vec3(0.0f), lamp_post_scale);
+
+            world->renderer.point_lights[i].position  = glm::vec3(p.x, p.y + 5.2f, p.z);
+            world->renderer.point_lights[i].constant  = 0.3f;
+            world->renderer.point_lights[i].linear    = 0.09f;
+            world->renderer.point_lights[i].quadratic = 0.032f;
+            world->renderer.point_lights[i].ambient   = glm::vec3(0.1f, 0.1f, 0.1f);
+            world->renderer.point_lights[i].diffuse   = glm::vec3(1.0f, 1.0f, 1.0f);
+            world->renderer.point_lights[i].specular  = glm::vec3(1.0f, 1.0f, 1.0f);
+        }
     }
 
     // Setup main systems
     System controller = {};
+    controller.name = "player_controller_system";
     controller.on_update = &player_controller_system;
-    use_component(controller, Player_Controller);
+    controller.flags = System::Flag_Main_Thread; // NOTE(alexander): toggles mouse locking on the input
+    use_component(controller, Player_Controller, System::Flag_Read_Only);
     use_component(controller, Position);
     use_component(controller, Euler_Rotation);
     push_system(scene->main_systems, controller);
@@ -444,6 +508,7 @@ initialize_scene(Simple_World_Scene* scene, Window* window) {
     push_hierarchical_transform_systems(scene->main_systems);
 
     push_camera_systems(scene->main_systems);
+    scene->main_schedule = build_system_schedule(&scene->main_systems);
 
     // Setup rendering pipeline
     push_mesh_renderer_system(scene->rendering_pipeline, &scene->player_camera);
@@ -464,6 +529,14 @@ render_scene(Simple_World_Scene* scene, Window* window, float dt) {
 
     World* world = &scene->world;
 
+    // NOTE(alexander): the world may have been replaced by a snapshot loaded in the world editor
+    if (!is_alive(world, scene->player) || !has_component(world, scene->player, Player_Controller)) {
+        world_query<Entity_Handle, const Player_Controller>(world, [scene](Entity_Handle entity, const Player_Controller& pc) {
+            scene->player = entity;
+            scene->player_camera = pc.camera;
+        });
+    }
+
     // Render the world
     auto camera = get_component(world, scene->player_camera, Camera);
     begin_frame(world->renderer.fog_color, camera->viewport, true, &scene->world.renderer);
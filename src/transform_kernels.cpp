@@ -0,0 +1,275 @@
+
+/***************************************************************************
+ * Transform kernels
+ * Builds translation * rotation * scale matrices for many entities at once,
+ * the affine transform is written straight from the quaternion, translation
+ * and scale without multiplying any intermediate matrices. On x64 the kernel uses
+ * AVX2 (8 matrices at a time) or SSE (4 at a time) depending on what the
+ * cpu supports, which is checked once at startup, otherwise a scalar loop.
+ ***************************************************************************/
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TRS_KERNEL_X64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define TRS_KERNEL_X64 0
+#endif
+
+#if TRS_KERNEL_X64 && !defined(_MSC_VER)
+// NOTE(alexander): gcc and clang only allow AVX2 intrinsics in functions compiled for it, msvc always does
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+// NOTE(alexander): the kernels writes arrays of these as arrays of affine transforms
+static_assert(sizeof(Local_To_World) == sizeof(Affine_Transform), "Local_To_World must only contain the transform");
+static_assert(sizeof(Local_To_Parent) == sizeof(Affine_Transform), "Local_To_Parent must only contain the transform");
+
+/**
+ * Writes count transforms to out, missing components are NULL and use the
+ * defaults i.e. no translation, no rotation and a scale of one.
+ */
+typedef void (*Trs_Kernel)(Affine_Transform* out, const Position* pos, const Rotation* rot, const Scale* scl, u32 count);
+
+// NOTE(alexander): same as glm::translate(pos) * glm::toMat4(rot) * glm::scale(scl)
+static inline void
+compute_trs_matrix(Affine_Transform* out, const glm::vec3& p, const glm::quat& q, const glm::vec3& s) {
+    f32 xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+    f32 xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+    f32 wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+    out->rows[0] = glm::vec4((1.0f - 2.0f*(yy + zz))*s.x, 2.0f*(xy - wz)*s.y, 2.0f*(xz + wy)*s.z, p.x);
+    out->rows[1] = glm::vec4(2.0f*(xy + wz)*s.x, (1.0f - 2.0f*(xx + zz))*s.y, 2.0f*(yz - wx)*s.z, p.y);
+    out->rows[2] = glm::vec4(2.0f*(xz - wy)*s.x, 2.0f*(yz + wx)*s.y, (1.0f - 2.0f*(xx + yy))*s.z, p.z);
+}
+
+static void
+trs_kernel_scalar(Affine_Transform* out, const Position* pos, const Rotation* rot, const Scale* scl, u32 count) {
+    const glm::vec3 zero(0.0f);
+    const glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+    const glm::vec3 one(1.0f);
+    for (u32 i = 0; i < count; i++) {
+        compute_trs_matrix(out + i, pos ? pos[i].v : zero, rot ? rot[i].q : identity, scl ? scl[i].v : one);
+    }
+}
+
+#if TRS_KERNEL_X64
+
+static constexpr u32 position_stride = sizeof(Position)/sizeof(f32);
+static constexpr u32 rotation_stride = sizeof(Rotation)/sizeof(f32);
+static constexpr u32 scale_stride = sizeof(Scale)/sizeof(f32);
+
+/***************************************************************************
+ * SSE kernel, 4 matrices at a time
+ ***************************************************************************/
+
+// NOTE(alexander): loads one field of 4 consecutive components, e.g. the x of 4 positions
+static inline __m128
+load_strided4(const f32* field, u32 stride, f32 default_value) {
+    if (!field) return _mm_set1_ps(default_value);
+    return _mm_setr_ps(field[0], field[stride], field[2*stride], field[3*stride]);
+}
+
+// NOTE(alexander): the lanes of x, y, z, w holds the same row of 4 different transforms
+static inline void
+store_transform_rows4(Affine_Transform* out, int row, __m128 x, __m128 y, __m128 z, __m128 w) {
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(&out[0].rows[row][0], x);
+    _mm_storeu_ps(&out[1].rows[row][0], y);
+    _mm_storeu_ps(&out[2].rows[row][0], z);
+    _mm_storeu_ps(&out[3].rows[row][0], w);
+}
+
+static void
+trs_kernel_sse(Affine_Transform* out, const Position* pos, const Rotation* rot, const Scale* scl, u32 count) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = load_strided4(pos ? &pos[i].v.x : NULL, position_stride, 0.0f);
+        __m128 py = load_strided4(pos ? &pos[i].v.y : NULL, position_stride, 0.0f);
+        __m128 pz = load_strided4(pos ? &pos[i].v.z : NULL, position_stride, 0.0f);
+        __m128 qx = load_strided4(rot ? &rot[i].q.x : NULL, rotation_stride, 0.0f);
+        __m128 qy = load_strided4(rot ? &rot[i].q.y : NULL, rotation_stride, 0.0f);
+        __m128 qz = load_strided4(rot ? &rot[i].q.z : NULL, rotation_stride, 0.0f);
+        __m128 qw = load_strided4(rot ? &rot[i].q.w : NULL, rotation_stride, 1.0f);
+        __m128 sx = load_strided4(scl ? &scl[i].v.x : NULL, scale_stride, 1.0f);
+        __m128 sy = load_strided4(scl ? &scl[i].v.y : NULL, scale_stride, 1.0f);
+        __m128 sz = load_strided4(scl ? &scl[i].v.z : NULL, scale_stride, 1.0f);
+
+        __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+        __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+        __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+        __m128 m00 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+        __m128 m01 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+        __m128 m02 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+        __m128 m10 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+        __m128 m11 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+        __m128 m12 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+        __m128 m20 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+        __m128 m21 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+        __m128 m22 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+
+        store_transform_rows4(out + i, 0, m00, m10, m20, px);
+        store_transform_rows4(out + i, 1, m01, m11, m21, py);
+        store_transform_rows4(out + i, 2, m02, m12, m22, pz);
+    }
+
+    trs_kernel_scalar(out + i, pos ? pos + i : NULL, rot ? rot + i : NULL, scl ? scl + i : NULL, count - i);
+}
+
+/***************************************************************************
+ * AVX2 kernel, 8 matrices at a time
+ ***************************************************************************/
+
+TARGET_AVX2 static inline __m256
+load_strided8(const f32* field, u32 stride, f32 default_value) {
+    if (!field) return _mm256_set1_ps(default_value);
+    __m256i indices = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int) stride));
+    return _mm256_i32gather_ps(field, indices, sizeof(f32));
+}
+
+/**
+ * The lanes of x, y, z, w holds the same row of 8 different transforms,
+ * each 128-bit half is transposed separately so transform k and k + 4 ends up in the same register.
+ */
+TARGET_AVX2 static inline void
+store_transform_rows8(Affine_Transform* out, int row, __m256 x, __m256 y, __m256 z, __m256 w) {
+    __m256 xy_lo = _mm256_unpacklo_ps(x, y); // x0 y0 x1 y1 | x4 y4 x5 y5
+    __m256 xy_hi = _mm256_unpackhi_ps(x, y); // x2 y2 x3 y3 | x6 y6 x7 y7
+    __m256 zw_lo = _mm256_unpacklo_ps(z, w);
+    __m256 zw_hi = _mm256_unpackhi_ps(z, w);
+    __m256 c04 = _mm256_shuffle_ps(xy_lo, zw_lo, _MM_SHUFFLE(1, 0, 1, 0)); // x0 y0 z0 w0 | x4 y4 z4 w4
+    __m256 c15 = _mm256_shuffle_ps(xy_lo, zw_lo, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 c26 = _mm256_shuffle_ps(xy_hi, zw_hi, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 c37 = _mm256_shuffle_ps(xy_hi, zw_hi, _MM_SHUFFLE(3, 2, 3, 2));
+
+    _mm_storeu_ps(&out[0].rows[row][0], _mm256_castps256_ps128(c04));
+    _mm_storeu_ps(&out[1].rows[row][0], _mm256_castps256_ps128(c15));
+    _mm_storeu_ps(&out[2].rows[row][0], _mm256_castps256_ps128(c26));
+    _mm_storeu_ps(&out[3].rows[row][0], _mm256_castps256_ps128(c37));
+    _mm_storeu_ps(&out[4].rows[row][0], _mm256_extractf128_ps(c04, 1));
+    _mm_storeu_ps(&out[5].rows[row][0], _mm256_extractf128_ps(c15, 1));
+    _mm_storeu_ps(&out[6].rows[row][0], _mm256_extractf128_ps(c26, 1));
+    _mm_storeu_ps(&out[7].rows[row][0], _mm256_extractf128_ps(c37, 1));
+}
+
+TARGET_AVX2 static void
+trs_kernel_avx2(Affine_Transform* out, const Position* pos, const Rotation* rot, const Scale* scl, u32 count) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = load_strided8(pos ? &pos[i].v.x : NULL, position_stride, 0.0f);
+        __m256 py = load_strided8(pos ? &pos[i].v.y : NULL, position_stride, 0.0f);
+        __m256 pz = load_strided8(pos ? &pos[i].v.z : NULL, position_stride, 0.0f);
+        __m256 qx = load_strided8(rot ? &rot[i].q.x : NULL, rotation_stride, 0.0f);
+        __m256 qy = load_strided8(rot ? &rot[i].q.y : NULL, rotation_stride, 0.0f);
+        __m256 qz = load_strided8(rot ? &rot[i].q.z : NULL, rotation_stride, 0.0f);
+        __m256 qw = load_strided8(rot ? &rot[i].q.w : NULL, rotation_stride, 1.0f);
+        __m256 sx = load_strided8(scl ? &scl[i].v.x : NULL, scale_stride, 1.0f);
+        __m256 sy = load_strided8(scl ? &scl[i].v.y : NULL, scale_stride, 1.0f);
+        __m256 sz = load_strided8(scl ? &scl[i].v.z : NULL, scale_stride, 1.0f);
+
+        __m256 xx = _mm256_mul_ps(qx, qx), yy = _mm256_mul_ps(qy, qy), zz = _mm256_mul_ps(qz, qz);
+        __m256 xy = _mm256_mul_ps(qx, qy), xz = _mm256_mul_ps(qx, qz), yz = _mm256_mul_ps(qy, qz);
+        __m256 wx = _mm256_mul_ps(qw, qx), wy = _mm256_mul_ps(qw, qy), wz = _mm256_mul_ps(qw, qz);
+
+        // NOTE(alexander): diagonal is (1 - 2*(a + b))*s, computed as fnmadd(2, a + b, 1)*s
+        __m256 m00 = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+        __m256 m01 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+        __m256 m02 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+        __m256 m10 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+        __m256 m11 = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+        __m256 m12 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+        __m256 m20 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+        __m256 m21 = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+        __m256 m22 = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+
+        store_transform_rows8(out + i, 0, m00, m10, m20, px);
+        store_transform_rows8(out + i, 1, m01, m11, m21, py);
+        store_transform_rows8(out + i, 2, m02, m12, m22, pz);
+    }
+
+    trs_kernel_sse(out + i, pos ? pos + i : NULL, rot ? rot + i : NULL, scl ? scl + i : NULL, count - i);
+}
+
+static bool
+cpu_supports_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool has_fma = (info[2] & (1 << 12)) != 0;
+    bool has_os_xsave = (info[2] & (1 << 27)) != 0;
+    bool has_avx = (info[2] & (1 << 28)) != 0;
+    if (!has_fma || !has_os_xsave || !has_avx) return false;
+    if ((_xgetbv(0) & 6) != 6) return false; // NOTE(alexander): the os has to save the ymm registers
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init(); // NOTE(alexander): may run before the constructor that normally does this
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif
+
+struct Trs_Kernel_Info {
+    const char* name;
+    Trs_Kernel kernel;
+};
+
+static const Trs_Kernel_Info trs_kernels[] = {
+    { "scalar", &trs_kernel_scalar },
+#if TRS_KERNEL_X64
+    { "sse",    &trs_kernel_sse },
+    { "avx2",   &trs_kernel_avx2 },
+#endif
+};
+
+static const Trs_Kernel_Info*
+find_best_trs_kernel() {
+#if TRS_KERNEL_X64
+    // NOTE(alexander): SSE2 is always available on x64
+    return cpu_supports_avx2() ? &trs_kernels[2] : &trs_kernels[1];
+#else
+    return &trs_kernels[0];
+#endif
+}
+
+// NOTE(alexander): the kernel used by the transform systems, see set_trs_kernel
+static const Trs_Kernel_Info* current_trs_kernel = find_best_trs_kernel();
+
+static inline void
+compute_trs_matrices(Affine_Transform* out, const Position* pos, const Rotation* rot, const Scale* scl, u32 count) {
+    current_trs_kernel->kernel(out, pos, rot, scl, count);
+}
+
+const char*
+get_trs_kernel_name() {
+    return current_trs_kernel->name;
+}
+
+/**
+ * Overrides the kernel chosen at startup, e.g. to compare them in benchmarks.
+ * Returns false if the kernel doesn't exist or isn't supported by this cpu.
+ */
+bool
+set_trs_kernel(const char* name) {
+    for (int i = 0; i < array_count(trs_kernels); i++) {
+        if (strcmp(trs_kernels[i].name, name) != 0) continue;
+#if TRS_KERNEL_X64
+        if (trs_kernels[i].kernel == &trs_kernel_avx2 && !cpu_supports_avx2()) return false;
+#endif
+        current_trs_kernel = &trs_kernels[i];
+        return true;
+    }
+    return false;
+}
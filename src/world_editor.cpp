@@ -3,9 +3,12 @@ static constexpr char* default_entity_name = "Entity";
 
 struct World_Editor {
     World* world;
+    Snapshot_Assets* assets; // used to resolve references when saving and loading the world
+    char snapshot_path[256];
     Entity_Handle editor_camera;
     Entity_Handle selected;
     std::vector<System> main_systems;
+    System_Schedule main_schedule;
     std::vector<System> rendering_pipeline;
 
     ImGuizmo::OPERATION guizmo_operation;
@@ -25,6 +28,16 @@ struct Editor_Camera_Controller {
 
 REGISTER_COMPONENT(Editor_Camera_Controller);
 
+static void
+snapshot_editor_camera_controller(Snapshot_Fixup* fixup, void* dst, const void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        snapshot_pointer(fixup, &((Editor_Camera_Controller*) dst)[i].input,
+                         &((const Editor_Camera_Controller*) src)[i].input);
+    }
+}
+
+REGISTER_SNAPSHOT_FUNCTION(Editor_Camera_Controller, snapshot_editor_camera_controller);
+
 DEF_SYSTEM(editor_camera_controller_system) {
     auto controller = (Editor_Camera_Controller*) components[0];
     auto pos = (Position*) components[1];
@@ -75,9 +88,8 @@ DEF_SYSTEM(editor_camera_controller_system) {
     if (input->d_key.ended_down) pos->v -= right * speed;
 }
 
-bool
-initialize_world_editor(World_Editor* editor, Window* window) {
-    assert(editor->world);
+static void
+spawn_editor_camera(World_Editor* editor, Window* window) {
     Entity_Handle editor_camera = spawn_entity(editor->world);
     editor->editor_camera = editor_camera;
     auto camera = add_component(editor->world, editor_camera, Camera);
@@ -94,20 +106,29 @@ initialize_world_editor(World_Editor* editor, Window* window) {
     pos->v = glm::vec3(50.0f, 5.0f, 50.0f);
     add_component(editor->world, editor_camera, Rotation);
     add_component(editor->world, editor_camera, Euler_Rotation);
+}
+
+bool
+initialize_world_editor(World_Editor* editor, Window* window) {
+    assert(editor->world);
+    spawn_editor_camera(editor, window);
+    snprintf(editor->snapshot_path, sizeof(editor->snapshot_path), "%sworld.snapshot", get_resource_folder());
 
     editor->guizmo_operation = ImGuizmo::TRANSLATE;
     editor->guizmo_mode = ImGuizmo::WORLD;
 
     // Setup main systems
     System controller = {};
+    controller.name = "editor_camera_controller_system";
     controller.on_update = &editor_camera_controller_system;
-    use_component(controller, Editor_Camera_Controller);
+    use_component(controller, Editor_Camera_Controller, System::Flag_Read_Only);
     use_component(controller, Position);
     use_component(controller, Euler_Rotation);
     push_system(editor->main_systems, controller);
 
     push_hierarchical_transform_systems(editor->main_systems);
     push_camera_systems(editor->main_systems);
+    editor->main_schedule = build_system_schedule(&editor->main_systems);
 
     // Setup rendering pipeline
     push_mesh_renderer_system(editor->rendering_pipeline, &editor->editor_camera);
@@ -125,32 +146,40 @@ update_world_editor(World_Editor* editor, Window* window, f32 dt) {
         }
     }
 
-    update_systems(editor->world, editor->main_systems, dt);
+    update_systems(editor->world, &editor->main_schedule, dt);
 };
 
 void
 edit_transform(World_Editor* editor, World* world, Camera* camera, Entity* entity) {
-    auto local_to_world = get_component(world, entity->handle, Local_To_World);
-    auto local_to_parent = get_component(world, entity->handle, Local_To_Parent);
-    if (!local_to_world) return;
-
-    ImGuizmo::BeginFrame();
-
-    glm::mat4 world_matrix = local_to_world->m;
-    glm::mat4 local_matrix = local_to_parent ? local_to_parent->m : local_to_world->m;
+    if (!_has_component(world, entity, Local_To_World_ID)) return;
 
     auto pos = get_component(world, entity->handle, Position);
     auto rot = get_component(world, entity->handle, Rotation);
     auto euler_rot = get_component(world, entity->handle, Euler_Rotation);
     auto scl = get_component(world, entity->handle, Scale);
 
+    // NOTE(alexander): adding components moves the entity to another archetype,
+    // so all the component pointers are fetched after this.
     if (pos != NULL || rot != NULL || scl != NULL) {
-        if (!pos) pos = add_component(world, entity->handle, Position);
-        if (!rot) rot = add_component(world, entity->handle, Rotation);
-        if (!euler_rot) euler_rot = add_component(world, entity->handle, Euler_Rotation);
-        if (!scl) scl = add_component(world, entity->handle, Scale);
+        if (!pos) add_component(world, entity->handle, Position);
+        if (!rot) add_component(world, entity->handle, Rotation);
+        if (!euler_rot) add_component(world, entity->handle, Euler_Rotation);
+        if (!scl) add_component(world, entity->handle, Scale);
+        pos = get_component(world, entity->handle, Position);
+        rot = get_component(world, entity->handle, Rotation);
+        euler_rot = get_component(world, entity->handle, Euler_Rotation);
+        scl = get_component(world, entity->handle, Scale);
     }
 
+    auto local_to_world = get_component(world, entity->handle, Local_To_World);
+    auto local_to_parent = get_component(world, entity->handle, Local_To_Parent);
+
+    ImGuizmo::BeginFrame();
+
+    // NOTE(alexander): ImGuizmo works on 4x4 matrices, the results are converted back before storing them
+    glm::mat4 world_matrix = affine_to_mat4(local_to_world->m);
+    glm::mat4 local_matrix = local_to_parent ? affine_to_mat4(local_to_parent->m) : world_matrix;
+
     if (ImGui::IsKeyPressed(90)) editor->guizmo_operation = ImGuizmo::TRANSLATE;
     if (ImGui::IsKeyPressed(69)) editor->guizmo_operation = ImGuizmo::ROTATE;
     if (ImGui::IsKeyPressed(82)) editor->guizmo_operation = ImGuizmo::SCALE;
@@ -205,9 +234,9 @@ edit_transform(World_Editor* editor, World* world, Camera* camera, Entity* entit
             if (scl) scl->v = scale;
 
             if (local_to_parent) {
-                local_to_parent->m = matrix;
+                local_to_parent->m = affine_from_mat4(matrix);
             } else {
-                local_to_world->m = matrix;
+                local_to_world->m = affine_from_mat4(matrix);
             }
         } else if (editor->guizmo_mode == ImGuizmo::WORLD) {
             glm::vec3 local_position, local_rotation, local_scale;
@@ -228,9 +257,9 @@ edit_transform(World_Editor* editor, World* world, Camera* camera, Entity* entit
             if (scl) scl->v = local_scale;
 
             if (local_to_parent) {
-                local_to_parent->m = local_matrix;
+                local_to_parent->m = affine_from_mat4(local_matrix);
             } else {
-                local_to_world->m = matrix;
+                local_to_world->m = affine_from_mat4(matrix);
             }
         }
     }
@@ -249,17 +278,18 @@ edit_transform(World_Editor* editor, World* world, Camera* camera, Entity* entit
     if (is_dirty) {
         if (local_to_parent) {
             // NOTE(alexander): conversion from world space to local space.
-            glm::mat4 inv_parent_world;
-            auto parent = (Parent*) _get_component(world, entity, Parent_ID, Parent_SIZE);
-            if (parent) {
-                auto parent_local_to_world = get_component(world, parent->handle, Local_To_World);
+            Affine_Transform inv_parent_world = affine_identity();
+            Entity_Handle parent = get_parent(world, entity->handle);
+            if (parent != null_entity_handle) {
+                auto parent_local_to_world = get_component(world, parent, Local_To_World);
                 if (parent_local_to_world) {
-                    inv_parent_world = glm::inverse(parent_local_to_world->m);
+                    inv_parent_world = affine_inverse(parent_local_to_world->m);
                 }
             }
             
             // Changes the local or world matrix 
-            glm::mat4 new_local_matrix = inv_parent_world * matrix;
+            Affine_Transform new_local_transform = affine_multiply(inv_parent_world, affine_from_mat4(matrix));
+            glm::mat4 new_local_matrix = affine_to_mat4(new_local_transform);
             ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(new_local_matrix),
                                                   glm::value_ptr(position),
                                                   glm::value_ptr(rotation),
@@ -269,7 +299,7 @@ edit_transform(World_Editor* editor, World* world, Camera* camera, Entity* entit
             if (pos) pos->v = position;
             if (euler_rot) euler_rot->v = rotation;
             if (scl) scl->v = scale;
-            local_to_parent->m = new_local_matrix;
+            local_to_parent->m = new_local_transform;
         } else {
             // Changes always the world matrix 
             ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(matrix),
@@ -280,17 +310,17 @@ edit_transform(World_Editor* editor, World* world, Camera* camera, Entity* entit
             if (pos) pos->v = position;
             if (euler_rot) euler_rot->v = rotation;
             if (scl) scl->v = scale;
-            local_to_world->m = matrix;
+            local_to_world->m = affine_from_mat4(matrix);
         }
     }
 }
 
 void
 build_entity_hierarchy(World_Editor* editor, World* world, Entity* entity) {
-    auto child = (Child*) _get_component(world, entity, Child_ID, Child_SIZE);
+    Entity_Handle first_child = get_first_child(world, entity->handle);
     auto debug_name = (Debug_Name*) _get_component(world, entity, Debug_Name_ID, Debug_Name_SIZE);
     auto entity_name = debug_name ? debug_name->s.c_str() : default_entity_name;
-    auto node_flags = child ? ImGuiTreeNodeFlags_OpenOnArrow | ImGuiTreeNodeFlags_OpenOnDoubleClick
+    auto node_flags = first_child != null_entity_handle ? ImGuiTreeNodeFlags_OpenOnArrow | ImGuiTreeNodeFlags_OpenOnDoubleClick
         : ImGuiTreeNodeFlags_Leaf;
     
     bool is_open = ImGui::TreeNodeEx((void*) entity->handle.id, node_flags, entity_name);
@@ -300,18 +330,31 @@ build_entity_hierarchy(World_Editor* editor, World* world, Entity* entity) {
     }
 
     if (is_open) {
-        for (auto component : entity->components) {
-            if (component.id == Child_ID) {
-                std::vector<u8>& memory = world->components[Child_ID];
-                child = (Child*) &memory[component.offset];
-                Entity* child_entity = get_entity(world, child->handle);
-                build_entity_hierarchy(editor, world, child_entity);
-            }
+        Entity_Handle child_handle = first_child;
+        while (child_handle != null_entity_handle) {
+            build_entity_hierarchy(editor, world, get_entity(world, child_handle));
+            child_handle = get_next_sibling(world, child_handle);
         }
         ImGui::TreePop();
     }
 }
 
+static void
+load_world_editor_snapshot(World_Editor* editor, Window* window) {
+    World* world = editor->world;
+    if (!load_world_snapshot(world, editor->snapshot_path, editor->assets)) return;
+
+    // NOTE(alexander): the handles from before are no longer valid, find the camera in the loaded world
+    editor->selected = null_entity_handle;
+    editor->editor_camera = null_entity_handle;
+    world_query<Entity_Handle, const Editor_Camera_Controller>(world, [editor](Entity_Handle entity, const Editor_Camera_Controller&) {
+        editor->editor_camera = entity;
+    });
+    if (editor->editor_camera == null_entity_handle) {
+        spawn_editor_camera(editor, window);
+    }
+}
+
 void
 render_world_editor(World_Editor* editor, Window* window, f32 dt) {
     World* world = editor->world;
@@ -323,10 +366,22 @@ render_world_editor(World_Editor* editor, Window* window, f32 dt) {
     end_frame();
 
     ImGui::Begin("Hierarchy", &editor->show_hierarchy);
+    ImGui::InputText("##snapshot_path", editor->snapshot_path, sizeof(editor->snapshot_path));
+    ImGui::SameLine();
+    if (ImGui::Button("Save")) {
+        save_world_snapshot(world, editor->snapshot_path, editor->assets);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Load")) {
+        load_world_editor_snapshot(editor, window);
+        camera = get_component(world, editor->editor_camera, Camera);
+    }
+    ImGui::Separator();
+
     for (u32 i = 0; i < world->entities.size(); i++) {
         Entity* entity = &world->entities[i];
         if (is_alive(world, entity->handle)) {
-            if (_get_component(world, entity, Parent_ID, Parent_SIZE)) {
+            if (get_parent(world, entity->handle) != null_entity_handle) {
                 continue; // Gets added by its parent instead
             }
 
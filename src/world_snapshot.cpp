@@ -0,0 +1,664 @@
+
+/***************************************************************************
+ * World snapshot
+ * Binary copy of the entity storage that is loaded by memory mapping the file,
+ * the chunks are adopted by the chunk pool as is so nothing has to be parsed
+ * or allocated per entity. Pointers in components e.g. textures and meshes are
+ * stored as references to named assets and fixed up when loading, see Snapshot_Assets.
+ * The exception is Debug_Name, see snapshot_string.
+ *
+ * +--------+--------------------------+------------+-------------+-----+---------+
+ * | header | chunks (aligned to page) | components | generations | ... | strings |
+ * +--------+--------------------------+------------+-------------+-----+---------+
+ ***************************************************************************/
+
+static constexpr u32 snapshot_magic = 0x4E535753; // "SWSN"
+static constexpr u32 snapshot_version = 3;
+static constexpr usize max_snapshot_component_name = 48;
+
+struct Snapshot_Section {
+    u64 offset; // in bytes from the beginning of the file
+    u64 count; // number of elements
+};
+
+struct Snapshot_Header {
+    u32 magic;
+    u32 version;
+    u32 chunk_size;
+    u32 chunks_per_page;
+    u32 column_alignment;
+    u32 num_chunks;
+
+    Snapshot_Section chunks;
+    Snapshot_Section components; // Snapshot_Component indexed by component id
+    Snapshot_Section generations;
+    Snapshot_Section removed_entity_indices;
+    Snapshot_Section entities;
+    Snapshot_Section handles;
+    Snapshot_Section archetypes;
+    Snapshot_Section chunk_counts; // number of entities in each chunk
+    Snapshot_Section hierarchy_depths;
+    Snapshot_Section hierarchy_indices;
+    Snapshot_Section hierarchy_levels;
+    Snapshot_Section hierarchy_entities; // entities of every level after each other
+    Snapshot_Section hierarchy_parents;
+    Snapshot_Section hierarchy_nodes;
+    Snapshot_Section assets;
+    Snapshot_Section strings;
+};
+
+struct Snapshot_Component {
+    char name[max_snapshot_component_name]; // empty if no component has this id
+    u32 size;
+    u32 alignment;
+};
+
+struct Snapshot_Archetype {
+    Component_Mask component_mask;
+    u32 first_chunk;
+    u32 num_chunks;
+};
+
+struct Snapshot_Level {
+    u32 first;
+    u32 count;
+};
+
+enum Snapshot_Asset_Type {
+    Snapshot_Asset_Pointer,
+    Snapshot_Asset_Mesh,
+};
+
+struct Snapshot_Asset {
+    u32 type;
+    u32 name; // offset into the strings
+};
+
+/**
+ * Named assets that components may refer to, registered by the scene before saving
+ * or loading. References are stored by name so they are valid in the next run even
+ * though the pointers and OpenGL handles are not.
+ */
+struct Snapshot_Assets {
+    std::vector<std::string> pointer_names;
+    std::vector<void*> pointers;
+    std::vector<std::string> mesh_names;
+    std::vector<Mesh> meshes;
+};
+
+// NOTE(alexander): passed to the components snapshot function, see REGISTER_SNAPSHOT_FUNCTION
+struct Snapshot_Fixup {
+    Snapshot_Assets* assets;
+    bool is_loading;
+
+    // Saving
+    std::vector<Snapshot_Asset> file_assets;
+    std::vector<char> strings;
+    std::unordered_map<u64, u32> asset_references; // (type, index) to file asset index + 1
+
+    // Loading
+    std::vector<i32> asset_remap; // file asset to index in assets, -1 if missing
+};
+
+void
+add_snapshot_pointer(Snapshot_Assets* assets, const char* name, void* pointer) {
+    assets->pointer_names.push_back(std::string(name));
+    assets->pointers.push_back(pointer);
+}
+
+void
+add_snapshot_mesh(Snapshot_Assets* assets, const char* name, const Mesh& mesh) {
+    assets->mesh_names.push_back(std::string(name));
+    assets->meshes.push_back(mesh);
+}
+
+static u32
+push_snapshot_string(Snapshot_Fixup* fixup, const char* string) {
+    u32 offset = (u32) fixup->strings.size();
+    fixup->strings.insert(fixup->strings.end(), string, string + strlen(string) + 1);
+    return offset;
+}
+
+// NOTE(alexander): returns the reference stored in the file, 0 means no asset
+static u32
+get_snapshot_reference(Snapshot_Fixup* fixup, Snapshot_Asset_Type type, i32 index) {
+    if (index < 0) return 0;
+
+    u64 key = ((u64) type << 32) | (u32) index;
+    auto it = fixup->asset_references.find(key);
+    if (it != fixup->asset_references.end()) {
+        return it->second;
+    }
+
+    Snapshot_Asset asset;
+    asset.type = type;
+    const std::string& name = type == Snapshot_Asset_Mesh ? fixup->assets->mesh_names[index]
+                                                           : fixup->assets->pointer_names[index];
+    asset.name = push_snapshot_string(fixup, name.c_str());
+    fixup->file_assets.push_back(asset);
+
+    u32 reference = (u32) fixup->file_assets.size();
+    fixup->asset_references[key] = reference;
+    return reference;
+}
+
+/**
+ * Converts the pointer to a reference when saving and back to the pointer of the
+ * asset with the same name when loading. Pointers to unknown assets becomes NULL.
+ */
+template <typename T>
+void
+snapshot_pointer(Snapshot_Fixup* fixup, T** dst, T* const* src) {
+    if (fixup->is_loading) {
+        u64 reference = *(u64*) dst;
+        i32 index = reference > 0 && reference <= fixup->asset_remap.size() ? fixup->asset_remap[reference - 1] : -1;
+        *dst = index >= 0 ? (T*) fixup->assets->pointers[index] : NULL;
+        return;
+    }
+
+    i32 index = -1;
+    if (*src) {
+        for (u32 i = 0; i < fixup->assets->pointers.size(); i++) {
+            if (fixup->assets->pointers[i] == (void*) *src) {
+                index = (i32) i;
+                break;
+            }
+        }
+    }
+    *(u64*) dst = get_snapshot_reference(fixup, Snapshot_Asset_Pointer, index);
+}
+
+// NOTE(alexander): meshes are identified by their id in the geometry arena, the reference is stored in first_index
+void
+snapshot_mesh(Snapshot_Fixup* fixup, Mesh* dst, const Mesh* src) {
+    if (fixup->is_loading) {
+        u32 reference = dst->first_index;
+        i32 index = reference > 0 && reference <= fixup->asset_remap.size() ? fixup->asset_remap[reference - 1] : -1;
+        *dst = index >= 0 ? fixup->assets->meshes[index] : Mesh {};
+        return;
+    }
+
+    i32 index = -1;
+    for (u32 i = 0; i < fixup->assets->meshes.size(); i++) {
+        const Mesh& mesh = fixup->assets->meshes[i];
+        if (mesh.id == src->id) {
+            index = (i32) i;
+            break;
+        }
+    }
+    *dst = {};
+    dst->first_index = get_snapshot_reference(fixup, Snapshot_Asset_Mesh, index);
+}
+
+// NOTE(alexander): the string is stored in the strings section and reconstructed when loading,
+// names longer than the small string buffer are allocated, one allocation per such entity.
+// Debug_Name is only for the editor so it stays a std::string rather than an offset into the file.
+void
+snapshot_string(Snapshot_Fixup* fixup, std::string* dst, const std::string* src) {
+    if (fixup->is_loading) {
+        u64 offset = *(u64*) dst;
+        new (dst) std::string(offset < fixup->strings.size() ? &fixup->strings[offset] : "");
+        return;
+    }
+
+    // NOTE(alexander): dst is a copy of the raw bytes, not a constructed string
+    memset((void*) dst, 0, sizeof(std::string));
+    *(u64*) dst = push_snapshot_string(fixup, src->c_str());
+}
+
+/***************************************************************************
+ * Snapshot functions of the common components
+ ***************************************************************************/
+
+static void
+snapshot_camera(Snapshot_Fixup* fixup, void* dst, const void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        snapshot_pointer(fixup, &((Camera*) dst)[i].window, &((const Camera*) src)[i].window);
+    }
+}
+
+static void
+snapshot_material(Snapshot_Fixup* fixup, Material* dst, const Material* src) {
+    dst->id = 0; // NOTE(alexander): only valid in the process that interned it, interned again when drawn
+    switch (src->type) {
+        case Material_Type_Basic: {
+            snapshot_pointer(fixup, &dst->Basic.shader, &src->Basic.shader);
+        } break;
+
+        case Material_Type_Phong: {
+            snapshot_pointer(fixup, &dst->Phong.shader, &src->Phong.shader);
+            snapshot_pointer(fixup, &dst->Phong.diffuse, &src->Phong.diffuse);
+            snapshot_pointer(fixup, &dst->Phong.specular, &src->Phong.specular);
+        } break;
+
+        case Material_Type_Sky: {
+            snapshot_pointer(fixup, &dst->Sky.shader, &src->Sky.shader);
+            snapshot_pointer(fixup, &dst->Sky.map, &src->Sky.map);
+        } break;
+
+        default: break;
+    }
+}
+
+static void
+snapshot_mesh_renderer(Snapshot_Fixup* fixup, void* dst, const void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        Mesh_Renderer* dst_renderer = (Mesh_Renderer*) dst + i;
+        const Mesh_Renderer* src_renderer = (const Mesh_Renderer*) src + i;
+        snapshot_mesh(fixup, &dst_renderer->mesh, &src_renderer->mesh);
+        snapshot_material(fixup, &dst_renderer->material, &src_renderer->material);
+    }
+}
+
+static void
+snapshot_debug_name(Snapshot_Fixup* fixup, void* dst, const void* src, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        snapshot_string(fixup, &((Debug_Name*) dst)[i].s, &((const Debug_Name*) src)[i].s);
+    }
+}
+
+REGISTER_SNAPSHOT_FUNCTION(Camera, snapshot_camera);
+REGISTER_SNAPSHOT_FUNCTION(Mesh_Renderer, snapshot_mesh_renderer);
+REGISTER_SNAPSHOT_FUNCTION(Debug_Name, snapshot_debug_name);
+
+/***************************************************************************
+ * Saving
+ ***************************************************************************/
+
+static bool
+write_snapshot_section(FILE* file, u64* offset, Snapshot_Section* section, const void* data, usize count, usize size) {
+    section->offset = *offset;
+    section->count = count;
+    if (count > 0 && fwrite(data, size, count, file) != count) {
+        return false;
+    }
+    *offset += count*size;
+    return true;
+}
+
+// NOTE(alexander): writes zeros until the file is end_offset bytes long
+static bool
+write_snapshot_zeros(FILE* file, u64* offset, u64 end_offset) {
+    static const u8 zeros[page_alignment] = {};
+    usize padding = (usize) (end_offset - *offset);
+    while (padding > 0) {
+        usize count = min(padding, sizeof(zeros));
+        if (fwrite(zeros, 1, count, file) != count) return false;
+        *offset += count;
+        padding -= count;
+    }
+    return true;
+}
+
+static bool
+write_snapshot_padding(FILE* file, u64* offset, usize alignment) {
+    return write_snapshot_zeros(file, offset, align_forward((usize) *offset, alignment));
+}
+
+/**
+ * Writes every entity, its components and the hierarchy to the file. Pointers in
+ * components has to be registered in assets, otherwise they are loaded as NULL.
+ * Returns false if the file couldn't be written or if some component is not trivial
+ * and has no snapshot function.
+ */
+bool
+save_world_snapshot(World* world, const char* filepath, Snapshot_Assets* assets) {
+    assert(world->structural_change_locks == 0 && "cannot save the world while systems are iterating");
+    assert(world->num_reserved_entities == 0 && "play back command buffers before saving the world");
+
+    for (u32 i = 0; i < world->archetypes.size(); i++) {
+        const Archetype& archetype = world->archetypes[i];
+        for (int k = 0; k < archetype.component_ids.size(); k++) {
+            const Component_Info& info = component_infos[archetype.component_ids[k]];
+            if (!info.is_trivial && !info.snapshot && archetype.chunks.size() > 0) {
+                printf("[Snapshot] cannot save component `%s`, it needs a snapshot function\n", info.name);
+                return false;
+            }
+        }
+    }
+
+    FILE* file = fopen(filepath, "wb");
+    if (!file) {
+        printf("[Snapshot] cannot open `%s` for writing\n", filepath);
+        return false;
+    }
+
+    Snapshot_Fixup fixup = {};
+    fixup.assets = assets;
+    fixup.is_loading = false;
+
+    Snapshot_Header header = {};
+    header.magic = snapshot_magic;
+    header.version = snapshot_version;
+    header.chunk_size = (u32) chunk_size;
+    header.chunks_per_page = (u32) chunks_per_page;
+    header.column_alignment = (u32) column_alignment;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    u64 offset = sizeof(header);
+
+    // NOTE(alexander): chunks are written as whole pages so they can be adopted by the chunk pool
+    ok = ok && write_snapshot_padding(file, &offset, page_alignment);
+    header.chunks.offset = offset;
+
+    std::vector<Snapshot_Archetype> archetypes(world->archetypes.size());
+    std::vector<u32> chunk_counts;
+    std::vector<u8> chunk_data(chunk_size);
+    for (u32 i = 0; i < world->archetypes.size() && ok; i++) {
+        const Archetype& archetype = world->archetypes[i];
+        archetypes[i].component_mask = archetype.component_mask;
+        archetypes[i].first_chunk = (u32) chunk_counts.size();
+        archetypes[i].num_chunks = (u32) archetype.chunks.size();
+
+        for (u32 c = 0; c < archetype.chunks.size() && ok; c++) {
+            const Chunk& chunk = archetype.chunks[c];
+            memcpy(chunk_data.data(), chunk.data, chunk_size);
+            for (int k = 0; k < archetype.component_ids.size(); k++) {
+                const Component_Info& info = component_infos[archetype.component_ids[k]];
+                if (info.snapshot) {
+                    u32 column_offset = archetype.column_offsets[k];
+                    info.snapshot(&fixup, chunk_data.data() + column_offset, chunk.data + column_offset, chunk.count);
+                }
+            }
+
+            ok = fwrite(chunk_data.data(), chunk_size, 1, file) == 1;
+            offset += chunk_size;
+            chunk_counts.push_back(chunk.count);
+        }
+    }
+    header.num_chunks = (u32) chunk_counts.size();
+    header.chunks.count = chunk_counts.size();
+    // NOTE(alexander): the last page is written in full, its unused chunks are adopted by the pool when loading
+    u64 chunks_end = header.chunks.offset + align_forward((usize) header.num_chunks, chunks_per_page)*chunk_size;
+    ok = ok && write_snapshot_zeros(file, &offset, chunks_end);
+
+    Snapshot_Component components[max_component_types] = {};
+    for (u32 id = 0; id < max_component_types; id++) {
+        const Component_Info& info = component_infos[id];
+        if (!info.name) continue;
+        assert(strlen(info.name) < max_snapshot_component_name && "component name is too long for snapshots");
+        strncpy(components[id].name, info.name, max_snapshot_component_name - 1);
+        components[id].size = info.size;
+        components[id].alignment = info.alignment;
+    }
+
+    std::vector<u32> removed_entity_indices(world->removed_entity_indices.begin(), world->removed_entity_indices.end());
+    std::vector<Snapshot_Level> levels(world->hierarchy.levels.size());
+    std::vector<Entity_Handle> level_entities;
+    std::vector<u32> level_parents;
+    for (u32 i = 0; i < levels.size(); i++) {
+        const Hierarchy_Level& level = world->hierarchy.levels[i];
+        levels[i].first = (u32) level_entities.size();
+        levels[i].count = (u32) level.entities.size();
+        level_entities.insert(level_entities.end(), level.entities.begin(), level.entities.end());
+        level_parents.insert(level_parents.end(), level.parents.begin(), level.parents.end());
+    }
+
+    ok = ok && write_snapshot_section(file, &offset, &header.components, components, max_component_types, sizeof(Snapshot_Component));
+    ok = ok && write_snapshot_section(file, &offset, &header.generations, world->generations.data(), world->generations.size(), sizeof(u8));
+    ok = ok && write_snapshot_padding(file, &offset, sizeof(u64));
+    ok = ok && write_snapshot_section(file, &offset, &header.removed_entity_indices, removed_entity_indices.data(), removed_entity_indices.size(), sizeof(u32));
+    ok = ok && write_snapshot_section(file, &offset, &header.entities, world->entities.data(), world->entities.size(), sizeof(Entity));
+    ok = ok && write_snapshot_section(file, &offset, &header.handles, world->handles.data(), world->handles.size(), sizeof(u32));
+    ok = ok && write_snapshot_padding(file, &offset, sizeof(u64));
+    ok = ok && write_snapshot_section(file, &offset, &header.archetypes, archetypes.data(), archetypes.size(), sizeof(Snapshot_Archetype));
+    ok = ok && write_snapshot_section(file, &offset, &header.chunk_counts, chunk_counts.data(), chunk_counts.size(), sizeof(u32));
+    ok = ok && write_snapshot_section(file, &offset, &header.hierarchy_depths, world->hierarchy.depths.data(), world->hierarchy.depths.size(), sizeof(u32));
+    ok = ok && write_snapshot_section(file, &offset, &header.hierarchy_indices, world->hierarchy.indices.data(), world->hierarchy.indices.size(), sizeof(u32));
+    ok = ok && write_snapshot_section(file, &offset, &header.hierarchy_levels, levels.data(), levels.size(), sizeof(Snapshot_Level));
+    ok = ok && write_snapshot_section(file, &offset, &header.hierarchy_entities, level_entities.data(), level_entities.size(), sizeof(Entity_Handle));
+    ok = ok && write_snapshot_section(file, &offset, &header.hierarchy_parents, level_parents.data(), level_parents.size(), sizeof(u32));
+    ok = ok && write_snapshot_section(file, &offset, &header.hierarchy_nodes, world->hierarchy.nodes.data(), world->hierarchy.nodes.size(), sizeof(Hierarchy_Node));
+    ok = ok && write_snapshot_section(file, &offset, &header.assets, fixup.file_assets.data(), fixup.file_assets.size(), sizeof(Snapshot_Asset));
+    ok = ok && write_snapshot_section(file, &offset, &header.strings, fixup.strings.data(), fixup.strings.size(), sizeof(char));
+
+    ok = ok && fseek(file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok) {
+        printf("[Snapshot] failed to write `%s`\n", filepath);
+    }
+    return ok;
+}
+
+/***************************************************************************
+ * Loading
+ ***************************************************************************/
+
+template <typename T>
+static inline const T*
+get_snapshot_section(u8* data, usize size, const Snapshot_Section& section) {
+    if (section.offset > size || section.count > (size - section.offset)/sizeof(T)) {
+        return NULL;
+    }
+    return (const T*) (data + section.offset);
+}
+
+static bool
+validate_snapshot(const Snapshot_Header* header, u8* data, usize size) {
+    if (header->magic != snapshot_magic) return false;
+    if (header->version != snapshot_version) return false;
+    if (header->chunk_size != chunk_size || header->chunks_per_page != chunks_per_page) return false;
+    if (header->column_alignment != column_alignment) return false;
+    if (header->chunks.offset % page_alignment != 0) return false;
+
+    usize chunk_bytes = align_forward((usize) header->num_chunks, chunks_per_page)*chunk_size;
+    if (header->chunks.offset > size || chunk_bytes > size - header->chunks.offset) return false;
+
+    const Snapshot_Section* sections = &header->components;
+    usize sizes[] = {
+        sizeof(Snapshot_Component), sizeof(u8), sizeof(u32), sizeof(Entity), sizeof(u32),
+        sizeof(Snapshot_Archetype), sizeof(u32), sizeof(u32), sizeof(u32), sizeof(Snapshot_Level),
+        sizeof(Entity_Handle), sizeof(u32), sizeof(Hierarchy_Node), sizeof(Snapshot_Asset), sizeof(char)
+    };
+    for (int i = 0; i < array_count(sizes); i++) {
+        if (sections[i].offset > size || sections[i].count > (size - sections[i].offset)/sizes[i]) {
+            return false;
+        }
+    }
+
+    // NOTE(alexander): component ids are assigned at compile time, the layout has to be the same as when saved
+    const Snapshot_Component* components = (const Snapshot_Component*) (data + header->components.offset);
+    if (header->components.count != max_component_types) return false;
+    for (u32 id = 0; id < max_component_types; id++) {
+        const Component_Info& info = component_infos[id];
+        if (components[id].name[0] == 0) continue;
+        if (!info.name || strncmp(info.name, components[id].name, max_snapshot_component_name) != 0 ||
+            info.size != components[id].size || info.alignment != components[id].alignment) {
+            printf("[Snapshot] component `%.*s` doesn't match the registered component\n",
+                   (int) max_snapshot_component_name, components[id].name);
+            return false;
+        }
+    }
+
+    if (header->chunk_counts.count != header->num_chunks) return false;
+    if (header->handles.count != header->generations.count) return false;
+    if (header->hierarchy_entities.count != header->hierarchy_parents.count) return false;
+    if (header->hierarchy_nodes.count != header->hierarchy_depths.count ||
+        header->hierarchy_nodes.count != header->hierarchy_indices.count) return false;
+
+    // NOTE(alexander): the sections are in bounds, now check that everything they refer to is as well
+    const Snapshot_Archetype* archetypes = get_snapshot_section<Snapshot_Archetype>(data, size, header->archetypes);
+    const u32* chunk_counts = get_snapshot_section<u32>(data, size, header->chunk_counts);
+    const Entity* entities = get_snapshot_section<Entity>(data, size, header->entities);
+    const u32* handles = get_snapshot_section<u32>(data, size, header->handles);
+    const Snapshot_Level* levels = get_snapshot_section<Snapshot_Level>(data, size, header->hierarchy_levels);
+
+    for (u64 i = 0; i < header->archetypes.count; i++) {
+        const Snapshot_Archetype& snapshot_archetype = archetypes[i];
+        if (snapshot_archetype.first_chunk > header->num_chunks ||
+            snapshot_archetype.num_chunks > header->num_chunks - snapshot_archetype.first_chunk) {
+            return false;
+        }
+        for (u64 j = 0; j < i; j++) {
+            if (archetypes[j].component_mask == snapshot_archetype.component_mask) return false;
+        }
+
+        Archetype archetype = {};
+        for (u32 id = 0; id < max_component_types; id++) {
+            if ((snapshot_archetype.component_mask & component_mask_bit(id)) == 0) continue;
+            if (components[id].name[0] == 0) return false;
+            archetype.component_ids.push_back(id);
+            archetype.component_sizes.push_back(component_infos[id].size);
+        }
+        initialize_archetype_layout(&archetype);
+        for (u32 c = 0; c < snapshot_archetype.num_chunks; c++) {
+            if (chunk_counts[snapshot_archetype.first_chunk + c] > archetype.chunk_capacity) return false;
+        }
+    }
+
+    for (u64 i = 0; i < header->entities.count; i++) {
+        const Entity& entity = entities[i];
+        if (entity.archetype >= header->archetypes.count) return false;
+        const Snapshot_Archetype& archetype = archetypes[entity.archetype];
+        if (entity.chunk >= archetype.num_chunks) return false;
+        if (entity.row >= chunk_counts[archetype.first_chunk + entity.chunk]) return false;
+
+        u32 index = get_entity_index(entity.handle);
+        if (index >= header->handles.count || handles[index] != i) return false;
+    }
+
+    for (u64 i = 0; i < header->hierarchy_levels.count; i++) {
+        if (levels[i].first > header->hierarchy_entities.count ||
+            levels[i].count > header->hierarchy_entities.count - levels[i].first) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Replaces everything in the world with the snapshot, the chunks are used directly from
+ * the mapped file (copy on write) and the rest is copied in bulk. References to assets
+ * are resolved by name in assets. Returns false if the file is missing or not compatible,
+ * the world is left untouched in that case.
+ */
+bool
+load_world_snapshot(World* world, const char* filepath, Snapshot_Assets* assets) {
+    usize size = 0;
+    u8* data = map_file_copy_on_write(filepath, &size);
+    if (!data) {
+        printf("[Snapshot] cannot open `%s`\n", filepath);
+        return false;
+    }
+
+    const Snapshot_Header* header = (const Snapshot_Header*) data;
+    if (size < sizeof(Snapshot_Header) || !validate_snapshot(header, data, size)) {
+        printf("[Snapshot] `%s` is corrupted or not a compatible world snapshot\n", filepath);
+        unmap_file(data, size);
+        return false;
+    }
+
+    const Snapshot_Archetype* archetypes = get_snapshot_section<Snapshot_Archetype>(data, size, header->archetypes);
+    const u32* chunk_counts = get_snapshot_section<u32>(data, size, header->chunk_counts);
+    const Entity* entities = get_snapshot_section<Entity>(data, size, header->entities);
+    const Snapshot_Level* levels = get_snapshot_section<Snapshot_Level>(data, size, header->hierarchy_levels);
+
+    clear_world(world);
+    Chunk_Pool* pool = &world->chunk_pool;
+    pool->mapped_memory = data;
+    pool->mapped_size = size;
+
+    // Adopt the chunk pages directly from the mapped file
+    u32 num_pages = (u32) ((header->num_chunks + chunks_per_page - 1)/chunks_per_page);
+    pool->pages.resize(num_pages);
+    for (u32 i = 0; i < num_pages; i++) {
+        Chunk_Page& page = pool->pages[i];
+        page.memory = NULL;
+        page.data = data + header->chunks.offset + i*chunks_per_page*chunk_size;
+        u32 num_used = min(header->num_chunks - i*(u32) chunks_per_page, (u32) chunks_per_page);
+        page.used_mask = num_used == 64 ? ~(u64) 0 : ((u64) 1 << num_used) - 1;
+    }
+    pool->num_used_chunks = header->num_chunks;
+    rebuild_chunk_free_list(pool);
+
+    // Recreate the archetypes, the chunk layout is the same since the component types matches
+    Snapshot_Fixup fixup = {};
+    fixup.assets = assets;
+    fixup.is_loading = true;
+    fixup.strings.assign(data + header->strings.offset, data + header->strings.offset + header->strings.count);
+    fixup.strings.push_back(0);
+
+    const Snapshot_Asset* file_assets = get_snapshot_section<Snapshot_Asset>(data, size, header->assets);
+    fixup.asset_remap.resize(header->assets.count, -1);
+    for (u64 i = 0; i < header->assets.count; i++) {
+        if (file_assets[i].name >= header->strings.count) continue;
+        const char* name = &fixup.strings[file_assets[i].name];
+        const std::vector<std::string>& names = file_assets[i].type == Snapshot_Asset_Mesh ? assets->mesh_names
+                                                                                           : assets->pointer_names;
+        for (u32 j = 0; j < names.size(); j++) {
+            if (names[j] == name) {
+                fixup.asset_remap[i] = (i32) j;
+                break;
+            }
+        }
+        if (fixup.asset_remap[i] < 0) {
+            printf("[Snapshot] missing asset `%s`\n", name);
+        }
+    }
+
+    std::vector<u32> archetype_remap(header->archetypes.count);
+    for (u64 i = 0; i < header->archetypes.count; i++) {
+        std::vector<u32> ids;
+        std::vector<u32> sizes;
+        for (u32 id = 0; id < max_component_types; id++) {
+            if (archetypes[i].component_mask & component_mask_bit(id)) {
+                ids.push_back(id);
+                sizes.push_back(component_infos[id].size);
+            }
+        }
+        u32 archetype_index = find_or_create_archetype(world, ids, sizes);
+        archetype_remap[i] = archetype_index;
+
+        Archetype& archetype = world->archetypes[archetype_index];
+        archetype.chunks.resize(archetypes[i].num_chunks);
+        for (u32 c = 0; c < archetypes[i].num_chunks; c++) {
+            u32 chunk_index = archetypes[i].first_chunk + c;
+            Chunk& chunk = archetype.chunks[c];
+            chunk.data = data + header->chunks.offset + chunk_index*chunk_size;
+            chunk.count = chunk_counts[chunk_index];
+            chunk.page = chunk_index/(u32) chunks_per_page;
+
+            for (int k = 0; k < archetype.component_ids.size(); k++) {
+                const Component_Info& info = component_infos[archetype.component_ids[k]];
+                if (info.snapshot) {
+                    u8* column = get_component_column(archetype, chunk, k);
+                    info.snapshot(&fixup, column, column, chunk.count);
+                }
+            }
+            mark_chunk_changed(world, archetype, chunk);
+            record_chunk_observer_events(world, Component_Observer::On_Add, archetype, chunk, 0, chunk.count);
+        }
+    }
+
+    // Copy the entities and the hierarchy in bulk
+    const u8* generations = get_snapshot_section<u8>(data, size, header->generations);
+    const u32* removed_entity_indices = get_snapshot_section<u32>(data, size, header->removed_entity_indices);
+    const u32* handles = get_snapshot_section<u32>(data, size, header->handles);
+    world->generations.assign(generations, generations + header->generations.count);
+    world->removed_entity_indices.assign(removed_entity_indices, removed_entity_indices + header->removed_entity_indices.count);
+    world->entities.assign(entities, entities + header->entities.count);
+    world->handles.assign(handles, handles + header->handles.count);
+    for (u32 i = 0; i < world->entities.size(); i++) {
+        world->entities[i].archetype = archetype_remap[world->entities[i].archetype];
+    }
+
+    const u32* depths = get_snapshot_section<u32>(data, size, header->hierarchy_depths);
+    const u32* indices = get_snapshot_section<u32>(data, size, header->hierarchy_indices);
+    const Entity_Handle* level_entities = get_snapshot_section<Entity_Handle>(data, size, header->hierarchy_entities);
+    const u32* level_parents = get_snapshot_section<u32>(data, size, header->hierarchy_parents);
+    const Hierarchy_Node* nodes = get_snapshot_section<Hierarchy_Node>(data, size, header->hierarchy_nodes);
+    world->hierarchy.nodes.assign(nodes, nodes + header->hierarchy_nodes.count);
+    world->hierarchy.depths.assign(depths, depths + header->hierarchy_depths.count);
+    world->hierarchy.indices.assign(indices, indices + header->hierarchy_indices.count);
+    world->hierarchy.levels.resize(header->hierarchy_levels.count);
+    for (u32 i = 0; i < world->hierarchy.levels.size(); i++) {
+        Hierarchy_Level& level = world->hierarchy.levels[i];
+        level.entities.assign(level_entities + levels[i].first, level_entities + levels[i].first + levels[i].count);
+        level.parents.assign(level_parents + levels[i].first, level_parents + levels[i].first + levels[i].count);
+    }
+    world->hierarchy.are_locations_valid = false; // NOTE(alexander): the chunks are mapped from the file
+
+    return true;
+}